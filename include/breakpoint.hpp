@@ -18,6 +18,14 @@ public:
 
 	bool		  is_enabled() const;
 	std::intptr_t get_address() const;
+	// original byte under the INT3 of an enabled breakpoint
+	uint8_t		  get_saved_data() const;
+	// the breakpoint now belongs to process `pid`, whose memory is a copy of
+	// the original one (fork)
+	void		  set_pid(const pid_t pid);
+	// the INT3 was written along with others (Breakpoint_Table::enable_all),
+	// `saved_data` is the byte it replaced
+	void		  set_enabled(const uint8_t saved_data);
 
 private:
 	pid_t		  m_pid;
@@ -0,0 +1,73 @@
+// breakpoints indexed by address
+#pragma once
+#include <breakpoint.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h> // pid_t
+#include <vector>
+
+namespace mini_debugger {
+
+// open addressing (linear probing) table of breakpoints. Addresses and
+// breakpoints live in two flat arrays so that a probe only walks the 8 byte
+// keys, memory is 2-4 slots of 32 bytes per breakpoint. In front of it, a
+// bitmap with one bit per page (addresses sharing a bit modulo its size)
+// answers "no breakpoint here" without hashing for pages we never touched
+class Breakpoint_Table
+{
+public:
+	class iterator
+	{
+	public:
+		iterator(Breakpoint_Table* table, std::size_t slot);
+
+		Breakpoint& operator*() const;
+		iterator&	operator++();
+		bool		operator!=(const iterator& other) const;
+
+	private:
+		void skip_unused();
+
+		Breakpoint_Table* m_table;
+		std::size_t		  m_slot;
+	};
+
+	Breakpoint_Table();
+
+	// breakpoint at `addr`, nullptr if there is none
+	Breakpoint*		  find(const std::intptr_t addr);
+	const Breakpoint* find(const std::intptr_t addr) const;
+	std::size_t		  count(const std::intptr_t addr) const;
+	// throws std::out_of_range if there is no breakpoint at `addr`
+	Breakpoint&		  at(const std::intptr_t addr);
+
+	// add `bp`, replacing the breakpoint at the same address if any
+	Breakpoint& insert(const Breakpoint& bp);
+	bool		erase(const std::intptr_t addr);
+	// make room for `n` breakpoints without rehashing
+	void		reserve(const std::size_t n);
+	// write the INT3s of all disabled breakpoints into process `pid`, with
+	// one read and one write per page of code instead of a peek and a poke
+	// per breakpoint. Returns the number of breakpoints enabled
+	std::size_t enable_all(const pid_t pid);
+
+	std::size_t size() const;
+	iterator	begin();
+	iterator	end();
+
+private:
+	std::size_t home_slot(const std::intptr_t addr) const;
+	bool		page_may_have_breakpoint(const std::intptr_t addr) const;
+	void		mark_page(const std::intptr_t addr);
+	void		rehash(const std::size_t capacity);
+
+	std::vector<std::intptr_t> m_keys;
+	std::vector<Breakpoint>	   m_values;
+	std::vector<uint64_t>	   m_page_bits;
+	std::size_t				   m_size;
+	std::size_t				   m_tombstones;
+	// 64 - log2(capacity), the shift of the multiplicative hash
+	unsigned				   m_shift;
+};
+
+};
@@ -0,0 +1,99 @@
+// tab completion of the command line: commands, ELF symbols (mangled, and
+// demangled once a thread of ours has demangled them), source files and the
+// lines of a source file. The names are kept sorted and front-coded, a C++
+// symbol table shares long prefixes (_ZN4core3fmt...) and takes a fraction of
+// its size in the file
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <debug_image.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace mini_debugger {
+
+// sorted set of strings in blocks of BLOCK_NAMES: the first name of a block
+// is stored whole, the others as the length of the prefix shared with the
+// name before them and the rest. A lookup is a binary search over the first
+// names of the blocks and a scan of the names which follow
+class String_Table
+{
+public:
+	String_Table();
+	// `names` need not be sorted nor unique, they are copied
+	explicit String_Table(std::vector<std::string_view> names);
+
+	// up to `limit` names starting with `prefix`, in order, appended to
+	// `out`
+	void complete(const std::string_view	prefix,
+				  const std::size_t			limit,
+				  std::vector<std::string>& out) const;
+
+	std::size_t size() const;
+	// bytes of memory held by the table
+	std::size_t memory_size() const;
+
+private:
+	static constexpr std::size_t BLOCK_NAMES{ 16 };
+
+	// first name of the block at `offset` in m_data
+	std::string_view block_head(const std::size_t offset) const;
+
+	// per name: varint shared length, varint length of the rest, the rest
+	std::string				 m_data;
+	// offset in m_data of each block
+	std::vector<std::size_t> m_blocks;
+	std::size_t				 m_size;
+};
+
+class Completer
+{
+public:
+	// `commands`: the first words of a command line. The symbols of `image`
+	// are read on a thread of ours, they are offered once it is done
+	Completer(std::shared_ptr<const Debug_Image> image,
+			  const std::vector<std::string_view>& commands);
+	~Completer();
+
+	// lines completing the last word of `line`, at most `limit`
+	std::vector<std::string> complete(const std::string_view line,
+									  const std::size_t		 limit);
+
+	const std::shared_ptr<const Debug_Image>& image() const;
+
+private:
+	// demangled names of the C++ functions, without their parameters
+	void demangle_symbols();
+	void complete_word(const std::string_view	 word,
+					   const std::size_t		 limit,
+					   std::vector<std::string>& out);
+	// lines beginning a statement in the units named like `file`
+	void complete_line(const std::string_view	 file,
+					   const std::string_view	 line,
+					   const std::size_t		 limit,
+					   std::vector<std::string>& out);
+	// names of the units and their base names, read on first use: libelfin
+	// must only be used by one thread
+	const String_Table& files();
+
+	std::shared_ptr<const Debug_Image> m_image;
+	String_Table					   m_commands;
+	std::optional<String_Table>		   m_files;
+
+	// published by the threads once built, guarded by m_mutex
+	std::mutex							m_mutex;
+	std::shared_ptr<const String_Table> m_symbols;
+	std::shared_ptr<const String_Table> m_demangled;
+	// the threads give up when set
+	std::atomic<bool>					m_stopping;
+	std::thread							m_indexer;
+	// started by the first completion of a symbol
+	std::thread							m_demangler;
+};
+
+};
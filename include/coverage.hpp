@@ -0,0 +1,87 @@
+// line coverage of a program built without instrumentation: an INT3 on the
+// first instruction of every statement, each one taken out the first time
+// it is hit. A line is covered once any of its statements ran, after which
+// the program runs at full speed through it
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/types.h> // pid_t
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace mini_debugger {
+
+// address of a statement (in the process) and its source line
+struct Coverage_Point
+{
+	std::uintptr_t	 address;
+	std::string_view file;
+	unsigned		 line;
+};
+
+class Coverage
+{
+public:
+	explicit Coverage(const pid_t pid);
+	~Coverage();
+	Coverage(const Coverage&)			 = delete;
+	Coverage& operator=(const Coverage&) = delete;
+
+	// plant the one-shot breakpoints of `points`. Each page of code is read
+	// and written back once, whatever the number of statements on it.
+	// Returns the number of breakpoints planted
+	std::size_t insert(const std::vector<Coverage_Point>& points);
+	// `address` is a breakpoint not hit so far: put the original byte back
+	// (the instruction can be run right away) and mark its line covered.
+	// False if `address` is not one of our breakpoints
+	bool		hit(const std::uintptr_t address);
+	// `address` is one of our breakpoints, hit or not. A thread which ran
+	// into it before another one took it out has to be rewound all the same
+	bool		has_breakpoint(const std::uintptr_t address) const;
+
+	// the memory of process `pid` is a copy of ours (fork) or is ours
+	// (vfork): put back the original bytes under the breakpoints left
+	void restore(const pid_t pid) const;
+	// plant the breakpoints left again after a restore() of our memory
+	void replant() const;
+	// the address space of the breakpoints is gone (exec), lines not
+	// covered so far stay so
+	void forget_breakpoints();
+
+	std::size_t line_count() const;
+	std::size_t covered_line_count() const;
+	// write the lines in the lcov tracefile format (geninfo/genhtml)
+	bool		write_lcov(const std::string& path) const;
+
+private:
+	struct Breakpoint_Site
+	{
+		uint32_t line;
+		uint8_t	 saved_data;
+	};
+
+	struct Source_Line
+	{
+		uint32_t file;
+		unsigned line;
+		bool	 covered;
+	};
+
+	// write, page by page, INT3 or the saved byte at every breakpoint left
+	void write_breakpoints(const pid_t pid, const bool plant) const;
+
+	pid_t m_pid;
+	// /proc/<pid>/mem, open for the whole run: a hit costs a single pwrite
+	int	  m_mem_fd;
+	// breakpoints not hit yet, by address
+	std::unordered_map<std::uintptr_t, Breakpoint_Site> m_sites;
+	// breakpoints hit and taken out, by address
+	std::unordered_set<std::uintptr_t>					m_hit;
+	std::vector<Source_Line>							m_lines;
+	std::vector<std::string>							m_files;
+};
+
+};
@@ -0,0 +1,125 @@
+// parsed ELF and DWARF of an executable. Every process running the same
+// binary (forked workers, a re-executed program) shares one image, so its
+// debug information is loaded and indexed only once
+#pragma once
+#include <cstdint>
+#include <debug_index.hpp>
+#include <debug_section_loader.hpp>
+#include <dwarf/dwarf++.hh>
+#include <elf/elf++.hh>
+#include <line_table.hpp>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mini_debugger {
+
+// defined symbol of .symtab or .dynsym, its name points into the file
+struct Elf_Symbol
+{
+	std::string_view name;
+	elf::stt		 type;
+	// address in the file
+	std::uintptr_t	 value;
+};
+
+struct Debug_Image
+{
+	std::string path;
+	elf::elf	elf;
+
+	// the DWARF is only parsed by the first caller: shared libraries are
+	// opened for their symbols far more often than for their debug info
+	const dwarf::dwarf& get_dwarf() const;
+	// false if the file has no debug information (get_dwarf() is then an
+	// invalid dwarf::dwarf which must not be queried)
+	bool				has_dwarf() const;
+	// compact line table of `unit`, decoded by the first caller and kept
+	// until the debug info budget evicts it
+	std::shared_ptr<const Line_Table>
+	line_table(const dwarf::compilation_unit& unit) const;
+	// defined symbols named `name`, found by a binary search of the symbols
+	// sorted by name by the first caller
+	std::vector<Elf_Symbol> symbols_named(const std::string_view name) const;
+
+	// unit whose code covers the DWARF address `pc`. Found through the
+	// accelerator tables when the file has them, else by reading the ranges
+	// of every unit. nullptr if there is none
+	const dwarf::compilation_unit* unit_at(const std::uintptr_t pc) const;
+	// units which may have a DIE named `name`: the ones the name tables
+	// list, every unit if they do not list it (no table, or a C++ name only
+	// indexed with its scope)
+	std::vector<const dwarf::compilation_unit*>
+	units_named(const std::string_view name) const;
+
+	~Debug_Image();
+
+private:
+	struct Cached_Line_Table
+	{
+		std::shared_ptr<const Line_Table> table;
+		std::size_t						  size;
+		// position in the least recently used list shared by all images
+		std::list<std::pair<const Debug_Image*, dwarf::section_offset>>::
+			iterator lru;
+	};
+
+	// drop the least recently used line tables until the budget is met
+	static void evict_line_tables();
+	friend void set_debug_info_budget(const std::size_t bytes);
+
+	const Debug_Index&			   index() const;
+	const dwarf::compilation_unit* unit_at_offset(
+		const dwarf::section_offset offset) const;
+
+	mutable std::once_flag						  m_dwarf_once;
+	mutable std::shared_ptr<Debug_Section_Loader> m_loader;
+	mutable dwarf::dwarf						  m_dwarf;
+
+	mutable std::once_flag				 m_index_once;
+	mutable std::unique_ptr<Debug_Index> m_index;
+
+	mutable std::once_flag			m_symbols_once;
+	mutable std::vector<Elf_Symbol> m_symbols;
+
+	// by offset of the unit in .debug_info, guarded by the lock of the
+	// line table cache
+	mutable std::map<dwarf::section_offset, Cached_Line_Table> m_line_tables;
+	// source paths of all the line tables, each stored once and never
+	// evicted: Line_Entry points into it
+	mutable std::mutex			  m_file_names_mutex;
+	mutable std::set<std::string> m_file_names;
+};
+
+// memory taken by decoded debug information (the line tables) of all images
+struct Debug_Info_Usage
+{
+	// 0 without budget
+	std::size_t budget;
+	std::size_t resident;
+	// total size of the tables dropped so far, and their number
+	std::size_t evicted;
+	std::size_t evictions;
+	// inflated compressed sections, kept while their image is used and not
+	// counted against the budget
+	std::size_t inflated;
+};
+
+// keep the decoded debug information of all images under `bytes`, 0 for no
+// limit. Past it the least recently used line tables are dropped, they are
+// decoded again from the file when needed
+void			 set_debug_info_budget(const std::size_t bytes);
+Debug_Info_Usage debug_info_usage();
+
+// the image of `path`, loaded if no process uses it yet. Throws if the file
+// cannot be opened. Only the ELF headers are read here
+std::shared_ptr<const Debug_Image>
+load_debug_image(const std::string& path);
+
+};
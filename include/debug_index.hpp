@@ -0,0 +1,83 @@
+// accelerator tables emitted by the compiler or the linker: .debug_aranges
+// (address -> unit), .debug_names and .gdb_index (name -> units). With them
+// a lookup only parses the units it needs instead of every DIE of the
+// program. A binary may have none of them, every query then says so and the
+// caller falls back to scanning the units
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <debug_section_loader.hpp>
+#include <dwarf/dwarf++.hh>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace mini_debugger {
+
+class Debug_Index
+{
+public:
+	// reads the headers and the address ranges, the name tables are only
+	// searched on lookup
+	explicit Debug_Index(Debug_Section_Loader& loader);
+
+	// offset in .debug_info of the unit whose code covers the DWARF address
+	// `pc`, std::nullopt if the tables do not cover it
+	std::optional<dwarf::section_offset>
+	unit_at(const std::uintptr_t pc) const;
+	// offsets in .debug_info of the units with an entry named `name`, empty
+	// if no name table lists it
+	std::vector<dwarf::section_offset>
+	units_named(const std::string_view name) const;
+
+private:
+	struct Address_Range
+	{
+		std::uintptr_t		  low;
+		std::uintptr_t		  high;
+		dwarf::section_offset unit;
+	};
+
+	// one name index of .debug_names, the linker concatenates those of
+	// every object file
+	struct Name_Index
+	{
+		std::vector<dwarf::section_offset> units;
+		const uint8_t*					   buckets;
+		const uint8_t*					   hashes;
+		const uint8_t*					   string_offsets;
+		const uint8_t*					   entry_offsets;
+		const uint8_t*					   abbrevs;
+		const uint8_t*					   entries;
+		const uint8_t*					   end;
+		uint32_t						   bucket_count;
+		uint32_t						   name_count;
+		bool							   dwarf64;
+	};
+
+	void read_aranges(const uint8_t* data, const std::size_t size);
+	void read_debug_names(const uint8_t* data, const std::size_t size);
+	void read_gdb_index(const uint8_t* data, const std::size_t size);
+
+	void find_in_name_index(const Name_Index&				   index,
+							const std::string_view			   name,
+							std::vector<dwarf::section_offset>& units) const;
+	void find_in_gdb_index(const std::string_view				name,
+						   std::vector<dwarf::section_offset>& units) const;
+
+	// sorted by low address
+	std::vector<Address_Range> m_ranges;
+
+	std::vector<Name_Index> m_name_indices;
+	const uint8_t*			m_strings;
+	std::size_t				m_strings_size;
+
+	// .gdb_index, m_gdb_slots is a power of 2 (0 if there is no index)
+	std::vector<dwarf::section_offset> m_gdb_units;
+	const uint8_t*					   m_gdb_symbols;
+	const uint8_t*					   m_gdb_constants;
+	const uint8_t*					   m_gdb_end;
+	uint32_t						   m_gdb_slots;
+};
+
+};
@@ -0,0 +1,73 @@
+// dwarf::loader reading the debug sections of an ELF file whether they are
+// stored as is, compressed in place (SHF_COMPRESSED, -gz=zlib / -gz=zstd) or
+// in the older .zdebug_* form. A compressed section is only inflated when
+// libdwarf++ first asks for it; that first access also starts inflating
+// .debug_info, .debug_abbrev and .debug_line on background threads, since a
+// DWARF query soon needs them. libdwarf++ keeps pointers into the sections,
+// they stay inflated as long as the loader
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <dwarf/dwarf++.hh>
+#include <elf/elf++.hh>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mini_debugger {
+
+class Debug_Section_Loader : public dwarf::loader
+{
+public:
+	// `file` has to outlive the loader, sections are not copied until they
+	// are inflated
+	explicit Debug_Section_Loader(const elf::elf& file);
+	~Debug_Section_Loader();
+
+	const void* load(dwarf::section_type section, size_t* size_out) override;
+	// same for the sections libdwarf++ does not know of (.debug_names,
+	// .gdb_index). `name` is the uncompressed name (.debug_*), nullptr if
+	// the file has no such section
+	const void* load_section(const std::string& name, std::size_t* size_out);
+
+private:
+	enum class Compression
+	{
+		none,
+		zlib, // SHF_COMPRESSED with ELFCOMPRESS_ZLIB, or .zdebug_*
+		zstd, // SHF_COMPRESSED with ELFCOMPRESS_ZSTD
+	};
+
+	struct Section
+	{
+		std::string			 name;
+		Compression			 compression;
+		// compressed stream and the size it inflates to
+		const uint8_t*		 data;
+		std::size_t			 size;
+		std::size_t			 inflated_size;
+		// filled once, by whichever thread gets to it first
+		std::once_flag		 once;
+		std::vector<uint8_t> contents;
+		bool				 valid;
+	};
+
+	void inflate(Section& section);
+	// inflate the compressed sections of PREFETCHED_SECTIONS in the
+	// background, once
+	void start_prefetch();
+
+	elf::elf										 m_elf;
+	// by name, .zdebug_* under their .debug_* name
+	std::map<std::string, std::unique_ptr<Section>> m_sections;
+	std::once_flag									 m_prefetch_once;
+	std::vector<std::future<void>>					 m_prefetch;
+};
+
+// bytes of the sections inflated by all the loaders alive
+std::size_t inflated_debug_bytes();
+
+};
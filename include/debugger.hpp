@@ -1,11 +1,29 @@
 #pragma once
 #include <breakpoint.hpp>
+#include <breakpoint_table.hpp>
+#include <completion.hpp>
+#include <coverage.hpp>
 #include <cstdint> // intptr_t
+#include <debug_image.hpp>
+#include <displaced_step.hpp>
 #include <dwarf/dwarf++.hh>
 #include <elf/elf++.hh>
+#include <functional>
+#include <heap_tracker.hpp>
+#include <latency_tracer.hpp>
+#include <line_table.hpp>
+#include <map>
+#include <memory>
+#include <memory_map.hpp>
+#include <module_index.hpp>
+#include <optional>
+#include <page_tracker.hpp>
 #include <signal.h>
 #include <string>
-#include <unordered_map>
+#include <sys/ptrace.h> // __ptrace_request
+#include <trace_recorder.hpp>
+#include <tracepoint.hpp>
+#include <vector>
 
 template class std::initializer_list<dwarf::taddr>;
 namespace mini_debugger {
@@ -26,17 +44,152 @@ struct symbol
 	std::uintptr_t addr;
 };
 
+// software watchpoint over a memory region of any size
+struct Watchpoint
+{
+	unsigned			 id;
+	std::uintptr_t		 address;
+	std::size_t			 length;
+	// contents of the region at the last stop
+	std::vector<uint8_t> contents;
+};
+
+// variable or 0xADDRESS printed at every stop
+struct Display
+{
+	unsigned	   id;
+	std::string	   expression;
+	// where the value was last read from, 0 if it lives in a register
+	std::uintptr_t address;
+	std::uint64_t  value;
+	bool		   valid;
+};
+
+// a command run forward from a stop, replayed by reverse-step/reverse-next
+enum class Movement
+{
+	step,
+	next,
+	finish,
+	cont,
+};
+
+struct Movement_Record
+{
+	Movement	  movement;
+	// rbp at the stop the command started from
+	std::intptr_t frame;
+};
+
+// a process of the session other than the current one, its state is swapped
+// with the Debugger members when it becomes current
+struct Inferior
+{
+	unsigned							id;
+	std::string							prog_name;
+	std::shared_ptr<const Debug_Image>	image;
+	dwarf::dwarf						dwarf;
+	elf::elf							elf;
+	pid_t								pid;
+	pid_t								tid;
+	std::vector<pid_t>					threads;
+	bool								attached;
+	std::intptr_t						load_address;
+	Breakpoint_Table					breakpoints;
+	std::map<std::intptr_t, std::function<void()>> internal_breakpoints;
+	Module_Index						modules;
+	std::uintptr_t						r_debug;
+	Memory_Map							memory_map;
+	std::unique_ptr<Tracepoint_Manager> tracepoints;
+	std::vector<Watchpoint>				watchpoints;
+	Page_Tracker						page_tracker;
+	Displaced_Stepper					displaced_stepper;
+	__ptrace_request					resume_request;
+	std::vector<Movement_Record>		history;
+	std::vector<std::intptr_t>			vfork_breakpoints;
+	pid_t								vfork_parent;
+};
+
+// a copy of the process parked at a stop by the checkpoint command, never
+// resumed itself: restart runs a fresh fork of it
+struct Checkpoint
+{
+	unsigned		 id;
+	unsigned		 inferior_id;
+	pid_t			 pid;
+	std::intptr_t	 pc;
+	// the INT3s in its memory
+	Breakpoint_Table breakpoints;
+	// number of forward commands run before it
+	std::size_t		 history;
+};
+
+// allocation functions of `heap track` with a result, free has none
+enum class Heap_Function
+{
+	malloc,
+	calloc,
+	realloc,
+};
+
+// a call to an allocation function, completed at its return breakpoint
+struct Heap_Call
+{
+	Heap_Function function;
+	// its first two arguments
+	uint64_t	  args[2];
+	// rsp at the entry, the return pops the return address above it
+	std::intptr_t stack_pointer;
+	uint32_t	  stack;
+};
+
 static constexpr int WORD_SIZE{ 16 };
 
 static constexpr short DEBUG_WINDOW_LEN{ 78 };
 
+// path of the executable running as process `pid`
+std::string
+executable_of(const pid_t pid);
+
+// how the program is started, by main() and again by the run command
+struct Launch_Options
+{
+	std::string				 program;
+	std::vector<std::string> args;
+	// variables set (or removed when empty) on top of our own environment
+	std::map<std::string, std::optional<std::string>> environment;
+	// files replacing stdin and stdout, empty to share ours
+	std::string				 input;
+	std::string				 output;
+	// seccomp filter installed before exec (see trace_syscalls)
+	std::vector<long>		 syscalls;
+};
+
+// fork and exec the program of `options` stopped under ptrace, with address
+// space randomization disabled so addresses stay the same from run to run.
+// Returns the pid of the process, -1 if it could not be forked
+pid_t
+launch_program(const Launch_Options& options);
+
 class Debugger
 {
+	// serves the process over the GDB remote protocol with our back end
+	friend class Gdb_Server;
+
 public:
 	explicit Debugger(std::string prog_name, const pid_t pid);
 
 	// start executing the debugger
 	void run();
+	// command lines completing the last word of `line`
+	std::vector<std::string> complete(const std::string_view line);
+	// seize every thread of an already running process and stop it
+	bool attach();
+	// what the run command starts again, the program is not relaunched
+	// without it
+	void set_launch_options(Launch_Options options);
+	// remove all breakpoints and let the process run on its own again
+	void detach();
 	// set a breakpoint at given address 0xADDRESS
 	void set_breakpoint_at_address(const std::intptr_t addr);
 	// set a breakpoint at given function name (does not support function
@@ -44,6 +197,23 @@ public:
 	void set_breakpoint_at_function(const std::string_view func_name);
 	void set_breakpoint_at_source_line(const std::string_view file,
 									   unsigned				  line);
+	// trace a function or 0xADDRESS without stopping the program, using a
+	// jump to a trampoline instead of an INT3
+	void set_tracepoint(const std::string_view location);
+	// report the system calls `numbers`, stopping on them if `stop` is set.
+	// They must be part of the seccomp filter the program is launched with
+	void trace_syscalls(const std::vector<long>& numbers, const bool stop);
+	// report every change of [address, address + length) at the next stops,
+	// the program is also stopped when a change is seen while it runs
+	void set_watchpoint(const std::uintptr_t address, const std::size_t length);
+	// print a variable of the current function or 0xADDRESS at every stop
+	void add_display(const std::string_view expression);
+	// run the launched program to its end with a one-shot breakpoint on
+	// every statement of the units whose name ends with one of `sources`
+	// (all units if empty), then write the lines hit to `output` in lcov
+	// format
+	bool collect_coverage(const std::vector<std::string>& sources,
+						  const std::string&			  output);
 
 	// print all registers's values
 	void dump_registers();
@@ -53,6 +223,9 @@ public:
 					  const unsigned		 n_lines_context = 3);
 	// unwind and print the stack
 	void print_backtrace();
+	// unwind the stacks of all the threads at once, with `group` threads
+	// with the same stack are printed together
+	void print_all_backtraces(const bool group);
 	void single_step_instruction();
 	void single_step_instruction_with_breakpoint_check();
 	// step in function
@@ -71,6 +244,26 @@ private:
 
 	// continue command for debugger
 	void continue_execution();
+	// continue one basic block at a time, recording every block
+	void continue_recording();
+	// append the current registers to the execution history
+	void record_state();
+	void handle_record_command(const std::vector<std::string>& args);
+	void handle_catch_syscall_command(const std::vector<std::string>& args);
+	// seccomp stop on a filtered system call: print a traced one and resume
+	// the thread, returns true if the debugger has to stop
+	bool handle_syscall_stop();
+
+	// print the changed watchpoints and the displays, called at each stop
+	void report_watches();
+	// compare the written pages of `watchpoint` with its contents, printing
+	// and saving the changes if `report` is set
+	bool check_watchpoint(Watchpoint& watchpoint, const bool report);
+	void print_display(Display& display);
+	// wait_for_signal() polling the watchpoints while the debugee runs
+	void wait_for_signal_watching();
+	std::optional<dwarf::expr_result>
+	locate_variable(const std::string_view name);
 
 	std::intptr_t read_memory(const std::intptr_t address);
 	void write_memory(const std::intptr_t address, const uint64_t value);
@@ -81,29 +274,228 @@ private:
 	// set program counter
 	void set_pc(const std::intptr_t pc);
 	void step_over_breakpoint();
+	// resume the current thread with PTRACE_CONT or a step request,
+	// delivering `signal` or else the signal held back for it
+	long resume(const __ptrace_request request, const int signal = 0);
+
+	// fork/vfork stop of the current process: keep, follow or detach the
+	// child. Returns true if the debugger has to stop
+	bool handle_fork_event(const int event);
+	bool handle_exec_event();
+	// a followed vfork child is done with the memory of its parent (exec or
+	// exit): take our INT3s out of it, and let the parent go if it is not
+	// kept
+	void end_vfork_sharing();
+	// thread `parent` created a thread: add it to the traced threads.
+	// Returns the new thread, stopped
+	pid_t handle_clone_event(const pid_t parent);
+	// remove the breakpoints of `inferior` and let it go
+	void detach_inferior(Inferior& inferior);
+	// stop of a process kept traced for the syscall filter only: resume it
+	// as if it was not traced
+	void resume_filtered_process(const pid_t tid, const int wait_status);
+	// exchange the current process with `inferior`
+	void swap_inferior(Inferior& inferior);
+	// the current process exited, continue with another inferior if any
+	bool switch_to_next_inferior();
+	void handle_inferior_command(const std::vector<std::string>& args);
+	void handle_set_command(const std::vector<std::string>& args);
 
+	// wait for the first stop of the launched program and set the tracing
+	// options
+	void wait_for_launch();
 	// wait until process m_pid is finished
 	void wait_for_signal();
+	// wait_for_signal() without reporting the stop. False if the stop was
+	// already handled (event, exit), the status is left in m_wait_status
+	bool wait_for_stop();
+	// stop/resume every traced thread except the current one
+	void stop_other_threads();
+	void resume_other_threads();
+	// stops are waited for on every thread and the others are stopped while
+	// the debugger has control: attached, or a launched program which
+	// created threads
+	bool traces_threads() const;
+	// stops are waited for on any process: several threads, or processes
+	// kept traced for the syscall filter
+	bool waits_for_any() const;
 
 	// get signal type when signal is received
 	siginfo_t get_signal_info();
 
 	// retrieve line entries and function DIEs from PC values
-	dwarf::die					get_function_from_pc(const std::intptr_t pc);
-	dwarf::line_table::iterator get_line_entry_from_pc(const std::intptr_t pc);
+	dwarf::die get_function_from_pc(const std::intptr_t pc);
+	// compact line table of the compilation unit containing `pc`
+	std::shared_ptr<const Line_Table>
+			   get_line_table_from_pc(const std::intptr_t pc);
+	Line_Entry get_line_entry_from_pc(const std::intptr_t pc);
 
 	void		  initialise_load_address();
 	std::intptr_t offset_load_address(const std::intptr_t addr);
 	std::intptr_t offset_dwarf_address(const std::intptr_t addr);
 
 	std::vector<symbol> lookup_symbol(const std::string_view symbol_name);
+	// symbols named `symbol_name` in the shared libraries, every library's
+	// symbol table is opened
+	std::vector<symbol>
+	lookup_library_symbol(const std::string_view symbol_name);
+	// function of a shared library containing `pc`, from its symbol table
+	std::optional<symbol> lookup_library_function(const std::intptr_t pc);
+
+	// breakpoint handled by the debugger itself, the program is resumed
+	// without stopping once `handler` ran. A handler already set at `addr`
+	// (r_brk, heap track, trace latency) runs first
+	void set_internal_breakpoint(const std::intptr_t addr,
+								 std::function<void()> handler);
+	// run the handler of the internal breakpoint the current thread just hit
+	// and step over it
+	void run_internal_breakpoint();
+	// address of the dynamic loader's r_debug (DT_DEBUG), 0 until the loader
+	// has initialised it
+	std::uintptr_t find_r_debug();
+	// re-read the loaded libraries from r_debug.r_map, set the rendezvous
+	// breakpoint (r_brk) the first time
+	void		   update_libraries();
+	void		   print_libraries();
+	void		   print_mappings();
+
+	// run a forward command, remembered for the reverse ones
+	void move(const Movement movement);
+	// fork the stopped process into a parked checkpoint
+	void take_checkpoint();
+	// replace the process by a fresh fork of checkpoint `id`, false if
+	// there is none or it could not be forked
+	bool restart_checkpoint(const unsigned id);
+	// back to the stop before the last forward command (`over_calls`: the
+	// last stop in the current function or a caller) by restarting the
+	// last checkpoint before it and replaying the commands in between
+	void reverse_step(const bool over_calls);
+	void print_checkpoints();
+	void kill_checkpoints();
+	// source around the pc of the current thread, or the pc alone
+	void print_location();
+	// kill the current process and start the program again (with `args`
+	// and redirections, the previous ones if none). The debug information
+	// and the breakpoints of the executable are kept
+	bool rerun(const std::vector<std::string>& args);
+	// SIGKILL the current process and reap all its threads, unless it was
+	// reaped already
+	void kill_process();
+	// a frame pointer and the return address above it belong to a stack
+	// frame: the frame is writable memory and the address is code
+	bool valid_frame(const std::intptr_t frame_pointer,
+					 const std::intptr_t return_address);
+	// function and line (or library) of a code address, for reports. The
+	// line of a return address is the one of the call before it
+	std::string describe_code_address(const std::intptr_t pc,
+									  const bool return_address = true);
+	// start recording the allocations of the program, the breakpoints are
+	// planted once the C library is loaded
+	void		track_heap();
+	// breakpoints on the entry of the allocation functions, false if the
+	// C library is not loaded yet
+	bool		plant_heap_breakpoints();
+	void		heap_function_entered(const Heap_Function function);
+	void		heap_function_returned();
+	// time the calls to `functions`, breakpoints on their entries
+	void		trace_latency(const std::vector<std::string>& functions);
+	void		latency_function_entered(const std::size_t function);
+	// handler of the return addresses of the calls seen by heap track and
+	// trace latency
+	void		traced_function_returned();
+	void		heap_block_freed();
+	// stack of return addresses of the current thread at a function entry
+	std::vector<std::uintptr_t> heap_stack();
+	// blocks not freed and the allocation sites with the most bytes and
+	// the most calls, `count` of each
+	void		print_heap_report(const std::size_t count);
+	// memory taken by decoded line tables against --max-debuginfo-mem
+	void		   print_debug_info_usage();
 
+	unsigned									  m_inferior_id;
 	std::string									  m_prog_name;
+	std::shared_ptr<const Debug_Image>			  m_image;
 	pid_t										  m_pid;
+	// thread reporting the last stop, registers are read from this thread
+	pid_t										  m_tid;
+	// threads seized by attach() or created by the program since, all
+	// stopped while the debugger has control
+	std::vector<pid_t>							  m_threads;
+	// threads of a launched program (not seized, PTRACE_INTERRUPT fails on
+	// them) sent a SIGSTOP by stop_other_threads() which they did not
+	// report yet
+	std::vector<pid_t>							  m_stopping_threads;
+	// signals other threads stopped with in stop_other_threads(), passed
+	// on by resume_other_threads(). The current thread's, held back by
+	// step_over_breakpoint(), is passed on by resume()
+	std::map<pid_t, int>						  m_pending_signals;
+	bool										  m_attached;
 	std::intptr_t								  m_load_address;
-	std::unordered_map<std::intptr_t, Breakpoint> m_breakpoints;
+	Breakpoint_Table							  m_breakpoints;
+	// breakpoints of the debugger itself (rendezvous), also in m_breakpoints
+	std::map<std::intptr_t, std::function<void()>> m_internal_breakpoints;
+	// shared libraries of the process, and the loader's r_debug
+	Module_Index								  m_modules;
+	std::uintptr_t								  m_r_debug;
+	// address space layout, to validate addresses before using them
+	Memory_Map									  m_memory_map;
 	dwarf::dwarf								  m_dwarf;
 	elf::elf									  m_elf;
+	// created by the first tracepoint
+	std::unique_ptr<Tracepoint_Manager>			  m_tracepoints;
+	// breakpoints of collect_coverage(), they never stop the program
+	std::unique_ptr<Coverage>					  m_coverage;
+	Trace_Recorder								  m_recorder;
+	// PTRACE_SINGLEBLOCK works, otherwise record every instruction
+	bool										  m_block_step;
+	// system calls in the seccomp filter, and those which stop the program
+	std::vector<long>							  m_filtered_syscalls;
+	std::vector<long>							  m_caught_syscalls;
+	// threads of detached children, still traced since the filter they
+	// inherited makes their filtered system calls fail with ENOSYS without
+	// a tracer. They run on their own, resumed at each of their stops
+	std::vector<pid_t>							  m_filtered_processes;
+	// how the current thread was last resumed, and its last wait status
+	__ptrace_request							  m_resume_request;
+	int											  m_wait_status;
+	// a caught mmap family system call changes the layout when resumed
+	bool										  m_remap_on_resume;
+	Page_Tracker								  m_page_tracker;
+	// steps over breakpoints without taking them out of the code
+	Displaced_Stepper							  m_displaced_stepper;
+	std::vector<Watchpoint>						  m_watchpoints;
+	std::vector<Display>						  m_displays;
+	unsigned									  m_next_watch_id;
+	// the SIGSTOP on its way was sent because a watchpoint changed
+	bool										  m_watch_stop;
+	// parked copies of the processes, and the forward commands run in the
+	// current process since it started
+	std::vector<Checkpoint>						  m_checkpoints;
+	unsigned									  m_next_checkpoint_id;
+	std::vector<Movement_Record>				  m_history;
+	std::optional<Launch_Options>				  m_launch;
+	// created by heap track, with the entries of the allocation functions
+	// and the calls not returned yet, by thread
+	std::unique_ptr<Heap_Tracker>				  m_heap;
+	std::vector<std::intptr_t>					  m_heap_breakpoints;
+	std::map<pid_t, Heap_Call>					  m_heap_calls;
+	// created by trace latency
+	std::unique_ptr<Latency_Tracer>				  m_latency;
+	// tab completion over the names of m_image, made again when it changes
+	std::unique_ptr<Completer>					  m_completer;
+	// processes of the session which are not the current one, all stopped
+	std::vector<Inferior>						  m_inferiors;
+	unsigned									  m_next_inferior_id;
+	// set follow-fork-mode child / set detach-on-fork off
+	bool										  m_follow_child;
+	bool										  m_detach_on_fork;
+	// breakpoints taken out while a vfork child borrows our memory
+	std::vector<std::intptr_t>					  m_vfork_breakpoints;
+	// parent whose memory a followed vfork child borrows, 0 if none
+	pid_t										  m_vfork_parent;
+	// new threads and forked children whose first stop was reaped before
+	// the clone or fork event of their parent
+	std::vector<pid_t>							  m_new_processes;
 };
 
 };
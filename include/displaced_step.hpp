@@ -0,0 +1,66 @@
+// displaced stepping: the instruction under a breakpoint is copied, with its
+// RIP-relative operands and branch displacements fixed up, into a scratch
+// slot of the debugee and single stepped there. The INT3 never leaves the
+// code, so other threads cannot run past it, and stepping over it costs one
+// single step plus the pc fixup
+#pragma once
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <sys/types.h> // pid_t
+#include <vector>
+
+namespace mini_debugger {
+
+// size of a slot, holds the longest instruction once widened
+static constexpr std::size_t DISPLACED_SLOT_SIZE{ 32 };
+// size of a scratch page, the threads stepping at once take different slots
+static constexpr std::size_t DISPLACED_PAGE_SIZE{ 4096 };
+
+class Displaced_Stepper
+{
+public:
+	explicit Displaced_Stepper(const pid_t pid);
+
+	// copy the instruction at `address`, whose first byte is hidden by an
+	// INT3 and is `saved_byte`, into the slot of the stopped thread `tid`.
+	// Returns the address to single step from, std::nullopt if the
+	// instruction cannot be moved (loop/jrcxz, no scratch page in reach)
+	std::optional<std::uintptr_t> prepare(const pid_t		   tid,
+										  const std::uintptr_t address,
+										  const uint8_t		   saved_byte);
+	// the step prepared for `tid` is done: move the pc back next to the
+	// original instruction and fix the return address pushed by a call
+	void finish(const pid_t tid);
+
+	// the stepper belongs to process `pid`, a fork with a copy of our
+	// scratch pages
+	void set_pid(const pid_t pid);
+	// scratch pages mapped so far, it grows when prepare() maps one
+	std::size_t page_count() const;
+
+private:
+	struct Pending_Step
+	{
+		std::uintptr_t from;
+		std::size_t	   length;
+		std::uintptr_t slot;
+		std::size_t	   slot_length;
+		std::intptr_t  rsp;
+	};
+
+	// scratch page within rel32 reach of `address`, mapped by `tid` if
+	// there is none yet. 0 if mapping one failed
+	std::uintptr_t scratch_page(const pid_t tid, const std::uintptr_t address);
+
+	pid_t						  m_pid;
+	std::vector<std::uintptr_t>	  m_pages;
+	// code pages with no scratch page in reach, mapping one failed
+	std::set<std::uintptr_t>	  m_out_of_reach;
+	// steps not finished yet, by thread. A thread takes a slot no other
+	// pending step uses, in every page
+	std::map<pid_t, Pending_Step> m_pending;
+};
+
+};
@@ -0,0 +1,93 @@
+// gdbserver: the Debugger's ptrace back end driven by a GDB remote serial
+// protocol client (gdb, IDEs) over a TCP port or a unix socket. Memory goes
+// through process_vm_readv in large binary packets, registers are sent from
+// one PTRACE_GETREGS/GETFPREGS snapshot and acks can be turned off, so a local
+// client runs at the speed of the tracing itself
+#pragma once
+#include <cstdint>
+#include <debugger.hpp>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mini_debugger {
+
+// largest packet we accept and send, advertised in qSupported
+static constexpr std::size_t GDB_PACKET_SIZE{ 0x20000 };
+
+class Gdb_Server
+{
+public:
+	explicit Gdb_Server(Debugger& debugger);
+	~Gdb_Server();
+
+	// listen on `address` ([host]:port, port or unix socket path), serve one
+	// client until it detaches, kills the process or goes away
+	bool serve(const std::string& address);
+
+private:
+	bool listen_on(const std::string& address);
+
+	// next packet of the client, acknowledged unless in no-ack mode. False
+	// once the connection is closed
+	bool read_packet(std::string& packet);
+	bool send_packet(const std::string_view data);
+	// fill m_input, waiting at most `timeout_ms` (-1: forever). False on
+	// disconnect
+	bool receive(const int timeout_ms);
+
+	// reply to `packet`, false when the session is over
+	bool handle_packet(const std::string& packet);
+	std::string handle_query(const std::string& packet);
+	std::string handle_xfer(const std::string& packet);
+	std::string handle_vcont(const std::string& actions);
+
+	// resume the current thread with `request` (the other attached threads
+	// continue unless `step_only` is set) and reply with the next stop
+	std::string resume(const __ptrace_request request,
+					   const int			  signal,
+					   const bool			  step_only);
+	// wait for the debugee while watching the client for an interrupt (^C)
+	void		wait_for_debugee();
+	// T packet of the current stop. A breakpoint hit which was `reported` by
+	// wait_for_stop() is rewound if the client supports swbreak
+	std::string update_stop_reply(const bool reported);
+	// threads of the process in the thread list packets
+	std::vector<pid_t> threads() const;
+
+	// registers in the layout of target_description(), one snapshot
+	std::vector<uint8_t> read_registers();
+	bool				 write_registers(const std::vector<uint8_t>& data);
+	std::string			 target_description() const;
+
+	// memory with our own INT3s replaced by the original bytes
+	bool read_memory(const std::uintptr_t  address,
+					 std::vector<uint8_t>& data,
+					 const std::size_t	   length);
+	// the bytes under our INT3s become their saved bytes, the INT3s stay
+	bool write_memory(const std::uintptr_t		   address,
+					  const std::vector<uint8_t>& data);
+	std::string libraries_xml();
+	std::string memory_map_xml();
+
+	Debugger&	m_debugger;
+	int			m_listen_fd;
+	int			m_fd;
+	std::string m_socket_path;
+	std::string m_input;
+	bool		m_no_ack;
+	bool		m_swbreak;
+	// the process exited, was killed or detached
+	bool		m_exited;
+	std::string m_stop_reply;
+	// document of the qXfer object being read in chunks
+	std::string m_xfer_object;
+	std::string m_xfer_document;
+	// handlers of our internal breakpoints on which the client put one of its
+	// own: the hit is reported, then the handler runs
+	std::map<std::intptr_t, std::function<void()>> m_shadowed;
+};
+
+};
@@ -0,0 +1,84 @@
+// live heap allocations of the debugee and the stacks which made them, fed by
+// the breakpoints of `heap track` on malloc/calloc/realloc/free. Stacks are
+// hash-consed: every allocation only keeps the 32 bit id of its stack, and a
+// stack seen a million times is stored once
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mini_debugger {
+
+// allocations made from one stack
+struct Heap_Site
+{
+	uint32_t	stack;
+	// still allocated
+	std::size_t live_bytes;
+	std::size_t live_count;
+	// since tracking started
+	std::size_t total_bytes;
+	std::size_t total_count;
+};
+
+class Heap_Tracker
+{
+public:
+	Heap_Tracker();
+
+	// id of the stack of return addresses `frames`, innermost first. The
+	// same frames always get the same id
+	uint32_t intern_stack(const std::vector<std::uintptr_t>& frames);
+	// return addresses of stack `id`, innermost first
+	std::vector<std::uintptr_t> frames(const uint32_t id) const;
+
+	// `size` bytes at `address` were allocated from stack `stack`
+	void allocated(const std::uintptr_t address,
+				   const std::size_t	size,
+				   const uint32_t		stack);
+	// `address` was freed. False if it is not a live allocation (made
+	// before tracking started, or a double free)
+	bool freed(const std::uintptr_t address);
+
+	std::size_t live_count() const;
+	std::size_t live_bytes() const;
+	// every stack which allocated, in no particular order
+	std::vector<Heap_Site> sites() const;
+
+private:
+	struct Stack
+	{
+		uint64_t	hash;
+		// frames are m_frames[offset, offset + length)
+		uint32_t	offset;
+		uint32_t	length;
+		std::size_t total_bytes;
+		std::size_t total_count;
+	};
+
+	struct Allocation
+	{
+		uint64_t size;
+		uint32_t stack;
+	};
+
+	// open addressing (linear probing) on both tables, as Breakpoint_Table
+	std::size_t find_slot(const std::uintptr_t address) const;
+	void		rehash_allocations(const std::size_t capacity);
+	void		rehash_stacks(const std::size_t capacity);
+
+	std::vector<Stack>			m_stacks;
+	std::vector<std::uintptr_t> m_frames;
+	// id + 1 of the stack hashed there, 0 when empty
+	std::vector<uint32_t>		m_stack_slots;
+
+	// live allocations by address, keys 0 (empty) and 1 (erased) are no
+	// heap pointers
+	std::vector<std::uintptr_t> m_addresses;
+	std::vector<Allocation>		m_allocations;
+	std::size_t					m_live_count;
+	std::size_t					m_live_bytes;
+	std::size_t					m_tombstones;
+};
+
+};
@@ -0,0 +1,23 @@
+// make a stopped thread of the debugee execute a system call on our behalf
+#pragma once
+#include <array>
+#include <sys/types.h> // pid_t
+
+namespace mini_debugger {
+
+// execute system call `number` with `args` in the stopped thread `tid` and
+// return its result (-errno on failure). The registers and the code at the
+// thread's pc are restored afterwards, so the thread does not notice
+long
+inject_syscall(const pid_t				   tid,
+			   const long				   number,
+			   const std::array<long, 6>& args = {});
+
+// fork the process of the stopped thread `tid`, which has to be traced with
+// PTRACE_O_TRACEFORK. The child is left stopped as an exact copy of the
+// process at the thread's current state (registers and code as they were
+// before the injection). Returns the pid of the child, -errno on failure
+pid_t
+inject_fork(const pid_t tid);
+
+};
@@ -0,0 +1,102 @@
+// durations of the calls to some functions of the debugee, timed at the
+// internal breakpoints of their entries and return addresses. A thread's
+// calls are matched on its shadow stack, so recursion and threads running
+// the same function at once are timed separately
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <sys/types.h> // pid_t
+#include <unordered_map>
+#include <vector>
+
+namespace mini_debugger {
+
+// log-linear histogram of nanoseconds: 16 linear buckets per power of two,
+// a percentile is off by at most 1/16 of its value, in 8KB whatever the
+// range of the durations
+class Latency_Histogram
+{
+public:
+	Latency_Histogram();
+
+	void		record(const uint64_t nanoseconds);
+	// upper bound of the bucket holding the `percent` percentile
+	uint64_t	percentile(const double percent) const;
+	uint64_t	max() const;
+	std::size_t count() const;
+
+private:
+	static constexpr unsigned SUB_BUCKET_BITS{ 4 };
+
+	static std::size_t bucket_of(const uint64_t nanoseconds);
+	static uint64_t	   bucket_end(const std::size_t bucket);
+
+	std::vector<uint64_t> m_buckets;
+	std::size_t			  m_count;
+	uint64_t			  m_max;
+};
+
+class Latency_Tracer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// `stop_cost`: time the debugee loses at each stop (measure_stop_cost),
+	// taken out of every duration for each stop of its thread during the
+	// call
+	explicit Latency_Tracer(const std::chrono::nanoseconds stop_cost);
+
+	// time of a breakpoint stop handled by a tracer, from the trap to the
+	// resumed thread, measured on a child of ours running INT3s
+	static std::chrono::nanoseconds measure_stop_cost();
+
+	// index of function `name`, added if it is new
+	std::size_t				 add_function(const std::string& name);
+	std::vector<std::string> functions() const;
+
+	// thread `tid` stopped, for any reason
+	void count_stop(const pid_t tid);
+	// thread `tid` is at the entry of `function`, the return address on top
+	// of its stack at `stack_pointer`
+	void entered(const pid_t		 tid,
+				 const std::size_t	 function,
+				 const std::intptr_t stack_pointer);
+	// thread `tid` is at a return address with `stack_pointer`
+	void returned(const pid_t tid, const std::intptr_t stack_pointer);
+
+	// call counts, p50/p99/max for each function
+	void print_report(std::ostream& out) const;
+
+private:
+	struct Frame
+	{
+		std::size_t		  function;
+		std::intptr_t	  stack_pointer;
+		Clock::time_point start;
+		// stops of the thread before the call
+		uint64_t		  stops;
+	};
+
+	struct Thread
+	{
+		std::vector<Frame> shadow_stack;
+		uint64_t		   stops{ 0 };
+	};
+
+	struct Function
+	{
+		std::string		  name;
+		Latency_Histogram histogram;
+	};
+
+	std::chrono::nanoseconds			m_stop_cost;
+	std::vector<Function>				m_functions;
+	std::unordered_map<pid_t, Thread>	m_threads;
+	// calls left by longjmp or an exception, never returned
+	std::size_t							m_abandoned;
+};
+
+};
@@ -0,0 +1,65 @@
+// compact line table of a compilation unit. libelfin decodes the line number
+// program again on each lookup and each of its entries carries every register
+// of the state machine; here the rows are decoded once, sorted by address and
+// split into arrays of 32 bit values (address delta, line, file index and
+// flags), 12 bytes per row, so that a pc lookup is a branchless binary search
+// over the address array only
+#pragma once
+#include <cstdint>
+#include <dwarf/dwarf++.hh>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mini_debugger {
+
+// one row of a line table
+struct Line_Entry
+{
+	std::uintptr_t	 address;
+	unsigned		 line;
+	// path of the source file, interned by the image owning the table
+	std::string_view file;
+	bool			 is_stmt;
+	// first address after a sequence of instructions, it has no line
+	bool			 end_sequence;
+};
+
+class Line_Table
+{
+public:
+	static constexpr std::size_t npos{ static_cast<std::size_t>(-1) };
+
+	// decode `table`, the file names are interned into `file_names`
+	Line_Table(const dwarf::line_table& table,
+			   std::set<std::string>&	file_names);
+
+	// row covering `address`, npos if there is none
+	std::size_t find_address(const std::uintptr_t address) const;
+	// rows of `line` (in any file of the unit) which begin a statement, by
+	// increasing address
+	std::vector<std::size_t> find_line(const unsigned line) const;
+
+	// rows are sorted by address
+	Line_Entry	entry(const std::size_t row) const;
+	std::size_t size() const;
+	// bytes of memory held by the table
+	std::size_t memory_size() const;
+
+private:
+	static constexpr uint32_t IS_STMT{ 1 };
+	static constexpr uint32_t END_SEQUENCE{ 2 };
+	// low bits of m_files_and_flags taken by the flags
+	static constexpr unsigned FLAG_BITS{ 2 };
+
+	std::uintptr_t				  m_base;
+	std::vector<uint32_t>		  m_address_deltas;
+	std::vector<uint32_t>		  m_lines;
+	std::vector<uint32_t>		  m_files_and_flags;
+	std::vector<std::string_view> m_files;
+	// rows of statements sorted by line, then address
+	std::vector<uint32_t>		  m_line_rows;
+};
+
+};
@@ -0,0 +1,34 @@
+// bulk access to the memory of a traced process
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h> // pid_t
+
+namespace mini_debugger {
+
+// copy `size` bytes at `address` of process `pid` into `buffer` with a single
+// process_vm_readv, the process does not need to be stopped
+bool
+read_memory_block(const pid_t		   pid,
+				  const std::uintptr_t address,
+				  void*				   buffer,
+				  const std::size_t	   size);
+
+// NUL terminated string at `address` of process `pid`, at most `max_size`
+// bytes. Read one page at a time so that a string ending right before an
+// unmapped page is still found
+std::string
+read_memory_string(const pid_t			pid,
+				   const std::uintptr_t address,
+				   const std::size_t	max_size = 4096);
+
+// copy `buffer` into process `pid`, read-only pages (code) included. The
+// process has to be traced by us
+bool
+write_memory_block(const pid_t			pid,
+				   const std::uintptr_t address,
+				   const void*			buffer,
+				   const std::size_t	size);
+
+};
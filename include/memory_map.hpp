@@ -0,0 +1,73 @@
+// cached /proc/<pid>/maps, kept sorted by address so that any address can be
+// classified with a binary search. The cache is re-read when it was
+// invalidated (exec, fork, new threads, library events, the mmaps we inject
+// and the mmap family system calls we catch), and now and then when an
+// address falls where the stack or the heap may have grown
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <sys/types.h> // pid_t
+#include <vector>
+
+namespace mini_debugger {
+
+enum class Region_Kind
+{
+	file,	   // mapping of a file: the program or a shared library
+	anonymous, // anonymous memory (malloc arenas, thread stacks, mmap)
+	heap,	   // [heap], grown by brk
+	stack,	   // [stack] of the main thread
+	special,   // [vdso], [vvar], [vsyscall]
+};
+
+struct Memory_Region
+{
+	std::uintptr_t start;
+	std::uintptr_t end;
+	bool		   readable;
+	bool		   writable;
+	bool		   executable;
+	bool		   shared;
+	std::uintptr_t offset;
+	// file path, [heap], [stack]... or empty for anonymous memory
+	std::string	   path;
+
+	Region_Kind kind() const;
+};
+
+std::string
+to_string(const Region_Kind kind);
+
+class Memory_Map
+{
+public:
+	Memory_Map();
+
+	// re-read /proc/<pid>/maps now
+	bool refresh(const pid_t pid);
+	// the mappings changed, re-read them on the next lookup
+	void invalidate();
+
+	// region containing `address`, nullptr if it is not mapped. Reads the
+	// maps again if they were invalidated. A miss only does when `address`
+	// is right below [stack] or above [heap], at most once per
+	// MISS_REFRESH_INTERVAL: the unwinders miss on every end of a stack
+	const Memory_Region* find(const pid_t pid, const std::uintptr_t address);
+
+	const std::vector<Memory_Region>& regions() const;
+
+private:
+	static constexpr std::chrono::milliseconds MISS_REFRESH_INTERVAL{ 100 };
+
+	const Memory_Region* lookup(const std::uintptr_t address) const;
+	// `address` is in the gap a growing [stack] or [heap] extends into
+	bool				 in_growth_gap(const std::uintptr_t address) const;
+
+	// sorted by start address, never overlapping
+	std::vector<Memory_Region>			  m_regions;
+	bool								  m_valid;
+	std::chrono::steady_clock::time_point m_miss_refresh;
+};
+
+};
@@ -0,0 +1,51 @@
+// shared libraries of the debugee, found through the dynamic loader's
+// rendezvous structure (r_debug / link_map). Libraries are only listed with
+// their address ranges, their ELF/DWARF are opened by the first query which
+// lands in them
+#pragma once
+#include <cstdint>
+#include <debug_image.hpp>
+#include <memory>
+#include <string>
+#include <sys/types.h> // pid_t
+#include <vector>
+
+namespace mini_debugger {
+
+struct Module
+{
+	std::string							path;
+	// load bias (l_addr): runtime address = address in the file + base
+	std::uintptr_t						base;
+	// the loader's link_map entry and the library's dynamic section (l_ld)
+	std::uintptr_t						link_map;
+	std::uintptr_t						dynamic;
+	// lowest and end address of the mappings of the file
+	std::uintptr_t						start;
+	std::uintptr_t						end;
+	// opened on demand by Module_Index::image_of()
+	std::shared_ptr<const Debug_Image>	image;
+};
+
+class Module_Index
+{
+public:
+	// replace the modules by the libraries of the link_map list starting at
+	// `link_map` in process `pid`. Returns the modules which went away
+	std::vector<Module> update(const pid_t pid, const std::uintptr_t link_map);
+	void				clear();
+
+	// module mapped at `address`, nullptr if there is none
+	Module*				find(const std::uintptr_t address);
+	// debug information of `module`, opened now if needed. nullptr if the
+	// file cannot be opened
+	std::shared_ptr<const Debug_Image> image_of(Module& module);
+
+	std::vector<Module>& modules();
+
+private:
+	// sorted by start address
+	std::vector<Module> m_modules;
+};
+
+};
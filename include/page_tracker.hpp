@@ -0,0 +1,35 @@
+// which pages of the debugee were written, from the soft-dirty bits of
+// /proc/<pid>/pagemap. Software watchpoints only compare these pages instead
+// of single stepping or re-reading whole regions
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h> // pid_t
+#include <vector>
+
+namespace mini_debugger {
+
+static constexpr std::uintptr_t TRACKED_PAGE_SIZE{ 4096 };
+
+class Page_Tracker
+{
+public:
+	explicit Page_Tracker(const pid_t pid);
+
+	// false if the kernel has no soft-dirty support (CONFIG_MEM_SOFT_DIRTY),
+	// every page is then reported as written
+	bool is_supported() const { return m_supported; }
+
+	// start address of each page overlapping [address, address + length)
+	// which was written since the last clear()
+	std::vector<std::uintptr_t> dirty_pages(const std::uintptr_t address,
+											const std::size_t	 length);
+	// reset the soft-dirty bits of the whole process
+	bool clear();
+
+private:
+	pid_t m_pid;
+	bool  m_supported;
+};
+
+};
@@ -0,0 +1,134 @@
+// addr2line for a stream of addresses: every address is resolved to its
+// function, file:line and chain of inlined calls without a process. The
+// lines are resolved by worker threads sharing the images, the output keeps
+// the order of the input
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <debug_image.hpp>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mini_debugger {
+
+class Symbolizer
+{
+public:
+	// addresses without a module are looked up in `program`
+	explicit Symbolizer(const std::string& program);
+
+	// read one location per line from `in` and write its frames to `out`
+	// in the format of addr2line -afi. A location is an address, or a
+	// module and an offset in it as `path+0xoffset` or `path 0xoffset`.
+	// Input is handled by blocks of lines, each block split between
+	// `threads` workers (0: one per core) and written once resolved.
+	// Returns the number of lines read
+	std::size_t
+	run(std::istream& in, std::ostream& out, unsigned threads = 0);
+
+private:
+	// a function or an inlined call covering some addresses of a unit
+	struct Scope
+	{
+		std::string name;
+		// enclosing scope, -1 for a function
+		int			parent;
+		// call site of an inlined call
+		std::string call_file;
+		unsigned	call_line;
+	};
+
+	struct Scope_Range
+	{
+		std::uintptr_t low;
+		std::uintptr_t high;
+		int			   scope;
+		// nesting level, inner scopes sort after outer ones at equal low
+		int			   depth;
+	};
+
+	// what a lookup needs from a unit, copied out of the DWARF once so that
+	// the workers never touch libelfin (whose lazy parsing is not thread
+	// safe)
+	struct Unit_Index
+	{
+		std::vector<Scope>				  scopes;
+		// sorted by low address, then depth
+		std::vector<Scope_Range>		  ranges;
+		std::shared_ptr<const Line_Table> line_table;
+	};
+
+	struct Elf_Symbol
+	{
+		std::uintptr_t address;
+		std::uintptr_t size;
+		std::string	   name;
+	};
+
+	struct Unit_Range
+	{
+		std::uintptr_t				   low;
+		std::uintptr_t				   high;
+		const dwarf::compilation_unit* unit;
+	};
+
+	struct Object
+	{
+		std::shared_ptr<const Debug_Image>	image;
+		// function symbols by address, for code without debug information
+		std::vector<Elf_Symbol>				symbols;
+		// by offset of the unit, built on first use
+		std::map<dwarf::section_offset, std::shared_ptr<const Unit_Index>>
+			units;
+		// ranges of every unit sorted by low address, read by the first
+		// lookup the accelerator tables cannot answer. Once set, a lookup is
+		// a binary search without the lock, a miss included
+		std::vector<Unit_Range>				unit_ranges;
+		std::atomic<bool>					has_unit_ranges{ false };
+	};
+
+	// last object and unit used by a worker: sorted input mostly stays in
+	// one unit, which is then found without locking
+	struct Worker_Cache
+	{
+		std::string						  module;
+		Object*							  object{ nullptr };
+		std::shared_ptr<const Unit_Index> unit;
+	};
+
+	// function symbols of .symtab and .dynsym, sorted by address
+	static void read_symbols(const elf::elf&		  elf,
+							 std::vector<Elf_Symbol>& out);
+	static std::shared_ptr<const Unit_Index>
+	index_unit(const Debug_Image& image, const dwarf::compilation_unit& unit);
+	static void read_unit_ranges(const Debug_Image&		  image,
+								 std::vector<Unit_Range>& out);
+	// innermost scope of `unit` covering `pc`, -1 if there is none
+	static int find_scope(const Unit_Index& unit, const std::uintptr_t pc);
+
+	// object of `path` ("" for the program), nullptr if it cannot be read
+	Object* object_of(const std::string_view path);
+	// index of the unit covering `pc`, nullptr if no unit does
+	std::shared_ptr<const Unit_Index>
+	unit_index_at(Object& object, const std::uintptr_t pc);
+	// index of `unit`, built on first use. m_mutex is held
+	std::shared_ptr<const Unit_Index>
+	unit_index(Object& object, const dwarf::compilation_unit& unit);
+
+	// frames of one line of input
+	void symbolize(const std::string_view line,
+				   Worker_Cache&		  cache,
+				   std::string&			  out);
+
+	std::map<std::string, std::unique_ptr<Object>, std::less<>> m_objects;
+	// guards m_objects and every use of libelfin
+	std::mutex													m_mutex;
+};
+
+};
@@ -0,0 +1,48 @@
+// x86-64 system calls: names, argument decoding and the seccomp filter used
+// to stop only on the system calls we are interested in
+#pragma once
+#include <array>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h> // pid_t
+#include <sys/user.h>  // user_regs_struct
+#include <vector>
+
+namespace mini_debugger {
+
+enum class Syscall_Arg
+{
+	none,
+	integer, // signed decimal
+	dirfd,	 // directory fd of the *at system calls, may be AT_FDCWD
+	hex,	 // pointer, flags
+	string,	 // NUL terminated string (paths)
+	buffer,	 // data whose length is the next argument, read at entry
+};
+
+struct Syscall_Descriptor
+{
+	long						number;
+	std::string					name;
+	std::array<Syscall_Arg, 6> args;
+};
+
+std::optional<long>
+get_syscall_number(const std::string_view name);
+
+std::string
+get_syscall_name(const long number);
+
+// "name(arg, ...)" for the system call about to be executed with `regs`,
+// pointer arguments are read from the memory of `pid`
+std::string
+format_syscall(const pid_t pid, const user_regs_struct& regs);
+
+// make the calling process stop its tracer on each of the system calls
+// `numbers` (SECCOMP_RET_TRACE), all the other ones run untouched. The
+// tracer must set PTRACE_O_TRACESECCOMP before any of them is executed
+bool
+install_syscall_filter(const std::vector<long>& numbers);
+
+};
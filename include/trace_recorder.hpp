@@ -0,0 +1,57 @@
+// execution history of the debugee: every pc reported while stepping, stored
+// as variable length deltas so that millions of them fit in a few MB
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <sys/user.h> // user_regs_struct
+#include <vector>
+
+namespace mini_debugger {
+
+// default memory budget of the compressed history, the oldest entries are
+// dropped beyond it
+static constexpr std::size_t TRACE_HISTORY_BYTES{ 64 << 20 };
+
+class Trace_Recorder
+{
+public:
+	explicit Trace_Recorder(const std::size_t max_bytes = TRACE_HISTORY_BYTES);
+
+	// clears the previous history, with `with_registers` the changes of the
+	// general purpose registers are stored along with each pc
+	void start(const bool with_registers);
+	void stop();
+	bool is_recording() const;
+
+	// append the state of a stop, regs.rip being the pc
+	void record(const user_regs_struct& regs);
+
+	// decode the last `count` pcs of the history, oldest first
+	std::vector<std::uintptr_t> last_pcs(const std::size_t count) const;
+	bool save(const std::string& path, const std::intptr_t load_address) const;
+	void print_info() const;
+
+private:
+	// every chunk can be decoded on its own: its first entry is a delta from
+	// 0, and the registers are deltas from all zeroes
+	struct Chunk
+	{
+		std::vector<uint8_t> bytes;
+		std::size_t			 entries;
+	};
+
+	void append_varint(std::uint64_t value);
+	void append_signed(const std::int64_t value);
+
+	std::size_t		  m_max_chunks;
+	bool			  m_recording;
+	bool			  m_with_registers;
+	std::deque<Chunk> m_chunks;
+	user_regs_struct  m_previous;
+	std::uint64_t	  m_recorded;
+	std::uint64_t	  m_dropped;
+};
+
+};
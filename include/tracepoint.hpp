@@ -0,0 +1,92 @@
+// tracepoints: instead of an INT3, the first instructions of the traced
+// location are replaced by a `jmp` to a trampoline in a page we inject into
+// the debugee. The trampoline stores the arguments into a ring buffer, runs
+// the displaced instructions and jumps back, so a hit never stops the process.
+// The ring buffer is drained by a thread of the debugger while the debugee
+// runs
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h> // pid_t
+#include <thread>
+#include <vector>
+
+namespace mini_debugger {
+
+// number of records of the ring buffer, has to be a power of 2
+static constexpr std::uint64_t TRACE_RING_RECORDS{ 1 << 16 };
+// size of the injected page holding the trampolines
+static constexpr std::size_t TRACE_CODE_SIZE{ 1 << 16 };
+// number of drained records kept around for `tracepoint events`
+static constexpr std::size_t TRACE_RECENT_RECORDS{ 4096 };
+
+// one hit of a tracepoint, as written by the trampolines
+struct Trace_Record
+{
+	// index of the record in the ring + 1, written last to publish it
+	std::uint64_t seq;
+	std::uint64_t id;
+	std::uint64_t tsc;
+	// rdi, rsi, rdx, rcx, r8, r9: the integer arguments of the function
+	std::uint64_t args[6];
+};
+
+class Tracepoint_Manager
+{
+public:
+	explicit Tracepoint_Manager(const pid_t pid);
+	~Tracepoint_Manager();
+
+	// patch a jump to a new trampoline at `address`, using the stopped thread
+	// `tid` to allocate memory in the debugee. `function_end` (0 if unknown)
+	// must not be overwritten, neither may the pc of a stopped thread
+	bool install(const pid_t						tid,
+				 const std::intptr_t				address,
+				 const std::intptr_t				function_end,
+				 std::string						name,
+				 const std::vector<std::intptr_t>& thread_pcs);
+	// put the original instructions back, the trampolines stay mapped for
+	// threads which are still running in them
+	void remove_all();
+
+	void print_tracepoints();
+	void print_events(const std::size_t count);
+
+private:
+	struct Tracepoint
+	{
+		std::intptr_t		 address;
+		std::string			 name;
+		std::vector<uint8_t> saved_code;
+		std::uint64_t		 hits;
+	};
+
+	// mmap the trampoline and ring buffer pages inside the debugee
+	bool allocate_scratch(const pid_t tid, const std::intptr_t near);
+	std::vector<uint8_t> trampoline_prologue(const std::uint64_t id) const;
+
+	void drain_loop();
+	// copy the new records out of the ring buffer, false if the debugee is
+	// gone
+	bool drain();
+
+	pid_t					 m_pid;
+	std::vector<Tracepoint>	 m_tracepoints;
+	std::uintptr_t			 m_code;
+	std::size_t				 m_code_used;
+	std::uintptr_t			 m_ring;
+
+	std::thread				 m_drain_thread;
+	std::atomic<bool>		 m_draining;
+	// protects everything the drain thread touches
+	std::mutex				 m_mutex;
+	std::uint64_t			 m_tail;
+	std::uint64_t			 m_dropped;
+	std::vector<Trace_Record> m_recent;
+	std::vector<Trace_Record> m_batch;
+	double					 m_ns_per_tick;
+};
+
+};
@@ -0,0 +1,61 @@
+// minimal x86-64 instruction decoder
+// it only finds out what is needed to move an instruction to another address:
+// the instruction length, RIP-relative memory operands and relative branches
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace mini_debugger {
+
+enum class Branch_Kind
+{
+	none,
+	jmp,	 // jmp rel8/rel32
+	jcc,	 // conditional jump rel8/rel32
+	call,	 // call rel32
+	loop,	 // loop/loopcc/jrcxz rel8, no rel32 form exists
+};
+
+struct Decoded_Instruction
+{
+	std::size_t length{ 0 };
+
+	// memory operand addressed relative to RIP, `disp_offset` is the offset
+	// of its 32 bit displacement inside the instruction
+	bool		rip_relative{ false };
+	std::size_t disp_offset{ 0 };
+
+	// relative branch, `branch_offset`/`branch_size` locate its displacement
+	Branch_Kind branch{ Branch_Kind::none };
+	std::size_t branch_offset{ 0 };
+	std::size_t branch_size{ 0 };
+	// condition code of a jcc (low nibble of its opcode)
+	uint8_t		condition{ 0 };
+};
+
+// decode the instruction at the start of `code`, std::nullopt if it is
+// invalid in 64 bit mode or longer than `size`
+std::optional<Decoded_Instruction>
+decode_instruction(const uint8_t* code, const std::size_t size);
+
+// target address of a relative branch located at `address`
+std::intptr_t
+branch_target(const Decoded_Instruction& insn,
+			  const uint8_t*			 code,
+			  const std::intptr_t		 address);
+
+// append a copy of `insn` (whose bytes are `code`, originally at `from`) to
+// `out`, to be executed at address `to`. Displacements are adjusted so that
+// memory operands and branch targets still point to the same absolute
+// addresses, rel8 branches are widened to rel32. Returns false if that is
+// not possible (out of the +-2GB range or a loop/jrcxz instruction)
+bool
+relocate_instruction(const Decoded_Instruction& insn,
+					 const uint8_t*				code,
+					 const std::intptr_t		from,
+					 const std::intptr_t		to,
+					 std::vector<uint8_t>&		out);
+
+};
@@ -54,4 +54,23 @@ Breakpoint::get_address() const
 	return m_addr;
 }
 
+uint8_t
+Breakpoint::get_saved_data() const
+{
+	return m_saved_data;
+}
+
+void
+Breakpoint::set_pid(const pid_t pid)
+{
+	m_pid = pid;
+}
+
+void
+Breakpoint::set_enabled(const uint8_t saved_data)
+{
+	m_saved_data = saved_data;
+	m_enabled	 = true;
+}
+
 };
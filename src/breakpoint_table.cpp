@@ -0,0 +1,268 @@
+#include <breakpoint_table.hpp>
+#include <memory_access.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mini_debugger {
+
+// keys of unused slots, no instruction can be at these addresses
+static constexpr std::intptr_t EMPTY_SLOT{ 0 };
+static constexpr std::intptr_t ERASED_SLOT{ -1 };
+
+static constexpr std::size_t MIN_CAPACITY{ 64 };
+static constexpr unsigned	 PAGE_SHIFT{ 12 };
+// 2^18 pages (1GB of code) before two pages share a bit, the bitmap is 32KB
+static constexpr std::size_t PAGE_BITS{ 1 << 18 };
+static constexpr uint8_t	 INT3{ 0xcc };
+
+static unsigned
+log2_of(std::size_t n)
+{
+	unsigned log{ 0 };
+	while (n >>= 1)
+		++log;
+	return log;
+}
+
+Breakpoint_Table::iterator::iterator(Breakpoint_Table* table,
+									 std::size_t	   slot)
+	: m_table{ table }
+	, m_slot{ slot }
+{
+	skip_unused();
+}
+
+Breakpoint&
+Breakpoint_Table::iterator::operator*() const
+{
+	return m_table->m_values[m_slot];
+}
+
+Breakpoint_Table::iterator&
+Breakpoint_Table::iterator::operator++()
+{
+	++m_slot;
+	skip_unused();
+	return *this;
+}
+
+bool
+Breakpoint_Table::iterator::operator!=(const iterator& other) const
+{
+	return m_slot != other.m_slot;
+}
+
+void
+Breakpoint_Table::iterator::skip_unused()
+{
+	while (m_slot < m_table->m_keys.size() &&
+		   (m_table->m_keys[m_slot] == EMPTY_SLOT ||
+			m_table->m_keys[m_slot] == ERASED_SLOT))
+		++m_slot;
+}
+
+Breakpoint_Table::Breakpoint_Table()
+	: m_keys(MIN_CAPACITY, EMPTY_SLOT)
+	, m_values(MIN_CAPACITY)
+	, m_page_bits(PAGE_BITS / 64, 0)
+	, m_size{ 0 }
+	, m_tombstones{ 0 }
+	, m_shift{ 64 - log2_of(MIN_CAPACITY) }
+{
+}
+
+std::size_t
+Breakpoint_Table::home_slot(const std::intptr_t addr) const
+{
+	// Fibonacci hashing, the top bits of the product are well mixed even for
+	// addresses that only differ in their low bits
+	return (static_cast<uint64_t>(addr) * 0x9e3779b97f4a7c15ull) >> m_shift;
+}
+
+bool
+Breakpoint_Table::page_may_have_breakpoint(const std::intptr_t addr) const
+{
+	auto page = (static_cast<uint64_t>(addr) >> PAGE_SHIFT) & (PAGE_BITS - 1);
+	return (m_page_bits[page / 64] >> (page % 64)) & 1;
+}
+
+void
+Breakpoint_Table::mark_page(const std::intptr_t addr)
+{
+	auto page = (static_cast<uint64_t>(addr) >> PAGE_SHIFT) & (PAGE_BITS - 1);
+	m_page_bits[page / 64] |= uint64_t{ 1 } << (page % 64);
+}
+
+Breakpoint*
+Breakpoint_Table::find(const std::intptr_t addr)
+{
+	return const_cast<Breakpoint*>(
+		static_cast<const Breakpoint_Table*>(this)->find(addr));
+}
+
+const Breakpoint*
+Breakpoint_Table::find(const std::intptr_t addr) const
+{
+	if (addr == EMPTY_SLOT || addr == ERASED_SLOT ||
+		!page_may_have_breakpoint(addr))
+		return nullptr;
+
+	const auto mask = m_keys.size() - 1;
+	for (auto slot = home_slot(addr);; slot = (slot + 1) & mask) {
+		if (m_keys[slot] == addr)
+			return &m_values[slot];
+		if (m_keys[slot] == EMPTY_SLOT)
+			return nullptr;
+	}
+}
+
+std::size_t
+Breakpoint_Table::count(const std::intptr_t addr) const
+{
+	return find(addr) != nullptr;
+}
+
+Breakpoint&
+Breakpoint_Table::at(const std::intptr_t addr)
+{
+	auto bp = find(addr);
+	if (bp == nullptr)
+		throw std::out_of_range{ "No breakpoint at this address" };
+	return *bp;
+}
+
+Breakpoint&
+Breakpoint_Table::insert(const Breakpoint& bp)
+{
+	const auto addr = bp.get_address();
+	if (auto existing = find(addr)) {
+		*existing = bp;
+		return *existing;
+	}
+
+	// keep the load factor (erased slots included) under 3/4
+	if ((m_size + m_tombstones + 1) * 4 > m_keys.size() * 3) {
+		rehash((m_size + 1) * 2 > m_keys.size() ? m_keys.size() * 2
+												: m_keys.size());
+	}
+
+	const auto mask = m_keys.size() - 1;
+	auto	   slot = home_slot(addr);
+	while (m_keys[slot] != EMPTY_SLOT && m_keys[slot] != ERASED_SLOT)
+		slot = (slot + 1) & mask;
+
+	if (m_keys[slot] == ERASED_SLOT)
+		--m_tombstones;
+	m_keys[slot]   = addr;
+	m_values[slot] = bp;
+	++m_size;
+	mark_page(addr);
+	return m_values[slot];
+}
+
+bool
+Breakpoint_Table::erase(const std::intptr_t addr)
+{
+	auto bp = find(addr);
+	if (bp == nullptr)
+		return false;
+
+	// the slot may be in the middle of a probe sequence, leave a tombstone.
+	// The page bit stays set until the next rehash
+	auto slot	 = static_cast<std::size_t>(bp - m_values.data());
+	m_keys[slot] = ERASED_SLOT;
+	--m_size;
+	++m_tombstones;
+	return true;
+}
+
+void
+Breakpoint_Table::reserve(const std::size_t n)
+{
+	auto capacity = m_keys.size();
+	while (n * 4 > capacity * 3)
+		capacity *= 2;
+	if (capacity != m_keys.size())
+		rehash(capacity);
+}
+
+std::size_t
+Breakpoint_Table::enable_all(const pid_t pid)
+{
+	std::vector<Breakpoint*> disabled;
+	for (auto& bp : *this) {
+		if (!bp.is_enabled())
+			disabled.push_back(&bp);
+	}
+	std::sort(disabled.begin(), disabled.end(), [](auto a, auto b) {
+		return a->get_address() < b->get_address();
+	});
+
+	std::size_t			 enabled{ 0 };
+	std::vector<uint8_t> code;
+	for (std::size_t first = 0, last = 0; first < disabled.size();
+		 first = last) {
+		auto page = disabled[first]->get_address() >> PAGE_SHIFT;
+		while (last < disabled.size() &&
+			   disabled[last]->get_address() >> PAGE_SHIFT == page) {
+			++last;
+		}
+		auto start = disabled[first]->get_address();
+		code.resize(disabled[last - 1]->get_address() + 1 - start);
+		if (!read_memory_block(pid, start, code.data(), code.size()))
+			continue;
+		std::vector<uint8_t> saved_data;
+		for (auto i = first; i < last; ++i) {
+			auto& byte = code[disabled[i]->get_address() - start];
+			saved_data.push_back(byte);
+			byte = INT3;
+		}
+		if (!write_memory_block(pid, start, code.data(), code.size()))
+			continue;
+		for (auto i = first; i < last; ++i) {
+			disabled[i]->set_enabled(saved_data[i - first]);
+		}
+		enabled += last - first;
+	}
+	return enabled;
+}
+
+void
+Breakpoint_Table::rehash(const std::size_t capacity)
+{
+	auto keys	= std::move(m_keys);
+	auto values = std::move(m_values);
+
+	m_keys.assign(capacity, EMPTY_SLOT);
+	m_values.assign(capacity, Breakpoint{});
+	m_page_bits.assign(PAGE_BITS / 64, 0);
+	m_shift		 = 64 - log2_of(capacity);
+	m_size		 = 0;
+	m_tombstones = 0;
+
+	for (std::size_t slot = 0; slot < keys.size(); ++slot) {
+		if (keys[slot] != EMPTY_SLOT && keys[slot] != ERASED_SLOT)
+			insert(values[slot]);
+	}
+}
+
+std::size_t
+Breakpoint_Table::size() const
+{
+	return m_size;
+}
+
+Breakpoint_Table::iterator
+Breakpoint_Table::begin()
+{
+	return iterator{ this, 0 };
+}
+
+Breakpoint_Table::iterator
+Breakpoint_Table::end()
+{
+	return iterator{ this, m_keys.size() };
+}
+
+};
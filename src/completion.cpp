@@ -0,0 +1,372 @@
+#include <completion.hpp>
+
+#include <cxxabi.h> // __cxa_demangle
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+namespace mini_debugger {
+
+static void
+write_varint(std::string& out, std::size_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<char>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+static std::size_t
+read_varint(const char*& data)
+{
+	std::size_t value{ 0 };
+	for (unsigned shift = 0;; shift += 7) {
+		auto byte = static_cast<unsigned char>(*data++);
+		value |= static_cast<std::size_t>(byte & 0x7f) << shift;
+		if (byte < 0x80)
+			return value;
+	}
+}
+
+// `s` is the end of the path `str` from a component on: "a.cpp" matches
+// "src/a.cpp" but not "data.cpp"
+static bool
+is_path_suffix(const std::string_view s, const std::string_view str)
+{
+	return s.size() <= str.size() &&
+		   str.compare(str.size() - s.size(), s.size(), s) == 0 &&
+		   (s.size() == str.size() || str[str.size() - s.size() - 1] == '/' ||
+			(!s.empty() && s.front() == '/'));
+}
+
+// names of the defined symbols of `elf`, pointing into its string tables
+static std::vector<std::string_view>
+symbol_names(const elf::elf&		  elf,
+			 const bool				  functions_only,
+			 const std::atomic<bool>& stopping)
+{
+	std::vector<std::string_view> names;
+	for (const auto& section : elf.sections()) {
+		if (section.get_hdr().type != elf::sht::symtab &&
+			section.get_hdr().type != elf::sht::dynsym)
+			continue;
+		for (auto sym : section.as_symtab()) {
+			if (stopping)
+				return {};
+			const auto& data = sym.get_data();
+			if (data.value == 0 || (data.type() != elf::stt::func &&
+									(functions_only ||
+									 data.type() != elf::stt::object)))
+				continue;
+			std::size_t length{ 0 };
+			auto		name = sym.get_name(&length);
+			if (length != 0)
+				names.emplace_back(name, length);
+		}
+	}
+	return names;
+}
+
+// "ns::f<int>(int) const" -> "ns::f<int>". "(anonymous namespace)" and the
+// operators keep their parentheses and angle brackets
+static std::string_view
+without_parameters(const std::string_view name)
+{
+	constexpr std::string_view ANONYMOUS{ "(anonymous namespace)" };
+	constexpr std::string_view OPERATOR{ "operator" };
+	int						   depth{ 0 };
+	for (std::size_t i = 0; i < name.size(); ++i) {
+		if (name.compare(i, ANONYMOUS.size(), ANONYMOUS) == 0) {
+			i += ANONYMOUS.size() - 1;
+		} else if (name.compare(i, OPERATOR.size(), OPERATOR) == 0) {
+			i += OPERATOR.size();
+			while (i < name.size() && std::strchr("<>=!+-*/%&|^~[],", name[i]))
+				++i;
+			if (name.compare(i, 2, "()") == 0)
+				i += 2;
+			--i;
+		} else if (name[i] == '<') {
+			++depth;
+		} else if (name[i] == '>') {
+			--depth;
+		} else if (name[i] == '(' && depth == 0) {
+			return name.substr(0, i);
+		}
+	}
+	return name;
+}
+
+String_Table::String_Table()
+	: m_size{ 0 }
+{
+}
+
+String_Table::String_Table(std::vector<std::string_view> names)
+{
+	std::sort(names.begin(), names.end());
+	names.erase(std::unique(names.begin(), names.end()), names.end());
+	m_size = names.size();
+	m_blocks.reserve(names.size() / BLOCK_NAMES + 1);
+
+	std::string_view previous;
+	for (std::size_t i = 0; i < names.size(); ++i) {
+		auto		name = names[i];
+		std::size_t shared{ 0 };
+		if (i % BLOCK_NAMES == 0) {
+			m_blocks.push_back(m_data.size());
+		} else {
+			auto limit = std::min(previous.size(), name.size());
+			while (shared < limit && previous[shared] == name[shared])
+				++shared;
+		}
+		write_varint(m_data, shared);
+		write_varint(m_data, name.size() - shared);
+		m_data.append(name.substr(shared));
+		previous = name;
+	}
+	m_data.shrink_to_fit();
+}
+
+std::string_view
+String_Table::block_head(const std::size_t offset) const
+{
+	auto data = m_data.data() + offset;
+	read_varint(data); // 0, nothing shared
+	auto length = read_varint(data);
+	return { data, length };
+}
+
+void
+String_Table::complete(const std::string_view	 prefix,
+					   const std::size_t		 limit,
+					   std::vector<std::string>& out) const
+{
+	// the names with the prefix start in the last block beginning before
+	// it, or in the first block beginning with it
+	auto block = std::partition_point(m_blocks.begin(),
+									  m_blocks.end(),
+									  [&](std::size_t offset) {
+										  return block_head(offset) < prefix;
+									  });
+	if (block != m_blocks.begin())
+		--block;
+
+	std::size_t found{ 0 };
+	std::string name;
+	auto		data = m_data.data() + (block == m_blocks.end() ? 0 : *block);
+	auto		end	 = m_data.data() + m_data.size();
+	while (data < end && found < limit) {
+		auto shared = read_varint(data);
+		auto length = read_varint(data);
+		name.resize(shared);
+		name.append(data, length);
+		data += length;
+		if (name.compare(0, prefix.size(), prefix) == 0) {
+			out.push_back(name);
+			++found;
+		} else if (name > prefix) {
+			// sorted: past the names with the prefix
+			break;
+		}
+	}
+}
+
+std::size_t
+String_Table::size() const
+{
+	return m_size;
+}
+
+std::size_t
+String_Table::memory_size() const
+{
+	return m_data.capacity() + m_blocks.capacity() * sizeof(std::size_t);
+}
+
+Completer::Completer(std::shared_ptr<const Debug_Image> image,
+					 const std::vector<std::string_view>& commands)
+	: m_image{ std::move(image) }
+	, m_commands{ commands }
+	, m_stopping{ false }
+{
+	// libelfin maps a section on its first use: map them all here, the
+	// threads then only read
+	for (const auto& section : m_image->elf.sections()) {
+		section.data();
+	}
+	m_indexer = std::thread{ [this] {
+		auto names = symbol_names(m_image->elf, false, m_stopping);
+		if (m_stopping)
+			return;
+		auto table = std::make_shared<const String_Table>(std::move(names));
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		m_symbols = std::move(table);
+	} };
+}
+
+Completer::~Completer()
+{
+	m_stopping = true;
+	if (m_indexer.joinable())
+		m_indexer.join();
+	if (m_demangler.joinable())
+		m_demangler.join();
+}
+
+const std::shared_ptr<const Debug_Image>&
+Completer::image() const
+{
+	return m_image;
+}
+
+std::vector<std::string>
+Completer::complete(const std::string_view line, const std::size_t limit)
+{
+	auto start = line.find_last_of(' ');
+	start	   = start == std::string_view::npos ? 0 : start + 1;
+	auto word  = line.substr(start);
+
+	std::vector<std::string> words;
+	if (line.find_first_not_of(' ') >= start) {
+		m_commands.complete(word, limit, words);
+	} else {
+		// file:line, but not ns::name
+		auto colon = word.rfind(':');
+		if (colon != std::string_view::npos && colon != 0 &&
+			word[colon - 1] != ':' &&
+			word.find_first_not_of("0123456789", colon + 1) ==
+				std::string_view::npos)
+			complete_line(
+				word.substr(0, colon), word.substr(colon + 1), limit, words);
+		else
+			complete_word(word, limit, words);
+	}
+
+	std::vector<std::string> lines;
+	lines.reserve(words.size());
+	for (const auto& completion : words) {
+		lines.push_back(std::string{ line.substr(0, start) } + completion);
+	}
+	return lines;
+}
+
+void
+Completer::complete_word(const std::string_view	   word,
+						 const std::size_t		   limit,
+						 std::vector<std::string>& out)
+{
+	files().complete(word, limit, out);
+	for (auto& file : out) {
+		file.push_back(':');
+	}
+
+	std::shared_ptr<const String_Table> symbols;
+	std::shared_ptr<const String_Table> demangled;
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		symbols	  = m_symbols;
+		demangled = m_demangled;
+	}
+	if (symbols)
+		symbols->complete(word, limit, out);
+	if (demangled)
+		demangled->complete(word, limit, out);
+	// nobody pays for demangling a program whose symbols are never completed
+	if (!m_demangler.joinable())
+		m_demangler = std::thread{ &Completer::demangle_symbols, this };
+
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+	if (out.size() > limit)
+		out.resize(limit);
+}
+
+void
+Completer::complete_line(const std::string_view	   file,
+						 const std::string_view	   line,
+						 const std::size_t		   limit,
+						 std::vector<std::string>& out)
+{
+	if (!m_image->has_dwarf())
+		return;
+	std::set<unsigned> lines;
+	for (const auto& unit : m_image->get_dwarf().compilation_units()) {
+		if (!is_path_suffix(file, dwarf::at_name(unit.root())))
+			continue;
+		auto table = m_image->line_table(unit);
+		for (std::size_t row = 0; row < table->size(); ++row) {
+			auto entry = table->entry(row);
+			if (entry.is_stmt && !entry.end_sequence &&
+				is_path_suffix(file, entry.file))
+				lines.insert(entry.line);
+		}
+	}
+	for (auto number : lines) {
+		auto text = std::to_string(number);
+		if (text.compare(0, line.size(), line) != 0)
+			continue;
+		out.push_back(std::string{ file } + ':' + text);
+		if (out.size() == limit)
+			break;
+	}
+}
+
+const String_Table&
+Completer::files()
+{
+	if (m_files)
+		return *m_files;
+	std::vector<std::string>	  paths;
+	std::vector<std::string_view> names;
+	if (m_image->has_dwarf()) {
+		for (const auto& unit : m_image->get_dwarf().compilation_units()) {
+			paths.push_back(dwarf::at_name(unit.root()));
+		}
+	}
+	for (const auto& path : paths) {
+		names.push_back(path);
+		auto slash = path.find_last_of('/');
+		if (slash != std::string::npos)
+			names.push_back(std::string_view{ path }.substr(slash + 1));
+	}
+	m_files.emplace(std::move(names));
+	return *m_files;
+}
+
+void
+Completer::demangle_symbols()
+{
+	// the demangled names are written one after the other, then indexed
+	std::string										 text;
+	std::vector<std::pair<std::size_t, std::size_t>> spans;
+	for (auto name : symbol_names(m_image->elf, true, m_stopping)) {
+		if (m_stopping)
+			return;
+		if (name.compare(0, 2, "_Z") != 0)
+			continue; // not C++
+		// the names end with a NUL in the string table
+		int	 status{ 0 };
+		auto demangled =
+			abi::__cxa_demangle(name.data(), nullptr, nullptr, &status);
+		if (status == 0) {
+			auto function = without_parameters(demangled);
+			spans.emplace_back(text.size(), function.size());
+			text.append(function);
+		}
+		std::free(demangled);
+	}
+
+	std::vector<std::string_view> names;
+	names.reserve(spans.size());
+	for (auto [offset, length] : spans) {
+		names.emplace_back(text.data() + offset, length);
+	}
+	auto table = std::make_shared<const String_Table>(std::move(names));
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	m_demangled = std::move(table);
+}
+
+};
@@ -0,0 +1,229 @@
+#include <coverage.hpp>
+#include <memory_access.hpp>
+
+#include <fcntl.h>	// open
+#include <unistd.h> // pwrite, close
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <utility>
+
+namespace mini_debugger {
+
+static constexpr uint8_t		INT3{ 0xcc };
+// breakpoints are written one page of code at a time
+static constexpr std::uintptr_t CODE_PAGE_SIZE{ 4096 };
+
+Coverage::Coverage(const pid_t pid)
+	: m_pid{ pid }
+	, m_mem_fd{ open(("/proc/" + std::to_string(pid) + "/mem").c_str(),
+					 O_RDWR | O_CLOEXEC) }
+{
+}
+
+Coverage::~Coverage()
+{
+	if (m_mem_fd >= 0) {
+		close(m_mem_fd);
+	}
+}
+
+std::size_t
+Coverage::insert(const std::vector<Coverage_Point>& points)
+{
+	// number the files and lines, a line usually has several statements
+	std::map<std::string_view, uint32_t>					  files;
+	std::map<std::pair<std::string_view, unsigned>, uint32_t> lines;
+	std::vector<std::pair<std::uintptr_t, uint32_t>>		  sites;
+	sites.reserve(points.size());
+	for (const auto& point : points) {
+		auto file = files.find(point.file);
+		if (file == files.end()) {
+			file = files.emplace(point.file, m_files.size()).first;
+			m_files.emplace_back(point.file);
+		}
+		auto line = lines.find({ point.file, point.line });
+		if (line == lines.end()) {
+			line = lines.emplace(std::make_pair(point.file, point.line),
+								 m_lines.size())
+					   .first;
+			m_lines.push_back(Source_Line{ file->second, point.line, false });
+		}
+		sites.emplace_back(point.address, line->second);
+	}
+	std::sort(sites.begin(), sites.end());
+	auto same_address = [](auto&& a, auto&& b) { return a.first == b.first; };
+	sites.erase(std::unique(sites.begin(), sites.end(), same_address),
+				sites.end());
+
+	// one read and one write for all the statements of a page
+	m_sites.reserve(m_sites.size() + sites.size());
+	std::size_t			 planted{ 0 };
+	std::vector<uint8_t> code;
+	for (std::size_t first = 0, last = 0; first < sites.size(); first = last) {
+		auto page = sites[first].first & ~(CODE_PAGE_SIZE - 1);
+		while (last < sites.size() &&
+			   (sites[last].first & ~(CODE_PAGE_SIZE - 1)) == page) {
+			++last;
+		}
+		auto start = sites[first].first;
+		code.resize(sites[last - 1].first + 1 - start);
+		if (!read_memory_block(m_pid, start, code.data(), code.size())) {
+			std::cerr << "Cannot read the code at 0x" << std::hex << start
+					  << std::dec << '\n';
+			continue;
+		}
+
+		std::vector<std::uintptr_t> added;
+		for (auto i = first; i < last; ++i) {
+			auto [address, line] = sites[i];
+			auto& byte			 = code[address - start];
+			// already a breakpoint (ours or someone else's)
+			if (byte == INT3 || m_sites.count(address))
+				continue;
+			m_sites.emplace(address, Breakpoint_Site{ line, byte });
+			added.push_back(address);
+			byte = INT3;
+		}
+		if (!write_memory_block(m_pid, start, code.data(), code.size())) {
+			std::cerr << "Cannot write the code at 0x" << std::hex << start
+					  << std::dec << '\n';
+			for (auto address : added) {
+				m_sites.erase(address);
+			}
+			continue;
+		}
+		planted += added.size();
+	}
+	return planted;
+}
+
+bool
+Coverage::hit(const std::uintptr_t address)
+{
+	auto site = m_sites.find(address);
+	if (site == m_sites.end())
+		return false;
+
+	auto saved_data = site->second.saved_data;
+	if (m_mem_fd < 0 || pwrite(m_mem_fd, &saved_data, 1, address) != 1) {
+		write_memory_block(m_pid, address, &saved_data, 1);
+	}
+	m_lines[site->second.line].covered = true;
+	m_sites.erase(site);
+	m_hit.insert(address);
+	return true;
+}
+
+bool
+Coverage::has_breakpoint(const std::uintptr_t address) const
+{
+	return m_sites.count(address) != 0 || m_hit.count(address) != 0;
+}
+
+void
+Coverage::restore(const pid_t pid) const
+{
+	write_breakpoints(pid, false);
+}
+
+void
+Coverage::replant() const
+{
+	write_breakpoints(m_pid, true);
+}
+
+void
+Coverage::forget_breakpoints()
+{
+	m_sites.clear();
+	m_hit.clear();
+	if (m_mem_fd >= 0) {
+		close(m_mem_fd);
+		m_mem_fd = -1;
+	}
+}
+
+void
+Coverage::write_breakpoints(const pid_t pid, const bool plant) const
+{
+	std::vector<std::uintptr_t> addresses;
+	addresses.reserve(m_sites.size());
+	for (const auto& [address, site] : m_sites) {
+		addresses.push_back(address);
+	}
+	std::sort(addresses.begin(), addresses.end());
+
+	std::vector<uint8_t> code;
+	for (std::size_t first = 0, last = 0; first < addresses.size();
+		 first = last) {
+		auto page = addresses[first] & ~(CODE_PAGE_SIZE - 1);
+		while (last < addresses.size() &&
+			   (addresses[last] & ~(CODE_PAGE_SIZE - 1)) == page) {
+			++last;
+		}
+		auto start = addresses[first];
+		code.resize(addresses[last - 1] + 1 - start);
+		if (!read_memory_block(pid, start, code.data(), code.size()))
+			continue;
+		for (auto i = first; i < last; ++i) {
+			code[addresses[i] - start] =
+				plant ? INT3 : m_sites.at(addresses[i]).saved_data;
+		}
+		write_memory_block(pid, start, code.data(), code.size());
+	}
+}
+
+std::size_t
+Coverage::line_count() const
+{
+	return m_lines.size();
+}
+
+std::size_t
+Coverage::covered_line_count() const
+{
+	return std::count_if(m_lines.begin(), m_lines.end(), [](auto&& line) {
+		return line.covered;
+	});
+}
+
+bool
+Coverage::write_lcov(const std::string& path) const
+{
+	std::ofstream out{ path };
+	if (!out) {
+		std::cerr << "Cannot write " << path << '\n';
+		return false;
+	}
+
+	// by file, then line
+	std::vector<const Source_Line*> lines;
+	for (const auto& line : m_lines) {
+		lines.push_back(&line);
+	}
+	std::sort(lines.begin(), lines.end(), [](auto a, auto b) {
+		return std::make_pair(a->file, a->line) <
+			   std::make_pair(b->file, b->line);
+	});
+
+	out << "TN:\n";
+	for (std::size_t first = 0, last = 0; first < lines.size(); first = last) {
+		std::size_t covered{ 0 };
+		out << "SF:" << m_files[lines[first]->file] << '\n';
+		for (; last < lines.size() && lines[last]->file == lines[first]->file;
+			 ++last) {
+			out << "DA:" << lines[last]->line << ','
+				<< (lines[last]->covered ? 1 : 0) << '\n';
+			covered += lines[last]->covered;
+		}
+		out << "LF:" << last - first << '\n'
+			<< "LH:" << covered << '\n'
+			<< "end_of_record\n";
+	}
+	return static_cast<bool>(out);
+}
+
+};
@@ -0,0 +1,250 @@
+#include <debug_image.hpp>
+#include <debug_section_loader.hpp>
+
+#include <fcntl.h>	  // open
+#include <sys/stat.h> // stat
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+
+namespace mini_debugger {
+
+// line tables of every image, least recently used first. A single lock
+// since evicting a table of one image can be caused by any other one
+static std::mutex cache_mutex;
+static std::list<std::pair<const Debug_Image*, dwarf::section_offset>>
+						cache_lru;
+static Debug_Info_Usage cache_usage{};
+
+std::shared_ptr<const Debug_Image>
+load_debug_image(const std::string& path)
+{
+	// keyed by file identity rather than by name, so that symlinks and
+	// relative paths to the same binary share the image. A rebuilt binary
+	// (new mtime) gets a new one
+	using Key = std::tuple<dev_t, ino_t, long, long>;
+	static std::mutex										 mutex;
+	static std::map<Key, std::weak_ptr<const Debug_Image>> images;
+
+	struct stat file_stat;
+	if (stat(path.c_str(), &file_stat) < 0) {
+		throw std::runtime_error{ "Cannot open " + path + ": " +
+								  strerror(errno) };
+	}
+	Key key{ file_stat.st_dev,
+			 file_stat.st_ino,
+			 file_stat.st_mtim.tv_sec,
+			 file_stat.st_mtim.tv_nsec };
+
+	std::lock_guard<std::mutex> lock{ mutex };
+	if (auto image = images[key].lock())
+		return image;
+
+	auto fd		= open(path.c_str(), O_RDONLY);
+	auto image	= std::make_shared<Debug_Image>();
+	image->path = path;
+	image->elf	= elf::elf{ elf::create_mmap_loader(fd) };
+	images[key] = image;
+	return image;
+}
+
+const dwarf::dwarf&
+Debug_Image::get_dwarf() const
+{
+	std::call_once(m_dwarf_once, [this] {
+		try {
+			m_loader = std::make_shared<Debug_Section_Loader>(elf);
+			m_dwarf	 = dwarf::dwarf{ m_loader };
+		} catch (std::exception&) {
+			// no .debug_info (stripped library), keep the invalid dwarf
+		}
+	});
+	return m_dwarf;
+}
+
+bool
+Debug_Image::has_dwarf() const
+{
+	return get_dwarf().valid();
+}
+
+std::shared_ptr<const Line_Table>
+Debug_Image::line_table(const dwarf::compilation_unit& unit) const
+{
+	auto offset = unit.get_section_offset();
+	{
+		std::lock_guard<std::mutex> lock{ cache_mutex };
+		auto						cached = m_line_tables.find(offset);
+		if (cached != m_line_tables.end()) {
+			cache_lru.splice(cache_lru.end(), cache_lru, cached->second.lru);
+			return cached->second.table;
+		}
+	}
+
+	// decode without the cache lock, other images stay usable meanwhile
+	std::shared_ptr<const Line_Table> table;
+	{
+		std::lock_guard<std::mutex> lock{ m_file_names_mutex };
+		table =
+			std::make_shared<Line_Table>(unit.get_line_table(), m_file_names);
+	}
+
+	std::lock_guard<std::mutex> lock{ cache_mutex };
+	auto [cached, inserted] = m_line_tables.try_emplace(offset);
+	if (!inserted) {
+		// decoded by another thread in the meantime
+		cache_lru.splice(cache_lru.end(), cache_lru, cached->second.lru);
+		return cached->second.table;
+	}
+	cached->second.table = table;
+	cached->second.size	 = table->memory_size();
+	cached->second.lru = cache_lru.insert(cache_lru.end(), { this, offset });
+	cache_usage.resident += cached->second.size;
+	evict_line_tables();
+	return table;
+}
+
+Debug_Image::~Debug_Image()
+{
+	std::lock_guard<std::mutex> lock{ cache_mutex };
+	for (auto& [offset, cached] : m_line_tables) {
+		cache_lru.erase(cached.lru);
+		cache_usage.resident -= cached.size;
+	}
+}
+
+void
+Debug_Image::evict_line_tables()
+{
+	// the table just used stays, even alone over the budget
+	while (cache_usage.budget != 0 &&
+		   cache_usage.resident > cache_usage.budget && cache_lru.size() > 1) {
+		auto [image, offset] = cache_lru.front();
+		auto cached			 = image->m_line_tables.find(offset);
+		cache_usage.resident -= cached->second.size;
+		cache_usage.evicted += cached->second.size;
+		++cache_usage.evictions;
+		// a caller still holding the table keeps it alive
+		image->m_line_tables.erase(cached);
+		cache_lru.pop_front();
+	}
+}
+
+std::vector<Elf_Symbol>
+Debug_Image::symbols_named(const std::string_view name) const
+{
+	std::call_once(m_symbols_once, [this] {
+		for (const auto& section : elf.sections()) {
+			if (section.get_hdr().type != elf::sht::symtab &&
+				section.get_hdr().type != elf::sht::dynsym)
+				continue;
+			for (auto sym : section.as_symtab()) {
+				const auto& data = sym.get_data();
+				// undefined: imported from another library
+				if (data.value == 0)
+					continue;
+				std::size_t length{ 0 };
+				auto		symbol_name = sym.get_name(&length);
+				m_symbols.push_back(
+					{ { symbol_name, length }, data.type(), data.value });
+			}
+		}
+		std::sort(m_symbols.begin(),
+				  m_symbols.end(),
+				  [](auto&& a, auto&& b) { return a.name < b.name; });
+	});
+
+	auto [first, last] = std::equal_range(
+		m_symbols.begin(),
+		m_symbols.end(),
+		Elf_Symbol{ name, elf::stt::notype, 0 },
+		[](auto&& a, auto&& b) { return a.name < b.name; });
+	return { first, last };
+}
+
+const dwarf::compilation_unit*
+Debug_Image::unit_at(const std::uintptr_t pc) const
+{
+	if (auto offset = index().unit_at(pc)) {
+		if (auto unit = unit_at_offset(*offset))
+			return unit;
+	}
+
+	// no .debug_aranges, or a unit it leaves out
+	for (const auto& unit : get_dwarf().compilation_units()) {
+		if (die_pc_range(unit.root()).contains(pc))
+			return &unit;
+	}
+	return nullptr;
+}
+
+std::vector<const dwarf::compilation_unit*>
+Debug_Image::units_named(const std::string_view name) const
+{
+	std::vector<const dwarf::compilation_unit*> units;
+	for (auto offset : index().units_named(name)) {
+		if (auto unit = unit_at_offset(offset))
+			units.push_back(unit);
+	}
+	if (!units.empty())
+		return units;
+
+	for (const auto& unit : get_dwarf().compilation_units()) {
+		units.push_back(&unit);
+	}
+	return units;
+}
+
+const Debug_Index&
+Debug_Image::index() const
+{
+	std::call_once(m_index_once, [this] {
+		if (get_dwarf().valid())
+			m_index = std::make_unique<Debug_Index>(*m_loader);
+	});
+	if (!m_index)
+		throw std::out_of_range{ "No debug information in " + path };
+	return *m_index;
+}
+
+const dwarf::compilation_unit*
+Debug_Image::unit_at_offset(const dwarf::section_offset offset) const
+{
+	// units are in the order of .debug_info
+	const auto& units = get_dwarf().compilation_units();
+	auto		unit  = std::lower_bound(
+		  units.begin(), units.end(), offset, [](auto&& unit, auto offset) {
+			  return unit.get_section_offset() < offset;
+		  });
+	if (unit == units.end() || unit->get_section_offset() != offset)
+		return nullptr;
+	return &*unit;
+}
+
+void
+set_debug_info_budget(const std::size_t bytes)
+{
+	std::lock_guard<std::mutex> lock{ cache_mutex };
+	cache_usage.budget = bytes;
+	Debug_Image::evict_line_tables();
+}
+
+Debug_Info_Usage
+debug_info_usage()
+{
+	Debug_Info_Usage usage;
+	{
+		std::lock_guard<std::mutex> lock{ cache_mutex };
+		usage = cache_usage;
+	}
+	usage.inflated = inflated_debug_bytes();
+	return usage;
+}
+
+};
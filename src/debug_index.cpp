@@ -0,0 +1,446 @@
+#include <debug_index.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace mini_debugger {
+
+// attributes and forms of .debug_names entries, libdwarf++ only knows DWARF 4
+static constexpr uint64_t IDX_COMPILE_UNIT{ 1 };
+static constexpr uint64_t IDX_TYPE_UNIT{ 2 };
+static constexpr uint64_t FORM_DATA2{ 0x05 };
+static constexpr uint64_t FORM_DATA4{ 0x06 };
+static constexpr uint64_t FORM_DATA8{ 0x07 };
+static constexpr uint64_t FORM_DATA1{ 0x0b };
+static constexpr uint64_t FORM_FLAG{ 0x0c };
+static constexpr uint64_t FORM_SDATA{ 0x0d };
+static constexpr uint64_t FORM_UDATA{ 0x0f };
+static constexpr uint64_t FORM_REF1{ 0x11 };
+static constexpr uint64_t FORM_REF2{ 0x12 };
+static constexpr uint64_t FORM_REF4{ 0x13 };
+static constexpr uint64_t FORM_REF8{ 0x14 };
+static constexpr uint64_t FORM_REF_UDATA{ 0x15 };
+static constexpr uint64_t FORM_FLAG_PRESENT{ 0x19 };
+static constexpr uint64_t FORM_DATA16{ 0x1e };
+
+// bounds checked little endian reads, throw std::out_of_range past the end
+struct Reader
+{
+	const uint8_t* pos;
+	const uint8_t* end;
+
+	template<typename T>
+	T read()
+	{
+		skip(sizeof(T));
+		T value;
+		std::memcpy(&value, pos - sizeof(T), sizeof(T));
+		return value;
+	}
+
+	uint64_t read_offset(const bool dwarf64)
+	{
+		return dwarf64 ? read<uint64_t>() : read<uint32_t>();
+	}
+
+	uint64_t read_uleb()
+	{
+		uint64_t value{ 0 };
+		for (unsigned shift = 0;; shift += 7) {
+			auto byte = read<uint8_t>();
+			if (shift < 64)
+				value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+	}
+
+	// value of an attribute of form `form`
+	uint64_t read_form(const uint64_t form)
+	{
+		switch (form) {
+		case FORM_DATA1:
+		case FORM_REF1:
+		case FORM_FLAG:
+			return read<uint8_t>();
+		case FORM_DATA2:
+		case FORM_REF2:
+			return read<uint16_t>();
+		case FORM_DATA4:
+		case FORM_REF4:
+			return read<uint32_t>();
+		case FORM_DATA8:
+		case FORM_REF8:
+			return read<uint64_t>();
+		case FORM_UDATA:
+		case FORM_REF_UDATA:
+		case FORM_SDATA:
+			return read_uleb();
+		case FORM_FLAG_PRESENT:
+			return 1;
+		case FORM_DATA16:
+			skip(16);
+			return 0;
+		default:
+			throw std::out_of_range{ "Unknown form " + std::to_string(form) };
+		}
+	}
+
+	void skip(const uint64_t size)
+	{
+		if (size > static_cast<uint64_t>(end - pos))
+			throw std::out_of_range{ "Truncated section" };
+		pos += size;
+	}
+
+	// initial length of a unit: its size and whether it is 64 bit DWARF
+	std::pair<uint64_t, bool> read_length()
+	{
+		uint64_t length = read<uint32_t>();
+		if (length != 0xffffffff)
+			return { length, false };
+		return { read<uint64_t>(), true };
+	}
+
+	// reader over the next `size` bytes, which are skipped
+	Reader sub(const uint64_t size)
+	{
+		skip(size);
+		return Reader{ pos - size, pos };
+	}
+};
+
+// the string at `offset` of `strings`, empty if out of the section
+static std::string_view
+string_at(const uint8_t* strings, const std::size_t size, uint64_t offset)
+{
+	if (offset >= size)
+		return {};
+	auto str = reinterpret_cast<const char*>(strings) + offset;
+	return { str, strnlen(str, size - offset) };
+}
+
+Debug_Index::Debug_Index(Debug_Section_Loader& loader)
+	: m_strings{ nullptr }
+	, m_strings_size{ 0 }
+	, m_gdb_symbols{ nullptr }
+	, m_gdb_constants{ nullptr }
+	, m_gdb_end{ nullptr }
+	, m_gdb_slots{ 0 }
+{
+	// a malformed table is dropped, lookups fall back to scanning the units
+	auto read = [&loader](const char* name, auto reader) {
+		std::size_t size{ 0 };
+		auto		data =
+			static_cast<const uint8_t*>(loader.load_section(name, &size));
+		if (!data)
+			return;
+		try {
+			reader(data, size);
+		} catch (std::out_of_range& e) {
+			std::cerr << "Ignoring " << name << ": " << e.what() << '\n';
+		}
+	};
+
+	read(".debug_aranges", [this](const uint8_t* data, std::size_t size) {
+		read_aranges(data, size);
+	});
+	m_strings = static_cast<const uint8_t*>(
+		loader.load_section(".debug_str", &m_strings_size));
+	if (m_strings) {
+		read(".debug_names", [this](const uint8_t* data, std::size_t size) {
+			read_debug_names(data, size);
+		});
+	}
+	read(".gdb_index", [this](const uint8_t* data, std::size_t size) {
+		read_gdb_index(data, size);
+	});
+
+	std::sort(m_ranges.begin(), m_ranges.end(), [](auto&& a, auto&& b) {
+		return a.low < b.low;
+	});
+}
+
+std::optional<dwarf::section_offset>
+Debug_Index::unit_at(const std::uintptr_t pc) const
+{
+	auto range = std::upper_bound(
+		m_ranges.begin(),
+		m_ranges.end(),
+		pc,
+		[](std::uintptr_t pc, const Address_Range& r) { return pc < r.low; });
+	if (range == m_ranges.begin() || pc >= std::prev(range)->high)
+		return std::nullopt;
+	return std::prev(range)->unit;
+}
+
+std::vector<dwarf::section_offset>
+Debug_Index::units_named(const std::string_view name) const
+{
+	std::vector<dwarf::section_offset> units;
+	try {
+		for (const auto& index : m_name_indices) {
+			find_in_name_index(index, name, units);
+		}
+		find_in_gdb_index(name, units);
+	} catch (std::out_of_range&) {
+		// a corrupted entry, let the caller scan everything
+		return {};
+	}
+
+	std::sort(units.begin(), units.end());
+	units.erase(std::unique(units.begin(), units.end()), units.end());
+	return units;
+}
+
+void
+Debug_Index::read_aranges(const uint8_t* data, const std::size_t size)
+{
+	Reader reader{ data, data + size };
+	while (reader.pos < reader.end) {
+		auto start				 = reader.pos;
+		auto [length, dwarf64]	 = reader.read_length();
+		auto set				 = reader.sub(length);
+		auto version			 = set.read<uint16_t>();
+		auto unit				 = set.read_offset(dwarf64);
+		auto address_size		 = set.read<uint8_t>();
+		auto segment_selector_size = set.read<uint8_t>();
+		if (version != 2 || address_size != 8 || segment_selector_size != 0)
+			continue;
+
+		// the tuples are aligned on their size from the start of the set
+		set.skip((16 - (set.pos - start) % 16) % 16);
+		while (true) {
+			auto low	= set.read<uint64_t>();
+			auto extent = set.read<uint64_t>();
+			if (low == 0 && extent == 0)
+				break;
+			// code of functions the linker discarded
+			if (extent == 0 || low == 0 || low == UINT64_MAX)
+				continue;
+			m_ranges.push_back(Address_Range{ low, low + extent, unit });
+		}
+	}
+}
+
+void
+Debug_Index::read_debug_names(const uint8_t* data, const std::size_t size)
+{
+	Reader reader{ data, data + size };
+	while (reader.pos < reader.end) {
+		auto [length, dwarf64] = reader.read_length();
+		auto names			   = reader.sub(length);
+		if (names.read<uint16_t>() != 5)
+			continue;
+		names.skip(2); // padding
+
+		Name_Index index;
+		index.dwarf64			= dwarf64;
+		auto unit_count			= names.read<uint32_t>();
+		auto local_type_units	= names.read<uint32_t>();
+		auto foreign_type_units = names.read<uint32_t>();
+		index.bucket_count		= names.read<uint32_t>();
+		index.name_count		= names.read<uint32_t>();
+		auto abbrevs_size		= names.read<uint32_t>();
+		names.skip(names.read<uint32_t>()); // augmentation string
+
+		for (uint32_t i = 0; i < unit_count; ++i) {
+			index.units.push_back(names.read_offset(dwarf64));
+		}
+		std::size_t offset_size = dwarf64 ? 8 : 4;
+		names.skip(local_type_units * offset_size);
+		names.skip(foreign_type_units * uint64_t{ 8 });
+
+		index.buckets = names.pos;
+		names.skip(index.bucket_count * uint64_t{ 4 });
+		// no hashes without buckets, the names are then searched linearly
+		index.hashes = names.pos;
+		if (index.bucket_count)
+			names.skip(index.name_count * uint64_t{ 4 });
+		index.string_offsets = names.pos;
+		names.skip(index.name_count * offset_size);
+		index.entry_offsets = names.pos;
+		names.skip(index.name_count * offset_size);
+		index.abbrevs = names.pos;
+		names.skip(abbrevs_size);
+		index.entries = names.pos;
+		index.end	  = names.end;
+		m_name_indices.push_back(std::move(index));
+	}
+}
+
+void
+Debug_Index::read_gdb_index(const uint8_t* data, const std::size_t size)
+{
+	// versions 7 and 8 share the layout, older ones are obsolete and 9 adds
+	// a header field
+	Reader reader{ data, data + size };
+	auto   version = reader.read<uint32_t>();
+	if (version < 7 || version > 8)
+		return;
+	auto units		= reader.read<uint32_t>();
+	auto type_units = reader.read<uint32_t>();
+	auto addresses	= reader.read<uint32_t>();
+	auto symbols	= reader.read<uint32_t>();
+	auto constants	= reader.read<uint32_t>();
+	if (!(units <= type_units && type_units <= addresses &&
+		  addresses <= symbols && symbols <= constants && constants <= size))
+		throw std::out_of_range{ "Bad header" };
+
+	Reader unit_list{ data + units, data + type_units };
+	while (unit_list.pos < unit_list.end) {
+		m_gdb_units.push_back(unit_list.read<uint64_t>());
+		unit_list.skip(8); // length
+	}
+
+	// .debug_aranges is usually there too, gdb builds this part from it
+	if (m_ranges.empty()) {
+		Reader address_area{ data + addresses, data + symbols };
+		while (address_area.pos < address_area.end) {
+			auto low  = address_area.read<uint64_t>();
+			auto high = address_area.read<uint64_t>();
+			auto unit = address_area.read<uint32_t>();
+			if (unit < m_gdb_units.size() && low != 0 && low < high)
+				m_ranges.push_back(
+					Address_Range{ low, high, m_gdb_units[unit] });
+		}
+	}
+
+	uint32_t slots = (constants - symbols) / 8;
+	if (slots & (slots - 1))
+		throw std::out_of_range{ "Bad symbol table" };
+	m_gdb_slots		= slots;
+	m_gdb_symbols	= data + symbols;
+	m_gdb_constants = data + constants;
+	m_gdb_end		= data + size;
+}
+
+void
+Debug_Index::find_in_name_index(const Name_Index&					index,
+								const std::string_view				name,
+								std::vector<dwarf::section_offset>& units) const
+{
+	auto read_u32 = [](const uint8_t* table, uint32_t i) {
+		uint32_t value;
+		std::memcpy(&value, table + i * std::size_t{ 4 }, 4);
+		return value;
+	};
+	auto read_offset = [&index](const uint8_t* table, uint32_t i) {
+		return Reader{ table + i * (index.dwarf64 ? std::size_t{ 8 } : 4),
+					   index.end }
+			.read_offset(index.dwarf64);
+	};
+
+	// every entry of name `i`, a series ended by a null abbreviation code
+	auto add_units = [&](uint32_t i) {
+		auto   offset = read_offset(index.entry_offsets, i);
+		Reader entry{ index.entries, index.end };
+		entry.skip(offset);
+		while (auto code = entry.read_uleb()) {
+			Reader abbrev{ index.abbrevs, index.entries };
+			while (abbrev.read_uleb() != code) {
+				abbrev.read_uleb(); // tag
+				while (abbrev.read_uleb() | abbrev.read_uleb()) {
+				}
+			}
+			abbrev.read_uleb();
+
+			std::optional<uint64_t> unit;
+			bool					type_unit{ false };
+			while (true) {
+				auto attribute = abbrev.read_uleb();
+				auto form	   = abbrev.read_uleb();
+				if (attribute == 0 && form == 0)
+					break;
+				auto value = entry.read_form(form);
+				if (attribute == IDX_COMPILE_UNIT)
+					unit = value;
+				else if (attribute == IDX_TYPE_UNIT)
+					type_unit = true;
+			}
+			// the unit is implicit when the index has only one
+			if (!unit && index.units.size() == 1)
+				unit = 0;
+			if (!type_unit && unit && *unit < index.units.size())
+				units.push_back(index.units[*unit]);
+		}
+	};
+	auto matches = [&](uint32_t i) {
+		auto offset = read_offset(index.string_offsets, i);
+		return string_at(m_strings, m_strings_size, offset) == name;
+	};
+
+	if (index.bucket_count == 0) {
+		for (uint32_t i = 0; i < index.name_count; ++i) {
+			if (matches(i))
+				add_units(i);
+		}
+		return;
+	}
+
+	// DJB hash of the case folded name, the names of a bucket are
+	// contiguous
+	uint32_t hash{ 5381 };
+	for (unsigned char c : name) {
+		hash = hash * 33 + std::tolower(c);
+	}
+	auto bucket = hash % index.bucket_count;
+	auto first	= read_u32(index.buckets, bucket);
+	if (first == 0)
+		return;
+	for (auto i = first - 1; i < index.name_count; ++i) {
+		auto name_hash = read_u32(index.hashes, i);
+		if (name_hash % index.bucket_count != bucket)
+			break;
+		if (name_hash == hash && matches(i))
+			add_units(i);
+	}
+}
+
+void
+Debug_Index::find_in_gdb_index(const std::string_view				name,
+							   std::vector<dwarf::section_offset>& units) const
+{
+	if (m_gdb_slots == 0)
+		return;
+	auto read_u32 = [this](const uint8_t* address) {
+		Reader reader{ address, m_gdb_end };
+		return reader.read<uint32_t>();
+	};
+
+	// open addressing on gdb's own string hash
+	uint32_t hash{ 0 };
+	for (unsigned char c : name) {
+		hash = hash * 67 + std::tolower(c) - 113;
+	}
+	auto constants_size = static_cast<std::size_t>(m_gdb_end - m_gdb_constants);
+	auto mask			= m_gdb_slots - 1;
+	auto slot = hash & mask;
+	auto step = ((hash * 17) & mask) | 1;
+	for (uint32_t probe = 0; probe < m_gdb_slots; ++probe) {
+		auto name_offset   = read_u32(m_gdb_symbols + slot * 8);
+		auto vector_offset = read_u32(m_gdb_symbols + slot * 8 + 4);
+		if (name_offset == 0 && vector_offset == 0)
+			return;
+		if (string_at(m_gdb_constants, constants_size, name_offset) == name) {
+			// count then the units, the top byte holds the kind of symbol
+			if (vector_offset >= constants_size)
+				return;
+			Reader vector{ m_gdb_constants + vector_offset, m_gdb_end };
+			for (auto count = vector.read<uint32_t>(); count > 0; --count) {
+				auto unit = vector.read<uint32_t>() & 0xffffff;
+				if (unit < m_gdb_units.size())
+					units.push_back(m_gdb_units[unit]);
+			}
+			return;
+		}
+		slot = (slot + step) & mask;
+	}
+}
+
+};
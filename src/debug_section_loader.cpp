@@ -0,0 +1,237 @@
+#include <debug_section_loader.hpp>
+
+#include <elf.h> // Elf64_Chdr, SHF_COMPRESSED
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+namespace mini_debugger {
+
+// ch_type of zstd compressed sections, missing from older <elf.h>
+static constexpr uint32_t COMPRESS_ZSTD{ 2 };
+// .zdebug_* header: "ZLIB" then the inflated size, big endian
+static constexpr std::size_t ZDEBUG_HEADER_SIZE{ 12 };
+// needed by nearly every query, the others are inflated on their first use
+static const char* const PREFETCHED_SECTIONS[]{ ".debug_info",
+												".debug_abbrev",
+												".debug_line" };
+
+static std::atomic<std::size_t> inflated_bytes{ 0 };
+
+std::size_t
+inflated_debug_bytes()
+{
+	return inflated_bytes;
+}
+
+#ifdef HAVE_ZSTD
+// frames of at least this size are inflated on their own thread
+static constexpr std::size_t PARALLEL_FRAME_SIZE{ 1 << 20 };
+
+// inflate the zstd `data` into `out`, whose size is the inflated one. Each
+// frame is independent, so the frames of a multi-frame stream (zstd -B,
+// pzstd) are inflated in parallel
+static bool
+inflate_zstd(const uint8_t* data, std::size_t size, std::vector<uint8_t>& out)
+{
+	struct Frame
+	{
+		const uint8_t* data;
+		std::size_t	   size;
+		std::size_t	   offset;
+		std::size_t	   inflated_size;
+	};
+	std::vector<Frame> frames;
+	std::size_t		   offset{ 0 };
+	for (std::size_t read = 0; read < size;) {
+		auto frame_size =
+			ZSTD_findFrameCompressedSize(data + read, size - read);
+		if (ZSTD_isError(frame_size)) {
+			frames.clear();
+			break;
+		}
+		auto content = ZSTD_getFrameContentSize(data + read, frame_size);
+		if (content == ZSTD_CONTENTSIZE_ERROR ||
+			content == ZSTD_CONTENTSIZE_UNKNOWN ||
+			offset + content > out.size()) {
+			frames.clear();
+			break;
+		}
+		frames.push_back(Frame{ data + read, frame_size, offset, content });
+		read += frame_size;
+		offset += content;
+	}
+
+	// sizes of the frames not recorded: one pass over the whole stream
+	if (frames.empty()) {
+		auto result = ZSTD_decompress(out.data(), out.size(), data, size);
+		return !ZSTD_isError(result) && result == out.size();
+	}
+
+	auto inflate_frame = [&out](const Frame& frame) {
+		auto result = ZSTD_decompress(out.data() + frame.offset,
+									  frame.inflated_size,
+									  frame.data,
+									  frame.size);
+		return !ZSTD_isError(result) && result == frame.inflated_size;
+	};
+	std::vector<std::future<bool>> workers;
+	bool						   ok{ true };
+	for (const auto& frame : frames) {
+		if (frame.inflated_size >= PARALLEL_FRAME_SIZE && frames.size() > 1)
+			workers.push_back(
+				std::async(std::launch::async, inflate_frame, frame));
+		else
+			ok = inflate_frame(frame) && ok;
+	}
+	for (auto& worker : workers)
+		ok = worker.get() && ok;
+	return ok && offset == out.size();
+}
+#endif
+
+Debug_Section_Loader::Debug_Section_Loader(const elf::elf& file)
+	: m_elf{ file }
+{
+	for (const auto& section : m_elf.sections()) {
+		auto name = section.get_name();
+		auto data = static_cast<const uint8_t*>(section.data());
+		auto size = section.size();
+
+		auto entry			= std::make_unique<Section>();
+		entry->name			= name;
+		entry->compression	= Compression::none;
+		entry->data			= data;
+		entry->size			= size;
+		entry->inflated_size = size;
+		entry->valid		= true;
+		if (name.rfind(".zdebug_", 0) == 0) {
+			// the GNU format predating SHF_COMPRESSED
+			if (size < ZDEBUG_HEADER_SIZE || std::memcmp(data, "ZLIB", 4) != 0)
+				continue;
+			name = ".debug_" + name.substr(8);
+			entry->compression	 = Compression::zlib;
+			entry->inflated_size = 0;
+			for (int i = 4; i < 12; ++i)
+				entry->inflated_size = entry->inflated_size << 8 | data[i];
+			entry->data = data + ZDEBUG_HEADER_SIZE;
+			entry->size = size - ZDEBUG_HEADER_SIZE;
+		} else if (name.rfind(".debug_", 0) != 0 && name != ".gdb_index") {
+			continue;
+		} else if (static_cast<std::uint64_t>(section.get_hdr().flags) &
+				   SHF_COMPRESSED) {
+			Elf64_Chdr header;
+			if (size < sizeof(header))
+				continue;
+			std::memcpy(&header, data, sizeof(header));
+			if (header.ch_type == ELFCOMPRESS_ZLIB) {
+				entry->compression = Compression::zlib;
+			} else if (header.ch_type == COMPRESS_ZSTD) {
+				entry->compression = Compression::zstd;
+			} else {
+				std::cerr << "Unknown compression of " << name << '\n';
+				continue;
+			}
+			entry->inflated_size = header.ch_size;
+			entry->data			 = data + sizeof(header);
+			entry->size			 = size - sizeof(header);
+		}
+
+		m_sections[name] = std::move(entry);
+	}
+}
+
+Debug_Section_Loader::~Debug_Section_Loader()
+{
+	// the background threads write into our sections
+	for (auto& task : m_prefetch) {
+		task.wait();
+	}
+	for (auto& [name, section] : m_sections) {
+		inflated_bytes -= section->contents.size();
+	}
+}
+
+const void*
+Debug_Section_Loader::load(dwarf::section_type section, size_t* size_out)
+{
+	return load_section(dwarf::elf::section_type_to_name(section), size_out);
+}
+
+const void*
+Debug_Section_Loader::load_section(const std::string& name,
+								   std::size_t*		  size_out)
+{
+	auto found = m_sections.find(name);
+	if (found == m_sections.end())
+		return nullptr;
+
+	auto& entry = *found->second;
+	if (entry.compression == Compression::none) {
+		*size_out = entry.size;
+		return entry.data;
+	}
+
+	start_prefetch();
+	std::call_once(entry.once, [&] { inflate(entry); });
+	if (!entry.valid)
+		return nullptr;
+	*size_out = entry.contents.size();
+	return entry.contents.data();
+}
+
+void
+Debug_Section_Loader::inflate(Section& section)
+{
+	section.contents.resize(section.inflated_size);
+	bool ok{ false };
+	if (section.compression == Compression::zlib) {
+		// a single deflate stream, it can only be inflated in order
+		uLongf size = section.contents.size();
+		ok			= uncompress(section.contents.data(),
+						 &size,
+						 section.data,
+						 section.size) == Z_OK &&
+			 size == section.contents.size();
+	} else {
+#ifdef HAVE_ZSTD
+		ok = inflate_zstd(section.data, section.size, section.contents);
+#else
+		std::cerr << section.name
+				  << " is zstd compressed, mini_debugger was built without "
+					 "zstd\n";
+#endif
+	}
+
+	if (!ok) {
+		std::cerr << "Cannot decompress " << section.name << '\n';
+		section.contents.clear();
+		section.contents.shrink_to_fit();
+		section.valid = false;
+	}
+	inflated_bytes += section.contents.size();
+}
+
+void
+Debug_Section_Loader::start_prefetch()
+{
+	std::call_once(m_prefetch_once, [this] {
+		for (auto name : PREFETCHED_SECTIONS) {
+			auto found = m_sections.find(name);
+			if (found == m_sections.end() ||
+				found->second->compression == Compression::none)
+				continue;
+			auto entry = found->second.get();
+			m_prefetch.push_back(std::async(std::launch::async, [this, entry] {
+				std::call_once(entry->once, [&] { inflate(*entry); });
+			}));
+		}
+	});
+}
+
+};
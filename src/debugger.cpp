@@ -1,19 +1,70 @@
 #include <debugger.hpp>
 #include <expr_context.hpp>
+#include <inferior_syscall.hpp>
 #include <linenoise.h>
+#include <memory_access.hpp>
 #include <registers.hpp>
-
-#include <fcntl.h>		// open
-#include <sys/ptrace.h> // ptrace
-#include <sys/wait.h>	// waitpid
-
+#include <syscalls.hpp>
+
+#include <link.h>			// r_debug, Elf64_Dyn
+#include <fcntl.h>			// open
+#include <signal.h>			// kill
+#include <sys/personality.h> // personality
+#include <sys/ptrace.h>		// ptrace
+#include <sys/syscall.h>	// SYS_tgkill, SYS_mmap
+#include <sys/user.h>		// user_regs_struct
+#include <sys/wait.h>		// waitpid
+#include <unistd.h>			// readlink, fork, execve, syscall
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits> // PATH_MAX
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace mini_debugger {
 
+// report new threads, forks and execs of the debugee, the threads and the
+// children are traced as well
+static constexpr long PROCESS_TRACE_OPTIONS{ PTRACE_O_TRACECLONE |
+											 PTRACE_O_TRACEFORK |
+											 PTRACE_O_TRACEVFORK |
+											 PTRACE_O_TRACEVFORKDONE |
+											 PTRACE_O_TRACEEXEC };
+
+// first words of the command lines, offered by tab completion
+static const std::vector<std::string_view> COMMANDS{
+	"backtrace", "break",	   "catch",		   "checkpoint", "continue",
+	"detach",	 "display",	   "finish",	   "heap",		 "inferior",
+	"info",		 "memory",	   "next",		   "quit",		 "record",
+	"register",	 "restart",	   "reverse-next", "reverse-step", "run",
+	"set",		 "step",	   "symbol",	   "thread",	 "trace",
+	"tracepoint", "undisplay", "unset",		   "unwatch",	 "variables",
+	"watch"
+};
+// completions handed to linenoise for one tab
+static constexpr std::size_t MAX_COMPLETIONS{ 64 };
+
+// the debugger reading commands, linenoise takes a plain function
+static Debugger* completing_debugger{ nullptr };
+
+static void
+complete_command_line(const char* buffer, linenoiseCompletions* completions)
+{
+	for (const auto& line : completing_debugger->complete(buffer)) {
+		linenoiseAddCompletion(completions, line.c_str());
+	}
+}
+
 // split the input `line` by `pattern`
 static std::vector<std::string>
 split(const std::string_view line, const char pattern)
@@ -73,6 +124,156 @@ to_string(symbol_type symbol)
 	return {};
 }
 
+// list the ids of all threads of process `pid`
+static std::vector<pid_t>
+list_threads(const pid_t pid)
+{
+	std::vector<pid_t> tids;
+	std::error_code	   ec;
+	for (const auto& task : std::filesystem::directory_iterator(
+			 "/proc/" + std::to_string(pid) + "/task", ec)) {
+		tids.emplace_back(std::stoi(task.path().filename().string()));
+	}
+	return tids;
+}
+
+// region of `regions` (sorted) containing `address`, nullptr if none
+static const Memory_Region*
+region_of(const std::vector<Memory_Region>& regions,
+		  const std::uintptr_t				address)
+{
+	auto region = std::upper_bound(
+		regions.begin(),
+		regions.end(),
+		address,
+		[](std::uintptr_t address, auto&& region) {
+			return address < region.start;
+		});
+	if (region == regions.begin() || address >= std::prev(region)->end)
+		return nullptr;
+	return &*std::prev(region);
+}
+
+// return addresses of the stack of a thread stopped with `regs`, pc first,
+// following the frame pointers. The top of the stack is read with a single
+// process_vm_readv, deeper frames a word pair at a time. Only reads memory:
+// safe on any thread of ours while the regions do not change
+static std::vector<std::uintptr_t>
+unwind_stack(const pid_t						pid,
+			 const user_regs_struct&			regs,
+			 const std::vector<Memory_Region>& regions)
+{
+	// unwinding through code without frame pointers can loop
+	static constexpr std::size_t MAX_FRAMES{ 256 };
+	// most stacks are shallower than this
+	static constexpr std::size_t STACK_WINDOW{ 64 * 1024 };
+
+	std::vector<std::uintptr_t> frames{ regs.rip };
+	std::vector<char>			window;
+	std::uintptr_t				window_start = regs.rsp;
+	if (auto stack = region_of(regions, regs.rsp)) {
+		window.resize(std::min<std::uintptr_t>(STACK_WINDOW,
+											   stack->end - regs.rsp));
+		if (!read_memory_block(pid, window_start, window.data(), window.size()))
+			window.clear();
+	}
+
+	std::uintptr_t frame_pointer = regs.rbp;
+	while (frames.size() < MAX_FRAMES) {
+		// saved frame pointer, then the return address
+		std::uintptr_t frame[2];
+		if (frame_pointer >= window_start &&
+			frame_pointer + sizeof(frame) <= window_start + window.size())
+			std::memcpy(frame,
+						window.data() + (frame_pointer - window_start),
+						sizeof(frame));
+		else if (!read_memory_block(pid, frame_pointer, frame, sizeof(frame)))
+			break;
+
+		// the checks of valid_frame(), on the regions read beforehand
+		auto stack = region_of(regions, frame_pointer);
+		auto code  = region_of(regions, frame[1]);
+		if (stack == nullptr || !stack->writable || code == nullptr ||
+			!code->executable)
+			break;
+		frames.push_back(frame[1]);
+		// callers are higher up the stack, anything else is garbage
+		if (frame[0] <= frame_pointer)
+			break;
+		frame_pointer = frame[0];
+	}
+	return frames;
+}
+
+// path of the executable running as process `pid`
+std::string
+executable_of(const pid_t pid)
+{
+	std::string link{ "/proc/" + std::to_string(pid) + "/exe" };
+	char		path[PATH_MAX]{};
+	auto		len = readlink(link.c_str(), path, sizeof(path) - 1);
+	if (len < 0)
+		return {};
+	return std::string(path, len);
+}
+
+pid_t
+launch_program(const Launch_Options& options)
+{
+	// everything exec needs is built before the fork
+	std::vector<std::string> environment;
+	for (auto variable = environ; *variable; ++variable) {
+		std::string_view entry{ *variable };
+		if (!options.environment.count(
+				std::string{ entry.substr(0, entry.find('=')) }))
+			environment.emplace_back(entry);
+	}
+	for (const auto& [name, value] : options.environment) {
+		if (value)
+			environment.push_back(name + '=' + *value);
+	}
+	std::vector<char*> envp;
+	for (auto& entry : environment) {
+		envp.push_back(entry.data());
+	}
+	envp.push_back(nullptr);
+
+	std::vector<std::string> args{ options.program };
+	args.insert(args.end(), options.args.begin(), options.args.end());
+	std::vector<char*> argv;
+	for (auto& arg : args) {
+		argv.push_back(arg.data());
+	}
+	argv.push_back(nullptr);
+
+	auto pid = fork();
+	if (pid != 0)
+		return pid;
+
+	if (!options.input.empty()) {
+		auto fd = open(options.input.c_str(), O_RDONLY);
+		if (fd < 0 || dup2(fd, STDIN_FILENO) < 0)
+			_exit(127);
+		close(fd);
+	}
+	if (!options.output.empty()) {
+		auto fd =
+			open(options.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0)
+			_exit(127);
+		close(fd);
+	}
+	personality(ADDR_NO_RANDOMIZE);
+	if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0)
+		_exit(127);
+	// the filter survives exec, from then on only the selected system calls
+	// stop the debugee
+	if (!options.syscalls.empty() && !install_syscall_filter(options.syscalls))
+		_exit(127);
+	execve(options.program.c_str(), argv.data(), envp.data());
+	_exit(127);
+}
+
 symbol_type
 to_symbol_type(elf::stt sym)
 {
@@ -93,23 +294,69 @@ to_symbol_type(elf::stt sym)
 }
 
 Debugger::Debugger(std::string prog_name, const pid_t pid)
-	: m_prog_name{ std::move(prog_name) }
+	: m_inferior_id{ 1 }
+	, m_prog_name{ std::move(prog_name) }
+	, m_image{ load_debug_image(m_prog_name) }
 	, m_pid{ pid }
+	, m_tid{ pid }
+	, m_attached{ false }
 	, m_load_address{ 0 }
+	, m_r_debug{ 0 }
+	, m_block_step{ true }
+	, m_resume_request{ PTRACE_CONT }
+	, m_wait_status{ 0 }
+	, m_remap_on_resume{ false }
+	, m_page_tracker{ pid }
+	, m_displaced_stepper{ pid }
+	, m_next_watch_id{ 1 }
+	, m_watch_stop{ false }
+	, m_next_checkpoint_id{ 1 }
+	, m_next_inferior_id{ 2 }
+	, m_follow_child{ false }
+	, m_detach_on_fork{ true }
+	, m_vfork_parent{ 0 }
 {
-	auto fd = open(m_prog_name.c_str(), O_RDONLY);
-
-	m_elf	= elf::elf{ elf::create_mmap_loader(fd) };
-	m_dwarf = dwarf::dwarf{ dwarf::elf::create_loader(m_elf) };
+	// handles sharing the parsed state of the image
+	if (!m_image->has_dwarf()) {
+		throw std::runtime_error{ "No debug information in " + m_prog_name };
+	}
+	m_elf	= m_image->elf;
+	m_dwarf = m_image->get_dwarf();
 }
 
 void
-Debugger::run()
+Debugger::wait_for_launch()
 {
 	// wait until the child process has finished launching
+	m_threads.assign(1, m_pid);
+	m_stopping_threads.clear();
+	m_pending_signals.clear();
 	wait_for_signal();
 	// find the load address of the program
 	initialise_load_address();
+	// the filter installed before exec only reports to us with
+	// PTRACE_O_TRACESECCOMP, otherwise the filtered system calls fail with
+	// ENOSYS
+	auto options = PROCESS_TRACE_OPTIONS;
+	if (!m_filtered_syscalls.empty()) {
+		options |= PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD |
+				   PTRACE_O_EXITKILL;
+	}
+	ptrace(PTRACE_SETOPTIONS, m_pid, nullptr, options);
+}
+
+void
+Debugger::run()
+{
+	// attach() already stopped the process and found its load address
+	if (!m_attached) {
+		wait_for_launch();
+	}
+
+	// the symbols are indexed while the user types the first command
+	m_completer			= std::make_unique<Completer>(m_image, COMMANDS);
+	completing_debugger = this;
+	linenoiseSetCompletionCallback(complete_command_line);
 
 	// listen and handle user input with linenoise
 	char* line{ nullptr };
@@ -118,6 +365,113 @@ Debugger::run()
 		linenoiseHistoryAdd(line);
 		linenoiseFree(line);
 	}
+
+	// never leave a process we attached to stopped or with INT3s in its code
+	if (m_attached) {
+		detach();
+	}
+	// once we are gone they would run on their own
+	kill_checkpoints();
+}
+
+std::vector<std::string>
+Debugger::complete(const std::string_view line)
+{
+	// after an exec, a rebuild or a switch of inferior
+	if (!m_completer || m_completer->image() != m_image) {
+		m_completer = std::make_unique<Completer>(m_image, COMMANDS);
+	}
+	return m_completer->complete(line, MAX_COMPLETIONS);
+}
+
+bool
+Debugger::attach()
+{
+	// the target keeps running until every thread is seized, so do the
+	// expensive work first: the constructor parsed the ELF/DWARF, decode the
+	// line tables here and read the mappings of the executable, which do not
+	// move once the process is running. Under a memory budget most tables
+	// would be evicted again, they are decoded on demand instead
+	if (debug_info_usage().budget == 0) {
+		for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+			m_image->line_table(compilation_unit);
+		}
+	}
+	initialise_load_address();
+
+	// threads can be created while we attach, so keep on listing the tasks
+	// until every thread we know of is stopped and no new thread shows up
+	m_attached = true;
+	bool found_new_thread{ true };
+	while (found_new_thread) {
+		found_new_thread = false;
+
+		std::vector<pid_t> seized;
+		for (auto tid : list_threads(m_pid)) {
+			if (std::find(m_threads.begin(), m_threads.end(), tid) !=
+				m_threads.end())
+				continue;
+			// PTRACE_SEIZE does not stop the thread, PTRACE_INTERRUPT does
+			if (ptrace(PTRACE_SEIZE, tid, nullptr, PROCESS_TRACE_OPTIONS) <
+				0) {
+				// the thread exited in the meantime
+				if (errno == ESRCH)
+					continue;
+				std::cerr << "Cannot attach to thread " << tid << ": "
+						  << strerror(errno) << '\n';
+				detach();
+				return false;
+			}
+			ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+			m_threads.emplace_back(tid);
+			seized.emplace_back(tid);
+			found_new_thread = true;
+		}
+
+		for (auto tid : seized) {
+			int wait_status{};
+			waitpid(tid, &wait_status, __WALL);
+		}
+	}
+
+	std::cout << "Attached to process " << m_pid << " (" << std::dec
+			  << m_threads.size() << " threads)\n";
+	return true;
+}
+
+void
+Debugger::detach()
+{
+	if (m_tracepoints) {
+		m_tracepoints->remove_all();
+	}
+	// take our INT3 instructions out of the code before letting it go
+	for (auto& bp : m_breakpoints) {
+		if (bp.is_enabled()) {
+			bp.disable();
+		}
+	}
+	for (auto tid : m_threads) {
+		auto pending = m_pending_signals.find(tid);
+		ptrace(PTRACE_DETACH,
+			   tid,
+			   nullptr,
+			   pending != m_pending_signals.end() ? pending->second : 0);
+	}
+	m_pending_signals.clear();
+	// no thread is known before the first stop of a launched process
+	if (m_threads.empty()) {
+		ptrace(PTRACE_DETACH, m_pid, nullptr, nullptr);
+	}
+	m_threads.clear();
+	m_attached = false;
+
+	// forked processes we kept are let go as well
+	for (auto& inferior : m_inferiors) {
+		detach_inferior(inferior);
+	}
+	m_inferiors.clear();
+	kill_checkpoints();
 }
 
 void
@@ -128,7 +482,7 @@ Debugger::handle_command(const std::string_view line)
 	auto command = args.at(0);
 
 	if (is_prefix(command, "continue")) {
-		continue_execution();
+		move(Movement::cont);
 	} else if (is_prefix(command, "break")) {
 		if (args.at(1)[0] == '0' && args.at(1)[1] == 'x') {
 			// naively assume that the user has written 0xADDRESS
@@ -142,26 +496,67 @@ Debugger::handle_command(const std::string_view line)
 		} else {
 			set_breakpoint_at_function(args.at(1));
 		}
+	} else if (command == "trace") {
+		if (args.size() > 2 && args.at(1) == "latency") {
+			trace_latency({ args.begin() + 2, args.end() });
+		} else if (args.size() == 2 && args.at(1) == "report" && m_latency) {
+			m_latency->print_report(std::cout);
+		} else {
+			std::cerr << "Usage: trace latency <function...>|report\n";
+		}
+	} else if (is_prefix(command, "tracepoint")) {
+		if (args.size() < 2 || args.at(1) == "list") {
+			if (m_tracepoints)
+				m_tracepoints->print_tracepoints();
+		} else if (args.at(1) == "events") {
+			if (m_tracepoints)
+				m_tracepoints->print_events(
+					args.size() > 2 ? std::stoul(args.at(2)) : 20);
+		} else {
+			set_tracepoint(args.at(1));
+		}
+	} else if (is_prefix(command, "record")) {
+		handle_record_command(args);
+	} else if (is_prefix(command, "catch")) {
+		if (args.size() < 2 || args.at(1) != "syscall") {
+			std::cerr << "Usage: catch syscall [names]\n";
+			return;
+		}
+		handle_catch_syscall_command(args);
 	} else if (is_prefix(command, "register")) {
 		if (is_prefix(args.at(1), "dump")) {
 			dump_registers();
 		} else if (is_prefix(args.at(1), "read")) {
-			std::cout << get_register_value(m_pid,
+			std::cout << get_register_value(m_tid,
 											get_register_from_name(args.at(2)))
 					  << std::endl;
 		} else if (is_prefix(args.at(1), "write")) {
 			std::string val{ args.at(3), 2 }; // assume 0xValue
-			set_register_value(m_pid,
+			set_register_value(m_tid,
 							   get_register_from_name(args.at(2)),
 							   std::stoull(val, 0, WORD_SIZE));
 		}
 	} else if (is_prefix(command, "memory")) {
 		std::string addr{ args.at(2), 2 }; // assume 0xADDRESS
+		auto		address = std::stoull(addr, 0, WORD_SIZE);
+		// the address may be in a mapping newer than the cache
+		m_memory_map.invalidate();
+		if (m_memory_map.find(m_pid, address) == nullptr) {
+			std::cerr << "Cannot access memory at address 0x" << std::hex
+					  << address << '\n';
+			return;
+		}
 
 		if (is_prefix(args.at(1), "read")) {
-			std::cout << std::hex
-					  << read_memory(std::stoull(addr, 0, WORD_SIZE))
-					  << std::endl;
+			// -1 is a valid word, errno tells a failed PTRACE_PEEKDATA apart
+			errno	   = 0;
+			auto value = read_memory(address);
+			if (errno != 0) {
+				std::cerr << "Cannot access memory at address 0x" << std::hex
+						  << address << '\n';
+				return;
+			}
+			std::cout << std::hex << value << std::endl;
 		}
 		if (is_prefix(args.at(1), "write")) {
 			std::string value{ args.at(3), 2 }; // assume 0xValue
@@ -169,140 +564,2095 @@ Debugger::handle_command(const std::string_view line)
 						 std::stoull(value, 0, WORD_SIZE));
 		}
 	} else if (is_prefix(command, "step")) {
-		step_in();
+		move(Movement::step);
 	} else if (is_prefix(command, "next")) {
-		step_over();
+		move(Movement::next);
 	} else if (is_prefix(command, "finish")) {
-		step_out();
+		move(Movement::finish);
+	} else if (command == "reverse-step") {
+		reverse_step(false);
+	} else if (command == "reverse-next") {
+		reverse_step(true);
+	} else if (is_prefix(command, "checkpoint")) {
+		take_checkpoint();
+	} else if (command == "run" ||
+			   (is_prefix(command, "restart") &&
+				(args.size() < 2 ||
+				 args.at(1).find_first_not_of("0123456789") !=
+					 std::string::npos))) {
+		rerun({ args.begin() + 1, args.end() });
+	} else if (is_prefix(command, "restart")) {
+		if (restart_checkpoint(std::stoul(args.at(1)))) {
+			print_location();
+		}
 	} else if (is_prefix(command, "symbol")) {
 		auto syms = lookup_symbol(args.at(1));
 		for (auto&& sym : syms) {
 			std::cout << sym.name << ' ' << mini_debugger::to_string(sym.type)
 					  << " 0x" << std::hex << sym.addr << std::endl;
 		}
-	} else if (is_prefix(command, "backtrace")) {
-		print_backtrace();
-	} else if (is_prefix(command, "variables")) {
-		read_variables();
-	} else if (is_prefix(command, "quit")) {
-		std::cout << "Exited from mini debugger\n";
-		exit(0);
-	} else {
-		std::cerr << "Unknown command\n";
+	} else if (is_prefix(command, "backtrace")) {
+		print_backtrace();
+	} else if (command == "thread") {
+		// thread apply all backtrace [--group]
+		if (args.size() >= 4 && args.at(1) == "apply" && args.at(2) == "all" &&
+			(is_prefix(args.at(3), "backtrace") || args.at(3) == "bt")) {
+			print_all_backtraces(args.size() > 4 && args.at(4) == "--group");
+		} else {
+			std::cerr << "Usage: thread apply all backtrace [--group]\n";
+		}
+	} else if (is_prefix(command, "variables")) {
+		read_variables();
+	} else if (is_prefix(command, "detach")) {
+		if (!m_attached) {
+			std::cerr << "Not attached to a running process\n";
+			return;
+		}
+		detach();
+		std::cout << "Detached from process " << std::dec << m_pid << '\n';
+		exit(0);
+	} else if (is_prefix(command, "quit")) {
+		if (m_attached) {
+			detach();
+		}
+		std::cout << "Exited from mini debugger\n";
+		exit(0);
+	} else if (is_prefix(command, "heap")) {
+		if (args.size() > 1 && is_prefix(args.at(1), "track")) {
+			track_heap();
+		} else if (args.size() > 1 && is_prefix(args.at(1), "report")) {
+			print_heap_report(args.size() > 2 ? std::stoul(args.at(2)) : 10);
+		} else {
+			std::cerr << "Usage: heap track|report [count]\n";
+		}
+	} else if (is_prefix(command, "inferior")) {
+		handle_inferior_command(args);
+	} else if (is_prefix(command, "info")) {
+		if (args.size() > 1 && is_prefix(args.at(1), "sharedlibrary")) {
+			print_libraries();
+		} else if (args.size() > 1 && args.at(1) == "proc") {
+			print_mappings();
+		} else if (args.size() > 1 && is_prefix(args.at(1), "debuginfo")) {
+			print_debug_info_usage();
+		} else if (args.size() > 1 && is_prefix(args.at(1), "checkpoints")) {
+			print_checkpoints();
+		} else {
+			std::cerr << "Usage: info sharedlibrary|proc "
+						 "mappings|debuginfo|checkpoints\n";
+		}
+	} else if (is_prefix(command, "set")) {
+		handle_set_command(args);
+	} else if (command == "unset") {
+		if (args.size() != 3 || args.at(1) != "environment" || !m_launch) {
+			std::cerr << "Usage: unset environment NAME\n";
+			return;
+		}
+		m_launch->environment[args.at(2)] = std::nullopt;
+	} else if (is_prefix(command, "watch")) {
+		if (args.size() < 2) {
+			for (auto&& watchpoint : m_watchpoints) {
+				std::cout << watchpoint.id << ": 0x" << std::hex
+						  << watchpoint.address << std::dec << ", "
+						  << watchpoint.length << " bytes\n";
+			}
+			return;
+		}
+		std::string addr{ args.at(1), 2 }; // assume 0xADDRESS
+		set_watchpoint(std::stoull(addr, 0, WORD_SIZE),
+					   args.size() > 2 ? std::stoull(args.at(2), 0, 0) : 8);
+	} else if (is_prefix(command, "unwatch")) {
+		auto id = std::stoul(args.at(1));
+		m_watchpoints.erase(
+			std::remove_if(m_watchpoints.begin(),
+						   m_watchpoints.end(),
+						   [id](auto&& watchpoint) {
+							   return watchpoint.id == id;
+						   }),
+			m_watchpoints.end());
+	} else if (is_prefix(command, "display")) {
+		if (args.size() < 2) {
+			for (auto& display : m_displays)
+				print_display(display);
+			return;
+		}
+		add_display(args.at(1));
+	} else if (is_prefix(command, "undisplay")) {
+		auto id = std::stoul(args.at(1));
+		m_displays.erase(
+			std::remove_if(m_displays.begin(),
+						   m_displays.end(),
+						   [id](auto&& display) { return display.id == id; }),
+			m_displays.end());
+	} else {
+		std::cerr << "Unknown command\n";
+	}
+}
+
+void
+Debugger::continue_execution()
+{
+	if (m_recorder.is_recording()) {
+		continue_recording();
+		return;
+	}
+
+	step_over_breakpoint();
+	resume_other_threads();
+	resume(PTRACE_CONT);
+	if (m_watchpoints.empty()) {
+		wait_for_signal();
+	} else {
+		wait_for_signal_watching();
+	}
+	stop_other_threads();
+
+	// the first stop after the dynamic loader ran: find the libraries and
+	// the rendezvous breakpoint which tracks the later ones
+	if (m_r_debug == 0) {
+		update_libraries();
+	}
+}
+
+void
+Debugger::record_state()
+{
+	user_regs_struct regs;
+	ptrace(PTRACE_GETREGS, m_tid, nullptr, &regs);
+	m_recorder.record(regs);
+}
+
+void
+Debugger::continue_recording()
+{
+	// with PTRACE_SINGLEBLOCK the cpu only traps on taken branches, so we
+	// record the start of every basic block instead of every instruction
+	bool first_step{ true };
+	while (true) {
+		record_state();
+
+		auto pc = get_pc();
+		auto bp = m_breakpoints.find(pc);
+		if (bp != nullptr && bp->is_enabled() &&
+			m_internal_breakpoints.count(pc)) {
+			// same as the INT3 being hit, without stopping
+			m_internal_breakpoints.at(pc)();
+			step_over_breakpoint();
+		} else if (bp != nullptr && bp->is_enabled()) {
+			if (!first_step) {
+				// reached the breakpoint without executing its INT3
+				std::cout << "Hit breakpoint at address 0x" << std::hex << pc
+						  << std::endl;
+				auto line_entry = get_line_entry_from_pc(get_offset_pc());
+				print_source(line_entry.file, line_entry.line);
+				return;
+			}
+			step_over_breakpoint();
+		} else if (m_block_step && resume(PTRACE_SINGLEBLOCK) == 0) {
+			wait_for_signal();
+		} else {
+			// branch stepping is not available on every cpu/hypervisor
+			m_block_step = false;
+			single_step_instruction();
+		}
+		first_step = false;
+
+		// anything but a step (a breakpoint in the middle of a block, a
+		// signal, the end of the process) stops the recording run
+		auto info = get_signal_info();
+		if (info.si_signo != SIGTRAP ||
+			(info.si_code != TRAP_TRACE && info.si_code != TRAP_BRANCH))
+			return;
+	}
+}
+
+void
+Debugger::handle_record_command(const std::vector<std::string>& args)
+{
+	if (args.size() < 2) {
+		m_recorder.print_info();
+		return;
+	}
+
+	if (is_prefix(args.at(1), "start")) {
+		m_recorder.start(args.size() > 2 && is_prefix(args.at(2), "regs"));
+		std::cout << "Recording, continue and step record every executed "
+					 "basic block\n";
+	} else if (is_prefix(args.at(1), "stop")) {
+		m_recorder.stop();
+		m_recorder.print_info();
+	} else if (is_prefix(args.at(1), "save")) {
+		if (!m_recorder.save(args.at(2), m_load_address)) {
+			std::cerr << "Cannot write " << args.at(2) << '\n';
+		}
+	} else if (is_prefix(args.at(1), "info")) {
+		m_recorder.print_info();
+	} else if (is_prefix(args.at(1), "show")) {
+		auto count = args.size() > 2 ? std::stoul(args.at(2)) : 20;
+		for (auto pc : m_recorder.last_pcs(count)) {
+			std::cout << "0x" << std::hex << pc;
+			// map the pc back to the source through the line table
+			try {
+				auto line_entry =
+					get_line_entry_from_pc(offset_load_address(pc));
+				std::cout << ' ' << line_entry.file << ':' << std::dec
+						  << line_entry.line;
+			} catch (const std::out_of_range&) {
+				std::cout << " ??";
+			}
+			std::cout << '\n';
+		}
+		std::cout << std::flush;
+	}
+}
+
+void
+Debugger::set_breakpoint_at_address(const std::intptr_t addr)
+{
+	std::cout << "Set breakpoint at address 0x" << std::hex << addr
+			  << std::endl;
+
+	Breakpoint bp{ m_pid, addr };
+	bp.enable();
+	m_breakpoints.insert(bp);
+}
+
+void
+Debugger::dump_registers()
+{
+	for (const auto& register_descriptor : g_register_descriptors) {
+		std::cout << std::setfill(' ') << std::setw(9)
+				  << register_descriptor.name << " 0x" << std::setfill('0')
+				  << std::setw(WORD_SIZE) << std::hex
+				  << get_register_value(m_tid, register_descriptor.reg) << '\n';
+	}
+}
+
+std::intptr_t
+Debugger::read_memory(const std::intptr_t address)
+{
+	return ptrace(PTRACE_PEEKDATA, m_pid, address, nullptr);
+}
+
+void
+Debugger::write_memory(const std::intptr_t address, const uint64_t value)
+{
+	ptrace(PTRACE_POKEDATA, m_pid, address, value);
+}
+
+std::intptr_t
+Debugger::get_pc()
+{
+	return get_register_value(m_tid, Reg::rip);
+}
+
+std::intptr_t
+Debugger::get_offset_pc()
+{
+	return offset_load_address(get_pc());
+}
+
+void
+Debugger::set_pc(const std::intptr_t pc)
+{
+	set_register_value(m_tid, Reg::rip, pc);
+}
+
+void
+Debugger::step_over_breakpoint()
+{
+	auto pc = get_pc();
+	auto bp = m_breakpoints.find(pc);
+	// check if breakpoint is set for the current pc
+	if (bp == nullptr || !bp->is_enabled()) {
+		return;
+	}
+
+	// run a relocated copy of the instruction in the thread's scratch slot,
+	// the INT3 stays in place for the other threads
+	auto pages = m_displaced_stepper.page_count();
+	auto slot  = m_displaced_stepper.prepare(m_tid, pc, bp->get_saved_data());
+	if (m_displaced_stepper.page_count() != pages) {
+		m_memory_map.invalidate();
+	}
+	if (slot) {
+		set_pc(*slot);
+		// a rep instruction stays on its copy until the last iteration
+		do {
+			resume(PTRACE_SINGLESTEP);
+			wait_for_signal();
+		} while (WIFSTOPPED(m_wait_status) &&
+				 WSTOPSIG(m_wait_status) == SIGTRAP &&
+				 get_signal_info().si_code == TRAP_TRACE &&
+				 static_cast<std::uintptr_t>(get_pc()) == *slot);
+		if (WIFSTOPPED(m_wait_status)) {
+			// the pc goes back to the original code. A fault of the copy, or
+			// a signal which came before it ran, is delivered on the next
+			// resume
+			m_displaced_stepper.finish(m_tid);
+			if (WSTOPSIG(m_wait_status) != SIGTRAP)
+				m_pending_signals[m_tid] = WSTOPSIG(m_wait_status);
+		}
+		return;
+	}
+
+	// instructions which cannot be moved are stepped in place
+	bp->disable();
+	// step over the original instruction
+	resume(PTRACE_SINGLESTEP);
+	wait_for_signal();
+	// re-enable the breakpoint, looked up again since the table may have
+	// been rehashed in the meantime
+	if ((bp = m_breakpoints.find(pc)) != nullptr) {
+		bp->enable();
+	}
+}
+
+bool
+Debugger::wait_for_stop()
+{
+	int options{};
+	while (true) {
+		if (!waits_for_any()) {
+			waitpid(m_pid, &m_wait_status, options);
+			if (WIFEXITED(m_wait_status) || WIFSIGNALED(m_wait_status)) {
+				end_vfork_sharing();
+			}
+			if ((WIFEXITED(m_wait_status) || WIFSIGNALED(m_wait_status)) &&
+				!m_inferiors.empty()) {
+				std::cout << "Process " << std::dec << m_pid << " exited\n";
+				switch_to_next_inferior();
+				return false;
+			}
+		} else {
+			// any of the traced threads can report the stop, the one which
+			// does becomes the current thread
+			while (true) {
+				auto tid = waitpid(-1, &m_wait_status, __WALL);
+				if (tid < 0)
+					return false;
+				if (std::find(m_filtered_processes.begin(),
+							  m_filtered_processes.end(),
+							  tid) != m_filtered_processes.end()) {
+					resume_filtered_process(tid, m_wait_status);
+					continue;
+				}
+				if (WIFEXITED(m_wait_status) || WIFSIGNALED(m_wait_status)) {
+					m_threads.erase(
+						std::remove(m_threads.begin(), m_threads.end(), tid),
+						m_threads.end());
+					if (tid == m_pid) {
+						m_threads.clear();
+						end_vfork_sharing();
+						// reported as the exit of a single threaded program
+						if (!m_attached && m_inferiors.empty())
+							break;
+						std::cout << "Process " << std::dec << m_pid
+								  << " exited\n";
+						m_attached = false;
+						switch_to_next_inferior();
+						return false;
+					}
+					continue;
+				}
+				// first stop of a new thread or a forked child, the clone or
+				// fork event of its parent comes next
+				if (std::find(m_threads.begin(), m_threads.end(), tid) ==
+					m_threads.end()) {
+					m_new_processes.emplace_back(tid);
+					continue;
+				}
+				if (m_wait_status >> 16 == PTRACE_EVENT_STOP) {
+					// the interrupt of wait_for_signal_watching(), the
+					// changes are reported by report_watches()
+					if (m_watch_stop && tid == m_tid) {
+						m_watch_stop = false;
+						return false;
+					}
+					// a PTRACE_INTERRUPT which was still pending from
+					// stop_other_threads(), it carries no event so keep
+					// running
+					ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+					continue;
+				}
+				// the same for its SIGSTOP to a thread of a launched program
+				auto stopping = std::find(
+					m_stopping_threads.begin(), m_stopping_threads.end(), tid);
+				if (WSTOPSIG(m_wait_status) == SIGSTOP &&
+					stopping != m_stopping_threads.end()) {
+					m_stopping_threads.erase(stopping);
+					ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+					continue;
+				}
+				// another stop came first, a pending interrupt of
+				// wait_for_signal_watching() is stale now
+				if (m_attached)
+					m_watch_stop = false;
+				m_tid = tid;
+				break;
+			}
+		}
+
+		// each stop during a timed call is taken out of its duration
+		if (m_latency && WIFSTOPPED(m_wait_status)) {
+			m_latency->count_stop(m_tid);
+		}
+		if (!WIFSTOPPED(m_wait_status) || WSTOPSIG(m_wait_status) != SIGTRAP)
+			break;
+		auto event = m_wait_status >> 16;
+		if (event == PTRACE_EVENT_SECCOMP) {
+			// system calls which are only traced are printed and resumed
+			if (handle_syscall_stop())
+				return false;
+		} else if (event == PTRACE_EVENT_CLONE) {
+			ptrace(PTRACE_CONT, handle_clone_event(m_tid), nullptr, nullptr);
+			resume(m_resume_request);
+		} else if (event == PTRACE_EVENT_FORK ||
+				   event == PTRACE_EVENT_VFORK) {
+			if (handle_fork_event(event))
+				return false;
+		} else if (event == PTRACE_EVENT_VFORK_DONE) {
+			// the vfork child exec'd or exited, the memory is ours again
+			for (auto addr : m_vfork_breakpoints) {
+				if (auto bp = m_breakpoints.find(addr))
+					bp->enable();
+			}
+			m_vfork_breakpoints.clear();
+			if (m_coverage) {
+				m_coverage->replant();
+			}
+			resume(m_resume_request);
+		} else if (event == PTRACE_EVENT_EXEC) {
+			if (handle_exec_event())
+				return false;
+		} else if (event == 0 && m_coverage &&
+				   m_coverage->has_breakpoint(get_pc() - 1) &&
+				   (get_signal_info().si_code == SI_KERNEL ||
+					get_signal_info().si_code == TRAP_BRKPT)) {
+			// first run of a statement, its original byte is back. Another
+			// thread may have taken it out while this one ran into it
+			m_coverage->hit(get_pc() - 1);
+			set_pc(get_pc() - 1);
+			resume(m_resume_request);
+		} else if (event == 0 && m_internal_breakpoints.count(get_pc() - 1)) {
+			auto info = get_signal_info();
+			if (info.si_code != SI_KERNEL && info.si_code != TRAP_BRKPT)
+				break;
+			auto request = m_resume_request;
+			run_internal_breakpoint();
+			// a single step ended on the breakpoint, stepping over it was
+			// that step
+			if (request == PTRACE_SINGLESTEP)
+				return false;
+			resume(request);
+		} else {
+			break;
+		}
+	}
+	return true;
+}
+
+void
+Debugger::wait_for_signal()
+{
+	if (!wait_for_stop())
+		return;
+
+	auto signal_info = get_signal_info();
+	switch (signal_info.si_signo) {
+		case SIGTRAP:
+			handle_sigtrap(signal_info);
+			break;
+		case SIGSEGV:
+			std::cerr << "segfault. " << signal_info.si_code << std::endl;
+			break;
+		case SIGSTOP:
+			// sent by wait_for_signal_watching() to a launched program, the
+			// changes are reported by report_watches()
+			if (m_watch_stop) {
+				m_watch_stop = false;
+				break;
+			}
+			[[fallthrough]];
+		default:
+			std::cout << "Got signal " << strsignal(signal_info.si_signo)
+					  << std::endl;
+	}
+}
+
+long
+Debugger::resume(const __ptrace_request request, const int signal)
+{
+	// remembered to resume the same way after a traced system call
+	m_resume_request = request;
+	// a caught mmap family system call runs now
+	if (m_remap_on_resume) {
+		m_memory_map.invalidate();
+		m_remap_on_resume = false;
+	}
+	auto pending	 = m_pending_signals.find(m_tid);
+	if (signal != 0 || pending == m_pending_signals.end())
+		return ptrace(request, m_tid, nullptr, signal);
+	auto held = pending->second;
+	m_pending_signals.erase(pending);
+	return ptrace(request, m_tid, nullptr, held);
+}
+
+bool
+Debugger::handle_fork_event(const int event)
+{
+	unsigned long message{};
+	ptrace(PTRACE_GETEVENTMSG, m_tid, nullptr, &message);
+	auto child = static_cast<pid_t>(message);
+	bool vfork = event == PTRACE_EVENT_VFORK;
+
+	// collect the first stop of the child, unless the wait loop already did
+	auto seen =
+		std::find(m_new_processes.begin(), m_new_processes.end(), child);
+	if (seen != m_new_processes.end()) {
+		m_new_processes.erase(seen);
+	} else {
+		int wait_status{};
+		waitpid(child, &wait_status, __WALL);
+	}
+
+	if (vfork) {
+		// the child borrows our memory until it execs or exits, so take our
+		// INT3s out of it until then (PTRACE_EVENT_VFORK_DONE)
+		for (auto& bp : m_breakpoints) {
+			if (bp.is_enabled()) {
+				bp.disable();
+				m_vfork_breakpoints.emplace_back(bp.get_address());
+			}
+		}
+	}
+
+	// the child is a copy of the parent, breakpoints included. It shares the
+	// parsed debug information instead of loading it again
+	Inferior inferior{ m_next_inferior_id++,
+					   m_prog_name,
+					   m_image,
+					   m_dwarf,
+					   m_elf,
+					   child,
+					   child,
+					   {},
+					   m_attached,
+					   m_load_address,
+					   m_breakpoints,
+					   m_internal_breakpoints,
+					   m_modules,
+					   m_r_debug,
+					   m_memory_map,
+					   nullptr,
+					   m_watchpoints,
+					   Page_Tracker{ child },
+					   m_displaced_stepper,
+					   PTRACE_CONT,
+					   {},
+					   {},
+					   0 };
+	inferior.threads.emplace_back(child);
+	for (auto& bp : inferior.breakpoints) {
+		bp.set_pid(child);
+	}
+	inferior.displaced_stepper.set_pid(child);
+	// mappings with MADV_DONTFORK are not in the child
+	inferior.memory_map.invalidate();
+	// coverage is collected in the parent only (for a vfork, until the
+	// child is done with our memory)
+	if (m_coverage) {
+		m_coverage->restore(child);
+	}
+
+	std::string kind = vfork ? "vfork" : "fork";
+	if (!m_follow_child) {
+		// the parent of a vfork cannot run until the child execs or exits,
+		// so such a child is never kept stopped
+		if (m_detach_on_fork || vfork) {
+			detach_inferior(inferior);
+			std::cout << "Detaching after " << kind << " from child process "
+					  << std::dec << child << '\n';
+		} else {
+			std::cout << "[New inferior " << inferior.id << " (process "
+					  << std::dec << child << ")]\n";
+			m_inferiors.push_back(std::move(inferior));
+		}
+		resume(m_resume_request);
+		return false;
+	}
+
+	std::cout << "Attaching after " << kind << " to child process "
+			  << std::dec << child << '\n';
+	// the other threads of the parent run until we stop them
+	stop_other_threads();
+
+	auto request = m_resume_request;
+	swap_inferior(inferior);
+	if (vfork) {
+		// the parent keeps the list of its breakpoints for its VFORK_DONE,
+		// the child puts them back into the memory they share
+		for (auto addr : inferior.vfork_breakpoints) {
+			if (auto bp = m_breakpoints.find(addr))
+				bp->enable();
+		}
+		m_vfork_parent = inferior.pid;
+	}
+	// the parent of a vfork is let go by end_vfork_sharing(), our INT3s are
+	// in its memory until then
+	if (m_detach_on_fork && !vfork) {
+		detach_inferior(inferior);
+	} else {
+		m_inferiors.push_back(std::move(inferior));
+	}
+	resume(request);
+	return false;
+}
+
+bool
+Debugger::handle_exec_event()
+{
+	end_vfork_sharing();
+	// the other threads are gone, the one calling exec took the pid
+	m_tid = m_pid;
+	m_threads.assign(1, m_pid);
+	m_stopping_threads.clear();
+	m_pending_signals.clear();
+
+	std::vector<std::intptr_t> offsets;
+	for (auto& bp : m_breakpoints) {
+		if (!m_internal_breakpoints.count(bp.get_address()))
+			offsets.emplace_back(bp.get_address() - m_load_address);
+	}
+	// the old address space went away with our INT3s and trampolines, and
+	// the new program comes with a new dynamic loader
+	m_breakpoints = Breakpoint_Table{};
+	m_internal_breakpoints.clear();
+	m_modules.clear();
+	m_r_debug = 0;
+	m_memory_map.invalidate();
+	m_tracepoints.reset();
+	if (m_coverage) {
+		m_coverage->forget_breakpoints();
+	}
+	m_watchpoints.clear();
+	m_displaced_stepper = Displaced_Stepper{ m_pid };
+	// the checkpoints run the old program
+	m_history.clear();
+	m_checkpoints.erase(
+		std::remove_if(m_checkpoints.begin(),
+					   m_checkpoints.end(),
+					   [this](auto&& checkpoint) {
+						   if (checkpoint.inferior_id != m_inferior_id)
+							   return false;
+						   kill(checkpoint.pid, SIGKILL);
+						   waitpid(checkpoint.pid, nullptr, __WALL);
+						   return true;
+					   }),
+		m_checkpoints.end());
+
+	auto program = executable_of(m_pid);
+	auto image	 = load_debug_image(program);
+	bool same_image{ image == m_image };
+	m_prog_name	   = program;
+	m_image		   = image;
+	m_elf		   = image->elf;
+	m_dwarf		   = image->get_dwarf();
+	m_load_address = 0;
+	initialise_load_address();
+	// the blocks of the old program went away with it
+	if (m_heap) {
+		m_heap.reset();
+		m_heap_breakpoints.clear();
+		m_heap_calls.clear();
+		track_heap();
+	}
+	if (m_latency) {
+		// the functions of the program are timed again from zero
+		auto functions = m_latency->functions();
+		m_latency.reset();
+		trace_latency(functions);
+	}
+
+	std::cout << "Process " << std::dec << m_pid
+			  << " is executing new program: " << program << '\n';
+	if (!same_image) {
+		if (!offsets.empty()) {
+			std::cout << "Deleted " << offsets.size()
+					  << " breakpoints of the previous program\n";
+		}
+		return true;
+	}
+
+	// the same binary again (a re-executing server): put the breakpoints
+	// back relative to the new load address and keep on running
+	m_breakpoints.reserve(offsets.size());
+	for (auto offset : offsets) {
+		m_breakpoints.insert(Breakpoint{ m_pid, m_load_address + offset })
+			.enable();
+	}
+	resume(m_resume_request);
+	return false;
+}
+
+void
+Debugger::detach_inferior(Inferior& inferior)
+{
+	if (inferior.tracepoints) {
+		inferior.tracepoints->remove_all();
+	}
+	for (auto& bp : inferior.breakpoints) {
+		if (bp.is_enabled()) {
+			bp.disable();
+		}
+	}
+	auto threads = inferior.threads.empty()
+					   ? std::vector<pid_t>{ inferior.pid }
+					   : inferior.threads;
+	for (auto tid : threads) {
+		// the seccomp filter stays in the process, we keep answering it
+		if (!m_filtered_syscalls.empty()) {
+			m_filtered_processes.emplace_back(tid);
+			ptrace(PTRACE_CONT, tid, nullptr, nullptr);
+		} else {
+			ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+		}
+	}
+}
+
+void
+Debugger::resume_filtered_process(const pid_t tid, const int wait_status)
+{
+	if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+		m_filtered_processes.erase(std::remove(m_filtered_processes.begin(),
+											   m_filtered_processes.end(),
+											   tid),
+								   m_filtered_processes.end());
+		return;
+	}
+
+	auto event = wait_status >> 16;
+	if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK ||
+		event == PTRACE_EVENT_CLONE) {
+		// its children and threads inherit the filter, and have none of our
+		// breakpoints
+		unsigned long message{};
+		ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &message);
+		auto child = static_cast<pid_t>(message);
+		auto seen =
+			std::find(m_new_processes.begin(), m_new_processes.end(), child);
+		if (seen != m_new_processes.end()) {
+			m_new_processes.erase(seen);
+		} else {
+			waitpid(child, nullptr, __WALL);
+		}
+		m_filtered_processes.emplace_back(child);
+		ptrace(PTRACE_CONT, child, nullptr, nullptr);
+	}
+	// a seccomp stop runs the system call, a signal is delivered
+	ptrace(PTRACE_CONT, tid, nullptr, event == 0 ? WSTOPSIG(wait_status) : 0);
+}
+
+void
+Debugger::swap_inferior(Inferior& inferior)
+{
+	std::swap(m_inferior_id, inferior.id);
+	std::swap(m_prog_name, inferior.prog_name);
+	std::swap(m_image, inferior.image);
+	std::swap(m_dwarf, inferior.dwarf);
+	std::swap(m_elf, inferior.elf);
+	std::swap(m_pid, inferior.pid);
+	std::swap(m_tid, inferior.tid);
+	std::swap(m_threads, inferior.threads);
+	std::swap(m_attached, inferior.attached);
+	std::swap(m_load_address, inferior.load_address);
+	std::swap(m_breakpoints, inferior.breakpoints);
+	std::swap(m_internal_breakpoints, inferior.internal_breakpoints);
+	std::swap(m_modules, inferior.modules);
+	std::swap(m_r_debug, inferior.r_debug);
+	std::swap(m_memory_map, inferior.memory_map);
+	std::swap(m_tracepoints, inferior.tracepoints);
+	std::swap(m_watchpoints, inferior.watchpoints);
+	std::swap(m_page_tracker, inferior.page_tracker);
+	std::swap(m_displaced_stepper, inferior.displaced_stepper);
+	std::swap(m_resume_request, inferior.resume_request);
+	std::swap(m_history, inferior.history);
+	std::swap(m_vfork_breakpoints, inferior.vfork_breakpoints);
+	std::swap(m_vfork_parent, inferior.vfork_parent);
+}
+
+void
+Debugger::end_vfork_sharing()
+{
+	if (m_vfork_parent == 0)
+		return;
+	for (auto& bp : m_breakpoints) {
+		if (bp.is_enabled()) {
+			auto saved_data = bp.get_saved_data();
+			write_memory_block(
+				m_vfork_parent, bp.get_address(), &saved_data, 1);
+		}
+	}
+	auto parent = std::find_if(
+		m_inferiors.begin(), m_inferiors.end(), [this](auto&& inferior) {
+			return inferior.pid == m_vfork_parent;
+		});
+	if (m_detach_on_fork && parent != m_inferiors.end()) {
+		detach_inferior(*parent);
+		m_inferiors.erase(parent);
+	}
+	m_vfork_parent = 0;
+}
+
+bool
+Debugger::switch_to_next_inferior()
+{
+	if (m_inferiors.empty())
+		return false;
+
+	swap_inferior(m_inferiors.back());
+	m_inferiors.pop_back();
+	std::cout << "[Switching to inferior " << m_inferior_id << " (process "
+			  << std::dec << m_pid << ")]\n";
+	return true;
+}
+
+void
+Debugger::handle_inferior_command(const std::vector<std::string>& args)
+{
+	if (args.size() < 2) {
+		std::cout << "* " << m_inferior_id << " process " << std::dec << m_pid
+				  << ' ' << m_prog_name << '\n';
+		for (const auto& inferior : m_inferiors) {
+			std::cout << "  " << inferior.id << " process " << inferior.pid
+					  << ' ' << inferior.prog_name << '\n';
+		}
+		return;
+	}
+
+	auto id		  = std::stoul(args.at(1));
+	auto inferior = std::find_if(m_inferiors.begin(),
+								 m_inferiors.end(),
+								 [id](auto&& inferior) {
+									 return inferior.id == id;
+								 });
+	if (inferior == m_inferiors.end()) {
+		if (id != m_inferior_id)
+			std::cerr << "No inferior " << id << '\n';
+		return;
+	}
+	swap_inferior(*inferior);
+	std::cout << "[Switching to inferior " << m_inferior_id << " (process "
+			  << std::dec << m_pid << ")]\n";
+}
+
+void
+Debugger::move(const Movement movement)
+{
+	m_history.push_back(
+		Movement_Record{ movement, get_register_value(m_tid, Reg::rbp) });
+	switch (movement) {
+		case Movement::step:
+			step_in();
+			break;
+		case Movement::next:
+			step_over();
+			break;
+		case Movement::finish:
+			step_out();
+			break;
+		case Movement::cont:
+			continue_execution();
+			break;
+	}
+	report_watches();
+}
+
+void
+Debugger::take_checkpoint()
+{
+	// the trampolines would be shared with the copy but not their state
+	if (m_tracepoints) {
+		std::cerr << "Checkpoints cannot be taken with tracepoints\n";
+		return;
+	}
+	if (m_threads.size() > 1) {
+		std::cout << "Only the current thread is copied into the checkpoint\n";
+	}
+
+	auto child = inject_fork(m_tid);
+	if (child < 0) {
+		std::cerr << "Cannot fork the process: " << strerror(-child) << '\n';
+		return;
+	}
+	Checkpoint checkpoint{ m_next_checkpoint_id++,
+						   m_inferior_id,
+						   child,
+						   get_pc(),
+						   m_breakpoints,
+						   m_history.size() };
+	for (auto& bp : checkpoint.breakpoints) {
+		bp.set_pid(child);
+	}
+	std::cout << "Checkpoint " << checkpoint.id << " at 0x" << std::hex
+			  << checkpoint.pc << std::dec << ", process " << child << '\n';
+	m_checkpoints.push_back(std::move(checkpoint));
+}
+
+bool
+Debugger::restart_checkpoint(const unsigned id)
+{
+	auto checkpoint = std::find_if(m_checkpoints.begin(),
+								   m_checkpoints.end(),
+								   [id](auto&& checkpoint) {
+									   return checkpoint.id == id;
+								   });
+	if (checkpoint == m_checkpoints.end()) {
+		std::cerr << "No checkpoint " << id << '\n';
+		return false;
+	}
+	if (checkpoint->inferior_id != m_inferior_id) {
+		std::cerr << "Checkpoint " << id << " belongs to inferior "
+				  << checkpoint->inferior_id << '\n';
+		return false;
+	}
+	if (m_tracepoints) {
+		std::cerr << "The checkpoint has none of the tracepoints, remove "
+					 "them first\n";
+		return false;
+	}
+
+	// the copies killed by the earlier restarts are zombie children of the
+	// checkpoint, the only children it has
+	while (inject_syscall(checkpoint->pid, SYS_wait4, { -1, 0, WNOHANG, 0 }) >
+		   0) {
+	}
+	// the checkpoint itself stays parked for the next restart
+	auto fresh = inject_fork(checkpoint->pid);
+	if (fresh < 0) {
+		std::cerr << "Cannot fork checkpoint " << id << ": "
+				  << strerror(-fresh) << '\n';
+		return false;
+	}
+
+	kill_process();
+	m_pid = fresh;
+	m_tid = fresh;
+	m_threads.assign(1, fresh);
+	m_stopping_threads.clear();
+	m_pending_signals.clear();
+
+	// the copy has the INT3s of the checkpoint, trade them for the current
+	// breakpoints
+	auto checkpoint_breakpoints = checkpoint->breakpoints;
+	for (auto& bp : checkpoint_breakpoints) {
+		bp.set_pid(fresh);
+		if (bp.is_enabled())
+			bp.disable();
+	}
+	for (auto& bp : m_breakpoints) {
+		bp.set_pid(fresh);
+		if (bp.is_enabled())
+			bp.enable();
+	}
+	m_displaced_stepper = Displaced_Stepper{ fresh };
+	m_page_tracker		= Page_Tracker{ fresh };
+	m_memory_map.invalidate();
+	m_history.resize(checkpoint->history);
+	// libraries opened or closed since the checkpoint
+	if (m_r_debug != 0) {
+		update_libraries();
+	}
+
+	std::cout << "Switching to checkpoint " << id << " (process " << fresh
+			  << ")\n";
+	return true;
+}
+
+void
+Debugger::reverse_step(const bool over_calls)
+{
+	if (m_history.empty()) {
+		std::cerr << "No command to reverse\n";
+		return;
+	}
+
+	auto target = m_history.size() - 1;
+	if (over_calls) {
+		// stops in functions called from here have a lower frame
+		auto frame = get_register_value(m_tid, Reg::rbp);
+		while (target > 0 && m_history[target].frame < frame) {
+			--target;
+		}
+	}
+
+	const Checkpoint* start{ nullptr };
+	for (const auto& checkpoint : m_checkpoints) {
+		if (checkpoint.inferior_id == m_inferior_id &&
+			checkpoint.history <= target &&
+			(!start || checkpoint.history >= start->history))
+			start = &checkpoint;
+	}
+	if (!start) {
+		std::cerr << "No checkpoint before the previous stop\n";
+		return;
+	}
+
+	std::vector<Movement> replay;
+	for (auto i = start->history; i < target; ++i) {
+		replay.push_back(m_history[i].movement);
+	}
+	// replayed silently, the program writes its own output again
+	auto output = std::cout.rdbuf(nullptr);
+	bool restarted{ restart_checkpoint(start->id) };
+	if (restarted) {
+		for (auto movement : replay) {
+			move(movement);
+		}
+	}
+	std::cout.rdbuf(output);
+	if (restarted) {
+		print_location();
+	}
+}
+
+void
+Debugger::print_checkpoints()
+{
+	for (const auto& checkpoint : m_checkpoints) {
+		std::cout << (checkpoint.inferior_id == m_inferior_id ? "  " : "* ")
+				  << checkpoint.id << " process " << std::dec
+				  << checkpoint.pid << " at 0x" << std::hex << checkpoint.pc
+				  << std::dec;
+		try {
+			auto entry = get_line_entry_from_pc(
+				offset_load_address(checkpoint.pc));
+			std::cout << ", " << entry.file << ':' << entry.line;
+		} catch (std::out_of_range&) {
+		}
+		std::cout << '\n';
+	}
+}
+
+void
+Debugger::kill_checkpoints()
+{
+	for (const auto& checkpoint : m_checkpoints) {
+		kill(checkpoint.pid, SIGKILL);
+		waitpid(checkpoint.pid, nullptr, __WALL);
+	}
+	m_checkpoints.clear();
+}
+
+void
+Debugger::kill_process()
+{
+	// a process we reaped is not ours anymore, its pid may have been given
+	// to an unrelated process since
+	int	 status{};
+	auto reaped = waitpid(m_pid, &status, WNOHANG | __WALL);
+	if ((reaped < 0 && errno == ECHILD) ||
+		(reaped == m_pid && (WIFEXITED(status) || WIFSIGNALED(status))))
+		return;
+
+	// the leader is reaped after the other threads
+	auto threads = list_threads(m_pid);
+	kill(m_pid, SIGKILL);
+	for (auto tid : threads) {
+		if (tid != m_pid)
+			waitpid(tid, nullptr, __WALL);
+	}
+	waitpid(m_pid, nullptr, __WALL);
+}
+
+void
+Debugger::set_launch_options(Launch_Options options)
+{
+	m_launch = std::move(options);
+}
+
+bool
+Debugger::rerun(const std::vector<std::string>& args)
+{
+	if (m_attached || !m_launch) {
+		std::cerr << "The process was not launched by us, it cannot be "
+					 "run again\n";
+		return false;
+	}
+	// new arguments replace the previous ones, redirections included
+	if (!args.empty()) {
+		m_launch->args.clear();
+		m_launch->input.clear();
+		m_launch->output.clear();
+		for (std::size_t i = 0; i < args.size(); ++i) {
+			const auto& arg = args[i];
+			if (arg.empty())
+				continue;
+			if (arg[0] == '<' || arg[0] == '>') {
+				auto file = arg.size() > 1 ? arg.substr(1)
+						  : i + 1 < args.size() ? args[++i]
+												: std::string{};
+				if (file.empty()) {
+					std::cerr << "Missing file after " << arg[0] << '\n';
+					return false;
+				}
+				(arg[0] == '<' ? m_launch->input : m_launch->output) = file;
+			} else {
+				m_launch->args.push_back(arg);
+			}
+		}
+	}
+
+	auto image = load_debug_image(m_launch->program);
+	if (!image->has_dwarf()) {
+		std::cerr << "No debug information in " << m_launch->program << '\n';
+		return false;
+	}
+
+	// breakpoints of the executable, relative to its load address. Those of
+	// shared libraries would be written before the libraries are mapped
+	std::vector<std::intptr_t> offsets;
+	std::size_t				   dropped{ 0 };
+	for (auto& bp : m_breakpoints) {
+		if (m_internal_breakpoints.count(bp.get_address()))
+			continue;
+		auto offset = bp.get_address() - m_load_address;
+		bool in_executable{ false };
+		for (const auto& segment : m_elf.segments()) {
+			const auto& hdr = segment.get_hdr();
+			if (hdr.type == elf::pt::load &&
+				static_cast<std::uintptr_t>(offset) - hdr.vaddr < hdr.memsz)
+				in_executable = true;
+		}
+		if (in_executable && image == m_image)
+			offsets.push_back(offset);
+		else
+			++dropped;
+	}
+	if (m_tracepoints || !m_watchpoints.empty()) {
+		std::cout << "Tracepoints and watchpoints are not kept\n";
+	}
+
+	// one program is debugged again, the other processes go away
+	for (auto& inferior : m_inferiors) {
+		swap_inferior(inferior);
+		kill_process();
+		swap_inferior(inferior);
+	}
+	m_inferiors.clear();
+	kill_checkpoints();
+	kill_process();
+	// the children which kept our syscall filter go with it
+	for (auto tid : m_filtered_processes) {
+		kill(tid, SIGKILL);
+		waitpid(tid, nullptr, __WALL);
+	}
+	m_filtered_processes.clear();
+	m_vfork_breakpoints.clear();
+	m_vfork_parent = 0;
+
+	auto pid = launch_program(*m_launch);
+	if (pid < 0) {
+		std::cerr << "Cannot fork: " << strerror(errno) << '\n';
+		m_threads.clear();
+		return false;
+	}
+	m_pid = pid;
+	m_tid = pid;
+	m_threads.clear();
+	m_breakpoints = Breakpoint_Table{};
+	m_internal_breakpoints.clear();
+	m_modules.clear();
+	m_r_debug = 0;
+	m_memory_map.invalidate();
+	m_tracepoints.reset();
+	m_watchpoints.clear();
+	m_page_tracker		= Page_Tracker{ pid };
+	m_displaced_stepper = Displaced_Stepper{ pid };
+	m_resume_request	= PTRACE_CONT;
+	m_history.clear();
+	// the ELF/DWARF and their indexes are reused unless the binary was
+	// rebuilt
+	m_prog_name	   = m_launch->program;
+	m_image		   = image;
+	m_elf		   = image->elf;
+	m_dwarf		   = image->get_dwarf();
+	m_load_address = 0;
+	wait_for_launch();
+
+	m_breakpoints.reserve(offsets.size());
+	for (auto offset : offsets) {
+		m_breakpoints.insert(Breakpoint{ m_pid, m_load_address + offset });
+	}
+	auto inserted = m_breakpoints.enable_all(m_pid);
+	if (m_heap) {
+		m_heap.reset();
+		m_heap_breakpoints.clear();
+		m_heap_calls.clear();
+		track_heap();
+	}
+	if (m_latency) {
+		// the functions of the program are timed again from zero
+		auto functions = m_latency->functions();
+		m_latency.reset();
+		trace_latency(functions);
+	}
+	std::cout << "Starting program: " << m_prog_name << " (process "
+			  << std::dec << m_pid << "), " << inserted
+			  << " breakpoints inserted\n";
+	if (dropped != 0) {
+		std::cout << "Deleted " << dropped
+				  << " breakpoints outside of the executable or of a "
+					 "previous build\n";
+	}
+	return true;
+}
+
+void
+Debugger::print_location()
+{
+	try {
+		auto entry = get_line_entry_from_pc(get_offset_pc());
+		print_source(entry.file, entry.line);
+	} catch (std::out_of_range&) {
+		std::cout << "0x" << std::hex << get_pc() << std::dec << '\n';
+	}
+}
+
+void
+Debugger::track_heap()
+{
+	if (m_heap) {
+		std::cerr << "Heap tracking is already on\n";
+		return;
+	}
+	m_heap = std::make_unique<Heap_Tracker>();
+	if (plant_heap_breakpoints())
+		return;
+
+	// the loader maps the C library before jumping to the entry point,
+	// plant the breakpoints there (the loader's own allocations are missed)
+	auto entry = static_cast<std::intptr_t>(m_elf.get_hdr().entry);
+	if (m_elf.get_hdr().type == elf::et::dyn)
+		entry += m_load_address;
+	set_internal_breakpoint(entry, [this] {
+		if (m_heap && m_heap_breakpoints.empty()) {
+			update_libraries();
+			plant_heap_breakpoints();
+		}
+	});
+	std::cout << "Heap tracking starts at the entry point\n";
+}
+
+bool
+Debugger::plant_heap_breakpoints()
+{
+	const std::pair<const char*, std::function<void()>> functions[]{
+		{ "malloc", [this] { heap_function_entered(Heap_Function::malloc); } },
+		{ "calloc", [this] { heap_function_entered(Heap_Function::calloc); } },
+		{ "realloc",
+		  [this] { heap_function_entered(Heap_Function::realloc); } },
+		{ "free", [this] { heap_block_freed(); } },
+	};
+	for (const auto& [name, handler] : functions) {
+		auto syms = lookup_library_symbol(name);
+		if (syms.empty()) {
+			// statically linked
+			for (auto sym : lookup_symbol(name)) {
+				// undefined, imported from a library
+				if (sym.addr == 0)
+					continue;
+				sym.addr += m_load_address;
+				syms.push_back(sym);
+			}
+		}
+		for (const auto& sym : syms) {
+			if (sym.type != symbol_type::func)
+				continue;
+			set_internal_breakpoint(sym.addr, handler);
+			m_heap_breakpoints.push_back(sym.addr);
+		}
+	}
+	if (m_heap_breakpoints.empty())
+		return false;
+	std::cout << "Tracking the heap with " << m_heap_breakpoints.size()
+			  << " breakpoints\n";
+	return true;
+}
+
+std::vector<std::uintptr_t>
+Debugger::heap_stack()
+{
+	// kept short: a deep stack costs two reads of the debugee per frame at
+	// every allocation
+	static constexpr std::size_t MAX_FRAMES{ 16 };
+
+	// at the entry the return address is on top of the stack and rbp is
+	// still the frame pointer of the caller
+	std::vector<std::uintptr_t> frames;
+	std::intptr_t				frame[2]{ get_register_value(m_tid, Reg::rbp),
+										  0 };
+	if (!read_memory_block(m_pid,
+						   get_register_value(m_tid, Reg::rsp),
+						   &frame[1],
+						   sizeof(frame[1])))
+		return frames;
+	frames.push_back(frame[1]);
+	// a frame is the saved frame pointer and the return address above it
+	auto frame_pointer = frame[0];
+	while (frames.size() < MAX_FRAMES &&
+		   read_memory_block(m_pid, frame_pointer, frame, sizeof(frame)) &&
+		   valid_frame(frame_pointer, frame[1])) {
+		frames.push_back(frame[1]);
+		frame_pointer = frame[0];
+	}
+	return frames;
+}
+
+void
+Debugger::heap_function_entered(const Heap_Function function)
+{
+	// allocations made by an allocation function itself (realloc calling
+	// malloc) are part of the outer call
+	if (m_heap_calls.count(m_tid))
+		return;
+
+	auto frames = heap_stack();
+	if (frames.empty())
+		return;
+	uint64_t first	= get_register_value(m_tid, Reg::rdi);
+	uint64_t second = get_register_value(m_tid, Reg::rsi);
+	m_heap_calls[m_tid] = Heap_Call{ function,
+									 { first, second },
+									 get_register_value(m_tid, Reg::rsp),
+									 m_heap->intern_stack(frames) };
+	// the result is read at the return address, the breakpoint stays for
+	// the next calls from there
+	auto return_address = static_cast<std::intptr_t>(frames.front());
+	if (!m_internal_breakpoints.count(return_address)) {
+		set_internal_breakpoint(return_address,
+								[this] { traced_function_returned(); });
+	}
+}
+
+void
+Debugger::heap_function_returned()
+{
+	auto call = m_heap_calls.find(m_tid);
+	// the return popped the return address pushed by the call
+	if (call == m_heap_calls.end() ||
+		get_register_value(m_tid, Reg::rsp) != call->second.stack_pointer + 8)
+		return;
+
+	auto [function, args, stack_pointer, stack] = call->second;
+	m_heap_calls.erase(call);
+	auto result = get_register_value(m_tid, Reg::rax);
+	switch (function) {
+		case Heap_Function::malloc:
+			if (result)
+				m_heap->allocated(result, args[0], stack);
+			break;
+		case Heap_Function::calloc:
+			if (result)
+				m_heap->allocated(result, args[0] * args[1], stack);
+			break;
+		case Heap_Function::realloc:
+			// realloc(ptr, 0) may free the block and return NULL
+			if (args[0] && (result || args[1] == 0))
+				m_heap->freed(args[0]);
+			if (result)
+				m_heap->allocated(result, args[1], stack);
+			break;
+	}
+}
+
+void
+Debugger::trace_latency(const std::vector<std::string>& functions)
+{
+	if (!m_latency) {
+		std::cout << "Measuring the cost of a stop...\n";
+		auto stop_cost = Latency_Tracer::measure_stop_cost();
+		m_latency	   = std::make_unique<Latency_Tracer>(stop_cost);
+	}
+
+	auto traced = m_latency->functions();
+	for (const auto& name : functions) {
+		if (std::find(traced.begin(), traced.end(), name) != traced.end()) {
+			std::cerr << name << " is already timed\n";
+			continue;
+		}
+		// the entry itself: the return address is still on top of the stack
+		std::vector<std::intptr_t> entries;
+		for (auto compilation_unit : m_image->units_named(name)) {
+			for (const auto& die : compilation_unit->root()) {
+				if (die.tag == dwarf::DW_TAG::subprogram &&
+					die.has(dwarf::DW_AT::name) &&
+					die.has(dwarf::DW_AT::low_pc) &&
+					dwarf::at_name(die) == name)
+					entries.push_back(
+						offset_dwarf_address(dwarf::at_low_pc(die)));
+			}
+		}
+		if (entries.empty()) {
+			for (const auto& sym : lookup_library_symbol(name)) {
+				if (sym.type == symbol_type::func)
+					entries.push_back(sym.addr);
+			}
+		}
+		if (entries.empty()) {
+			std::cerr << "No function " << name << '\n';
+			continue;
+		}
+
+		auto function = m_latency->add_function(name);
+		for (auto entry : entries) {
+			set_internal_breakpoint(entry, [this, function] {
+				latency_function_entered(function);
+			});
+		}
+		std::cout << "Timing " << name << " (" << entries.size()
+				  << " entries)\n";
+	}
+}
+
+void
+Debugger::latency_function_entered(const std::size_t function)
+{
+	auto stack_pointer = get_register_value(m_tid, Reg::rsp);
+	auto return_address = read_memory(stack_pointer);
+	m_latency->entered(m_tid, function, stack_pointer);
+	if (!m_internal_breakpoints.count(return_address)) {
+		set_internal_breakpoint(return_address,
+								[this] { traced_function_returned(); });
+	}
+}
+
+void
+Debugger::traced_function_returned()
+{
+	if (m_heap) {
+		heap_function_returned();
+	}
+	if (m_latency) {
+		m_latency->returned(m_tid, get_register_value(m_tid, Reg::rsp));
+	}
+}
+
+void
+Debugger::heap_block_freed()
+{
+	if (m_heap_calls.count(m_tid))
+		return;
+	if (auto address = get_register_value(m_tid, Reg::rdi))
+		m_heap->freed(address);
+}
+
+void
+Debugger::print_heap_report(const std::size_t count)
+{
+	if (!m_heap) {
+		std::cerr << "The heap is not tracked, start with heap track\n";
+		return;
+	}
+
+	auto sites = m_heap->sites();
+	std::cout << std::dec << m_heap->live_count() << " blocks ("
+			  << m_heap->live_bytes()
+			  << " bytes) not freed, leaked if the program exited\n";
+	// sites by decreasing `key`, only those with blocks left for live_bytes
+	auto print_sites = [&](const char* title, std::size_t Heap_Site::*key) {
+		std::sort(sites.begin(), sites.end(), [key](auto&& a, auto&& b) {
+			return a.*key > b.*key;
+		});
+		std::cout << '\n' << title << ":\n";
+		for (std::size_t i = 0; i < std::min(count, sites.size()); ++i) {
+			const auto& site = sites[i];
+			if (key == &Heap_Site::live_bytes && site.live_count == 0)
+				break;
+			std::cout << std::dec << "  " << site.live_bytes << " bytes in "
+					  << site.live_count << " blocks not freed, "
+					  << site.total_bytes << " bytes in " << site.total_count
+					  << " calls\n";
+			auto frames = m_heap->frames(site.stack);
+			for (std::size_t frame = 0; frame < frames.size(); ++frame) {
+				std::cout << "    #" << std::dec << frame << ' '
+						  << describe_code_address(frames[frame]) << '\n';
+			}
+		}
+	};
+	print_sites("Not freed, by bytes", &Heap_Site::live_bytes);
+	print_sites("Allocation sites by bytes", &Heap_Site::total_bytes);
+	print_sites("Allocation sites by calls", &Heap_Site::total_count);
+}
+
+void
+Debugger::set_internal_breakpoint(const std::intptr_t  addr,
+								  std::function<void()> handler)
+{
+	if (!m_breakpoints.count(addr)) {
+		m_breakpoints.insert(Breakpoint{ m_pid, addr }).enable();
+	}
+	auto& current = m_internal_breakpoints[addr];
+	if (current) {
+		current = [first = std::move(current), second = std::move(handler)] {
+			first();
+			second();
+		};
+	} else {
+		current = std::move(handler);
+	}
+}
+
+void
+Debugger::run_internal_breakpoint()
+{
+	auto pc = get_pc() - 1;
+	set_pc(pc);
+	// copied, the handler may replace itself
+	auto handler = m_internal_breakpoints.at(pc);
+	handler();
+	step_over_breakpoint();
+}
+
+std::uintptr_t
+Debugger::find_r_debug()
+{
+	for (const auto& segment : m_elf.segments()) {
+		const auto& hdr = segment.get_hdr();
+		if (hdr.type != elf::pt::dynamic)
+			continue;
+
+		// DT_DEBUG is filled in by the loader, read the dynamic section from
+		// memory rather than from the file
+		auto address = hdr.vaddr;
+		if (m_elf.get_hdr().type == elf::et::dyn)
+			address += m_load_address;
+		std::vector<Elf64_Dyn> dynamic(hdr.filesz / sizeof(Elf64_Dyn));
+		if (!read_memory_block(m_pid,
+							   address,
+							   dynamic.data(),
+							   dynamic.size() * sizeof(Elf64_Dyn)))
+			return 0;
+		for (const auto& entry : dynamic) {
+			if (entry.d_tag == DT_NULL)
+				break;
+			if (entry.d_tag == DT_DEBUG)
+				return entry.d_un.d_ptr;
+		}
+	}
+	// statically linked
+	return 0;
+}
+
+void
+Debugger::update_libraries()
+{
+	r_debug rendezvous;
+	if (m_r_debug == 0) {
+		m_r_debug = find_r_debug();
+		if (m_r_debug == 0 ||
+			!read_memory_block(
+				m_pid, m_r_debug, &rendezvous, sizeof(rendezvous))) {
+			m_r_debug = 0;
+			return;
+		}
+		// the loader calls r_brk (_dl_debug_state) before and after each
+		// change of the list
+		if (rendezvous.r_brk != 0) {
+			set_internal_breakpoint(rendezvous.r_brk,
+									[this] { update_libraries(); });
+		}
+	} else if (!read_memory_block(
+				   m_pid, m_r_debug, &rendezvous, sizeof(rendezvous))) {
+		return;
+	}
+
+	// RT_ADD/RT_DELETE: the list is being changed, wait for the second call
+	if (rendezvous.r_state != r_debug::RT_CONSISTENT)
+		return;
+	m_memory_map.invalidate();
+	auto removed = m_modules.update(
+		m_pid, reinterpret_cast<std::uintptr_t>(rendezvous.r_map));
+
+	// the INT3s in an unloaded library went away with its code
+	for (const auto& module : removed) {
+		std::vector<std::intptr_t> stale;
+		for (auto& bp : m_breakpoints) {
+			auto addr = static_cast<std::uintptr_t>(bp.get_address());
+			if (addr >= module.start && addr < module.end)
+				stale.emplace_back(bp.get_address());
+		}
+		for (auto addr : stale) {
+			m_breakpoints.erase(addr);
+			m_internal_breakpoints.erase(addr);
+		}
+	}
+}
+
+void
+Debugger::print_libraries()
+{
+	if (m_r_debug == 0) {
+		update_libraries();
+	}
+
+	std::cout << std::left << std::setw(20) << "From" << std::setw(20) << "To"
+			  << std::setw(11) << "Syms Read" << "Shared Object Library\n"
+			  << std::right;
+	for (auto& module : m_modules.modules()) {
+		std::cout << "0x" << std::hex << std::setfill('0') << std::setw(16)
+				  << module.start << "  0x" << std::setw(16) << module.end
+				  << std::setfill(' ') << std::dec << "  "
+				  << (module.image ? "Yes" : "No ") << "        "
+				  << module.path << '\n';
+	}
+}
+
+void
+Debugger::print_debug_info_usage()
+{
+	auto usage = debug_info_usage();
+	std::cout << std::dec << "Budget:    ";
+	if (usage.budget == 0)
+		std::cout << "unlimited\n";
+	else
+		std::cout << usage.budget << " bytes\n";
+	std::cout << "Resident:  " << usage.resident << " bytes\n"
+			  << "Evicted:   " << usage.evicted << " bytes in "
+			  << usage.evictions << " line tables\n"
+			  << "Inflated:  " << usage.inflated
+			  << " bytes of compressed sections, outside the budget\n";
+}
+
+void
+Debugger::print_mappings()
+{
+	if (!m_memory_map.refresh(m_pid)) {
+		std::cerr << "Cannot read the mappings of process " << std::dec
+				  << m_pid << '\n';
+		return;
+	}
+
+	std::cout << std::left << std::setw(20) << "Start Addr" << std::setw(20)
+			  << "End Addr" << std::setw(12) << "Size" << std::setw(12)
+			  << "Offset" << std::setw(6) << "Perms" << std::setw(10)
+			  << "Kind" << "objfile\n";
+	for (const auto& region : m_memory_map.regions()) {
+		std::string perms{ region.readable ? 'r' : '-',
+						   region.writable ? 'w' : '-',
+						   region.executable ? 'x' : '-',
+						   region.shared ? 's' : 'p' };
+		std::cout << std::hex << "0x" << std::setw(18) << region.start << "0x"
+				  << std::setw(18) << region.end << "0x" << std::setw(10)
+				  << region.end - region.start << "0x" << std::setw(10)
+				  << region.offset << std::setw(6) << perms << std::setw(10)
+				  << to_string(region.kind()) << region.path << '\n';
+	}
+	std::cout << std::right << std::dec;
+}
+
+std::vector<symbol>
+Debugger::lookup_library_symbol(const std::string_view symbol_name)
+{
+	if (m_r_debug == 0) {
+		update_libraries();
+	}
+
+	std::vector<symbol> syms;
+	for (auto& module : m_modules.modules()) {
+		auto image = m_modules.image_of(module);
+		if (!image)
+			continue;
+		for (const auto& sym : image->symbols_named(symbol_name)) {
+			syms.emplace_back(symbol{ to_symbol_type(sym.type),
+									  std::string{ sym.name },
+									  module.base + sym.value });
+		}
+	}
+	return syms;
+}
+
+std::optional<symbol>
+Debugger::lookup_library_function(const std::intptr_t pc)
+{
+	if (m_r_debug == 0) {
+		update_libraries();
+	}
+	auto module = m_modules.find(pc);
+	if (module == nullptr)
+		return std::nullopt;
+	auto image = m_modules.image_of(*module);
+	if (!image)
+		return std::nullopt;
+
+	auto file_pc = pc - module->base;
+	for (auto& section : image->elf.sections()) {
+		if (section.get_hdr().type != elf::sht::symtab &&
+			section.get_hdr().type != elf::sht::dynsym)
+			continue;
+
+		for (auto sym : section.as_symtab()) {
+			auto& data = sym.get_data();
+			if (data.type() == elf::stt::func && data.value != 0 &&
+				file_pc >= data.value && file_pc < data.value + data.size) {
+				return symbol{ symbol_type::func,
+							   sym.get_name(),
+							   module->base + data.value };
+			}
+		}
 	}
+	return std::nullopt;
 }
 
 void
-Debugger::continue_execution()
+Debugger::handle_set_command(const std::vector<std::string>& args)
 {
-	step_over_breakpoint();
-	ptrace(PTRACE_CONT, m_pid, nullptr, nullptr);
-	wait_for_signal();
+	if (args.size() == 3 && args.at(1) == "follow-fork-mode" &&
+		(args.at(2) == "parent" || args.at(2) == "child")) {
+		m_follow_child = args.at(2) == "child";
+	} else if (args.size() == 3 && args.at(1) == "detach-on-fork" &&
+			   (args.at(2) == "on" || args.at(2) == "off")) {
+		m_detach_on_fork = args.at(2) == "on";
+	} else if (args.size() == 3 && args.at(1) == "environment" && m_launch) {
+		// NAME=value, or NAME alone for an empty value
+		auto equal = args.at(2).find('=');
+		m_launch->environment[args.at(2).substr(0, equal)] =
+			equal == std::string::npos ? std::string{}
+									   : args.at(2).substr(equal + 1);
+	} else {
+		std::cerr << "Usage: set follow-fork-mode parent|child\n"
+				  << "       set detach-on-fork on|off\n"
+				  << "       set environment NAME=value\n";
+	}
 }
 
-void
-Debugger::set_breakpoint_at_address(const std::intptr_t addr)
+bool
+Debugger::handle_syscall_stop()
 {
-	std::cout << "Set breakpoint at address 0x" << std::hex << addr
-			  << std::endl;
+	// the thread is stopped before executing the system call, its arguments
+	// are still in the registers
+	user_regs_struct regs;
+	ptrace(PTRACE_GETREGS, m_tid, nullptr, &regs);
+	auto call = format_syscall(m_pid, regs);
+	// the layout changes once the system call ran, not before
+	bool remaps{ false };
+	switch (regs.orig_rax) {
+		case SYS_mmap:
+		case SYS_munmap:
+		case SYS_mremap:
+		case SYS_mprotect:
+		case SYS_brk:
+			remaps = true;
+			break;
+	}
 
-	Breakpoint bp{ m_pid, addr };
-	bp.enable();
-	m_breakpoints[addr] = bp;
+	if (std::find(m_caught_syscalls.begin(),
+				  m_caught_syscalls.end(),
+				  static_cast<long>(regs.orig_rax)) !=
+		m_caught_syscalls.end()) {
+		std::cout << "Caught syscall " << call << std::endl;
+		m_remap_on_resume = remaps;
+		return true;
+	}
+
+	// run it up to the syscall-exit stop (SIGTRAP | 0x80 with
+	// TRACESYSGOOD) to print the result. The signals which come first are
+	// delivered on the way
+	int wait_status{};
+	int signal{ 0 };
+	while (true) {
+		ptrace(PTRACE_SYSCALL, m_tid, nullptr, signal);
+		waitpid(m_tid, &wait_status, __WALL);
+		signal = 0;
+		if (!WIFSTOPPED(wait_status) ||
+			WSTOPSIG(wait_status) == (SIGTRAP | 0x80))
+			break;
+		if (wait_status >> 16 == PTRACE_EVENT_CLONE) {
+			ptrace(PTRACE_CONT, handle_clone_event(m_tid), nullptr, nullptr);
+			continue;
+		}
+		// a group-stop has no siginfo, and its signal is not delivered again
+		siginfo_t info;
+		if (wait_status >> 16 == 0 &&
+			ptrace(PTRACE_GETSIGINFO, m_tid, nullptr, &info) == 0)
+			signal = WSTOPSIG(wait_status);
+	}
+	if (!WIFSTOPPED(wait_status)) {
+		// exit, exit_group or killed while in the system call
+		std::cout << call << " = ?\n"
+				  << "Process " << std::dec << m_pid << " exited\n";
+		return true;
+	}
+	if (remaps) {
+		m_memory_map.invalidate();
+	}
+	ptrace(PTRACE_GETREGS, m_tid, nullptr, &regs);
+	auto result = static_cast<long>(regs.rax);
+	std::cout << call << " = " << std::dec;
+	if (result < 0 && result >= -4095) {
+		std::cout << "-1 (" << strerror(-result) << ")\n";
+	} else if (result > 0xffff) {
+		std::cout << "0x" << std::hex << result << std::dec << '\n';
+	} else {
+		std::cout << result << '\n';
+	}
+
+	resume(m_resume_request);
+	return false;
 }
 
 void
-Debugger::dump_registers()
+Debugger::trace_syscalls(const std::vector<long>& numbers, const bool stop)
 {
-	for (const auto& register_descriptor : g_register_descriptors) {
-		std::cout << std::setfill(' ') << std::setw(9)
-				  << register_descriptor.name << " 0x" << std::setfill('0')
-				  << std::setw(WORD_SIZE) << std::hex
-				  << get_register_value(m_pid, register_descriptor.reg) << '\n';
+	for (auto number : numbers) {
+		if (std::find(m_filtered_syscalls.begin(),
+					  m_filtered_syscalls.end(),
+					  number) == m_filtered_syscalls.end())
+			m_filtered_syscalls.push_back(number);
+		if (stop && std::find(m_caught_syscalls.begin(),
+							  m_caught_syscalls.end(),
+							  number) == m_caught_syscalls.end())
+			m_caught_syscalls.push_back(number);
 	}
 }
 
-std::intptr_t
-Debugger::read_memory(const std::intptr_t address)
+void
+Debugger::handle_catch_syscall_command(const std::vector<std::string>& args)
 {
-	return ptrace(PTRACE_PEEKDATA, m_pid, address, nullptr);
+	if (args.size() < 3) {
+		for (auto number : m_filtered_syscalls) {
+			auto caught = std::find(m_caught_syscalls.begin(),
+									m_caught_syscalls.end(),
+									number) != m_caught_syscalls.end();
+			std::cout << get_syscall_name(number)
+					  << (caught ? " (stop)\n" : " (trace)\n");
+		}
+		return;
+	}
+
+	for (auto it = args.begin() + 2; it != args.end(); ++it) {
+		auto number = get_syscall_number(*it);
+		if (!number) {
+			std::cerr << "Unknown syscall " << *it << '\n';
+			continue;
+		}
+		// the filter cannot be changed once the program runs, a system call
+		// it lets through never reaches the debugger
+		if (std::find(m_filtered_syscalls.begin(),
+					  m_filtered_syscalls.end(),
+					  *number) == m_filtered_syscalls.end()) {
+			std::cerr << *it << " is not filtered, start the program with "
+					  << "--catch-syscall " << *it << '\n';
+			continue;
+		}
+		trace_syscalls({ *number }, true);
+		std::cout << "Catching syscall " << *it << '\n';
+	}
 }
 
 void
-Debugger::write_memory(const std::intptr_t address, const uint64_t value)
+Debugger::set_watchpoint(const std::uintptr_t address, const std::size_t length)
 {
-	ptrace(PTRACE_POKEDATA, m_pid, address, value);
+	Watchpoint watchpoint{
+		m_next_watch_id, address, length, std::vector<uint8_t>(length)
+	};
+	if (length == 0 ||
+		!read_memory_block(
+			m_pid, address, watchpoint.contents.data(), length)) {
+		std::cerr << "Cannot read memory at 0x" << std::hex << address
+				  << std::dec << '\n';
+		return;
+	}
+	if (!m_page_tracker.is_supported() && m_watchpoints.empty()) {
+		std::cerr << "No soft-dirty page tracking on this kernel, whole "
+					 "regions are compared\n";
+	}
+
+	m_watchpoints.push_back(std::move(watchpoint));
+	std::cout << "Watchpoint " << m_next_watch_id++ << ": 0x" << std::hex
+			  << address << std::dec << ", " << length << " bytes\n";
 }
 
-std::intptr_t
-Debugger::get_pc()
+void
+Debugger::add_display(const std::string_view expression)
 {
-	return get_register_value(m_pid, Reg::rip);
+	m_displays.push_back(
+		Display{ m_next_watch_id++, std::string{ expression }, 0, 0, false });
+	print_display(m_displays.back());
 }
 
-std::intptr_t
-Debugger::get_offset_pc()
+void
+Debugger::report_watches()
 {
-	return offset_load_address(get_pc());
+	if (m_watchpoints.empty() && m_displays.empty())
+		return;
+
+	for (auto& watchpoint : m_watchpoints)
+		check_watchpoint(watchpoint, true);
+	for (auto& display : m_displays)
+		print_display(display);
+
+	// the process is stopped, nothing can be written between the reads above
+	// and the clear
+	m_page_tracker.clear();
 }
 
-void
-Debugger::set_pc(const std::intptr_t pc)
+bool
+Debugger::check_watchpoint(Watchpoint& watchpoint, const bool report)
 {
-	set_register_value(m_pid, Reg::rip, pc);
+	// changed words printed for each watchpoint
+	static constexpr std::size_t MAX_REPORTED_WORDS{ 8 };
+
+	std::size_t			 changed_words{ 0 };
+	std::vector<uint8_t> page(TRACKED_PAGE_SIZE);
+	auto				 region_end = watchpoint.address + watchpoint.length;
+	for (auto page_start :
+		 m_page_tracker.dirty_pages(watchpoint.address, watchpoint.length)) {
+		// part of the page inside the watched region
+		auto start = std::max(page_start, watchpoint.address);
+		auto size =
+			std::min(page_start + TRACKED_PAGE_SIZE, region_end) - start;
+		auto saved = watchpoint.contents.data() + (start - watchpoint.address);
+		if (!read_memory_block(m_pid, start, page.data(), size) ||
+			std::memcmp(saved, page.data(), size) == 0)
+			continue;
+		if (!report)
+			return true;
+
+		if (changed_words == 0) {
+			std::cout << "Watchpoint " << watchpoint.id << " (0x" << std::hex
+					  << watchpoint.address << std::dec << ", "
+					  << watchpoint.length << " bytes) changed\n";
+		}
+		for (std::size_t i = 0; i < size; i += sizeof(uint64_t)) {
+			auto n = std::min(sizeof(uint64_t), size - i);
+			if (std::memcmp(saved + i, page.data() + i, n) == 0)
+				continue;
+			if (changed_words++ < MAX_REPORTED_WORDS) {
+				uint64_t old_value{};
+				uint64_t new_value{};
+				std::memcpy(&old_value, saved + i, n);
+				std::memcpy(&new_value, page.data() + i, n);
+				std::cout << "  0x" << std::hex << start + i << ": 0x"
+						  << old_value << " -> 0x" << new_value << std::dec
+						  << '\n';
+			}
+		}
+		std::memcpy(saved, page.data(), size);
+	}
+
+	if (changed_words > MAX_REPORTED_WORDS) {
+		std::cout << "  " << changed_words - MAX_REPORTED_WORDS
+				  << " more changed words\n";
+	}
+	return changed_words != 0;
 }
 
 void
-Debugger::step_over_breakpoint()
+Debugger::print_display(Display& display)
 {
-	auto pc = get_pc();
-	if (m_breakpoints.count(pc)) {
-		auto& bp = m_breakpoints[pc];
-		// check if breakpoint is set for the current pc
-		if (bp.is_enabled()) {
-			// disable the breakpoint
-			bp.disable();
-			// step over the original instruction
-			ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
-			wait_for_signal();
-			// re-enable the breakpoint
-			bp.enable();
+	std::uintptr_t			address{ 0 };
+	std::optional<uint64_t> value;
+	if (is_prefix("0x", display.expression)) {
+		address = std::stoull(display.expression, 0, WORD_SIZE);
+	} else {
+		try {
+			auto location = locate_variable(display.expression);
+			if (location &&
+				location->location_type == dwarf::expr_result::type::reg) {
+				value = get_register_value_from_dwarf_register(
+					m_tid, location->value);
+			} else if (location && location->location_type ==
+									   dwarf::expr_result::type::address) {
+				address = location->value;
+			}
+		} catch (std::exception&) {
+			// not stopped inside a function with debug information
 		}
 	}
+
+	if (address != 0) {
+		// read again only if the variable moved or its page was written
+		if (!display.valid || display.address != address ||
+			!m_page_tracker.dirty_pages(address, sizeof(uint64_t)).empty()) {
+			display.valid = read_memory_block(
+				m_pid, address, &display.value, sizeof(uint64_t));
+		}
+		if (display.valid)
+			value = display.value;
+	}
+	display.address = address;
+
+	std::cout << display.id << ": " << display.expression << " = ";
+	if (value) {
+		std::cout << std::dec << static_cast<long>(*value) << '\n';
+	} else {
+		std::cout << "<not available>\n";
+	}
 }
 
 void
-Debugger::wait_for_signal()
+Debugger::wait_for_signal_watching()
 {
-	int wait_status{};
-	int options{};
-	waitpid(m_pid, &wait_status, options);
-
-	auto signal_info = get_signal_info();
-	switch (signal_info.si_signo) {
-		case SIGTRAP:
-			handle_sigtrap(signal_info);
+	// no soft-dirty bits means comparing whole regions, do it less often
+	const auto interval = m_page_tracker.is_supported()
+							  ? std::chrono::milliseconds{ 10 }
+							  : std::chrono::milliseconds{ 100 };
+	while (true) {
+		// look for a pending stop without reaping it, wait_for_signal() does
+		siginfo_t info{};
+		waitid(waits_for_any() ? P_ALL : P_PID,
+			   m_pid,
+			   &info,
+			   WEXITED | WSTOPPED | WNOHANG | WNOWAIT | __WALL);
+		if (info.si_pid != 0)
 			break;
-		case SIGSEGV:
-			std::cerr << "segfault. " << signal_info.si_code << std::endl;
+
+		// the soft-dirty bits are only cleared at stops, so the pages written
+		// since the last one are compared on each poll and no write is missed
+		bool changed{ false };
+		for (auto& watchpoint : m_watchpoints)
+			changed = changed || check_watchpoint(watchpoint, false);
+		if (changed) {
+			// only the current thread: a SIGSTOP to the process would be a
+			// group-stop, reported to a seized process as PTRACE_EVENT_STOP
+			m_watch_stop = true;
+			if (m_attached)
+				ptrace(PTRACE_INTERRUPT, m_tid, nullptr, nullptr);
+			else
+				syscall(SYS_tgkill, m_pid, m_tid, SIGSTOP);
 			break;
-		default:
-			std::cout << "Got signal " << strsignal(signal_info.si_signo)
-					  << std::endl;
+		}
+		std::this_thread::sleep_for(interval);
 	}
+	wait_for_signal();
 }
 
-dwarf::die
-Debugger::get_function_from_pc(const std::intptr_t pc)
+std::optional<dwarf::expr_result>
+Debugger::locate_variable(const std::string_view name)
 {
-	// iterate through compilation_units until pc is found
-	for (auto& compilation_unit : m_dwarf.compilation_units()) {
-		if (!die_pc_range(compilation_unit.root()).contains(pc))
+	auto func = get_function_from_pc(get_offset_pc());
+	for (const auto& die : func) {
+		if (die.tag != dwarf::DW_TAG::variable ||
+			!die.has(dwarf::DW_AT::name) || at_name(die) != name)
 			continue;
 
+		auto location_val = die[dwarf::DW_AT::location];
+		if (location_val.get_type() != dwarf::value::type::exprloc)
+			return std::nullopt;
+		Ptrace_Expr_Context context{ m_tid, m_load_address };
+		return location_val.as_exprloc().evaluate(&context);
+	}
+	return std::nullopt;
+}
+
+dwarf::die
+Debugger::get_function_from_pc(const std::intptr_t pc)
+{
+	// only the unit covering pc is parsed
+	if (auto compilation_unit = m_image->unit_at(pc)) {
 		// iterate through children until we find relevant function
 		// (DW_TAG_subprogram)
-		for (const auto& die : compilation_unit.root()) {
+		for (const auto& die : compilation_unit->root()) {
 			if (die.tag == dwarf::DW_TAG::subprogram &&
 				die_pc_range(die).contains(pc)) {
 				return die;
@@ -313,23 +2663,151 @@ Debugger::get_function_from_pc(const std::intptr_t pc)
 	throw std::out_of_range{ "Cannot find function" };
 }
 
-dwarf::line_table::iterator
+std::shared_ptr<const Line_Table>
+Debugger::get_line_table_from_pc(const std::intptr_t pc)
+{
+	if (auto compilation_unit = m_image->unit_at(pc))
+		return m_image->line_table(*compilation_unit);
+
+	throw std::out_of_range{ "Cannot find line entry" };
+}
+
+Line_Entry
 Debugger::get_line_entry_from_pc(const std::intptr_t pc)
 {
-	for (auto& compilation_unit : m_dwarf.compilation_units()) {
-		if (!die_pc_range(compilation_unit.root()).contains(pc))
-			continue;
+	auto line_table = get_line_table_from_pc(pc);
+	auto row		= line_table->find_address(pc);
+	if (row == Line_Table::npos) {
+		throw std::out_of_range{ "Cannot find line entry" };
+	}
+	return line_table->entry(row);
+}
+
+pid_t
+Debugger::handle_clone_event(const pid_t parent)
+{
+	unsigned long message{};
+	ptrace(PTRACE_GETEVENTMSG, parent, nullptr, &message);
+	auto thread = static_cast<pid_t>(message);
+
+	// collect the first stop of the thread, unless the wait loop already did
+	auto seen =
+		std::find(m_new_processes.begin(), m_new_processes.end(), thread);
+	if (seen != m_new_processes.end()) {
+		m_new_processes.erase(seen);
+	} else {
+		int wait_status{};
+		waitpid(thread, &wait_status, __WALL);
+	}
+	m_threads.emplace_back(thread);
+	// its stack was mapped for it
+	m_memory_map.invalidate();
+	return thread;
+}
+
+bool
+Debugger::traces_threads() const
+{
+	return m_attached || m_threads.size() > 1;
+}
+
+bool
+Debugger::waits_for_any() const
+{
+	return traces_threads() || !m_filtered_processes.empty();
+}
 
-		auto& line_table = compilation_unit.get_line_table();
-		auto  it		 = line_table.find_address(pc);
-		if (it == line_table.end()) {
-			throw std::out_of_range{ "Cannot find line entry" };
+void
+Debugger::stop_other_threads()
+{
+	if (!traces_threads())
+		return;
+
+	// the threads of a launched program were not seized, they are stopped
+	// with a signal instead
+	auto threads = m_threads;
+	for (auto tid : threads) {
+		if (tid == m_tid)
+			continue;
+		if (m_attached) {
+			ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
 		} else {
-			return it;
+			syscall(SYS_tgkill, m_pid, tid, SIGSTOP);
+			m_stopping_threads.emplace_back(tid);
 		}
 	}
 
-	throw std::out_of_range{ "Cannot find line entry" };
+	std::vector<pid_t> exited;
+	for (auto tid : threads) {
+		if (tid == m_tid)
+			continue;
+
+		int wait_status{};
+		waitpid(tid, &wait_status, __WALL);
+		if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+			exited.emplace_back(tid);
+			continue;
+		}
+		if (wait_status >> 16 == PTRACE_EVENT_STOP)
+			continue;
+		auto stopping = std::find(
+			m_stopping_threads.begin(), m_stopping_threads.end(), tid);
+		if (WSTOPSIG(wait_status) == SIGSTOP &&
+			stopping != m_stopping_threads.end()) {
+			m_stopping_threads.erase(stopping);
+			continue;
+		}
+		// a thread it created is traced and stopped as well
+		if (wait_status >> 16 == PTRACE_EVENT_CLONE) {
+			handle_clone_event(tid);
+			continue;
+		}
+		// a signal for the program, delivered when the thread is resumed
+		if (wait_status >> 16 == 0 && WSTOPSIG(wait_status) != SIGTRAP) {
+			m_pending_signals[tid] = WSTOPSIG(wait_status);
+			continue;
+		}
+
+		// the thread stopped for another reason before the interrupt landed,
+		// if it ran into one of our breakpoints rewind it so that it hits the
+		// breakpoint again once it is resumed
+		siginfo_t info;
+		ptrace(PTRACE_GETSIGINFO, tid, nullptr, &info);
+		if (info.si_signo == SIGTRAP &&
+			(info.si_code == SI_KERNEL || info.si_code == TRAP_BRKPT)) {
+			auto pc = get_register_value(tid, Reg::rip);
+			if (m_breakpoints.count(pc - 1) ||
+				(m_coverage && m_coverage->has_breakpoint(pc - 1))) {
+				set_register_value(tid, Reg::rip, pc - 1);
+			}
+		}
+	}
+
+	for (auto tid : exited) {
+		m_threads.erase(std::remove(m_threads.begin(), m_threads.end(), tid),
+						m_threads.end());
+		m_stopping_threads.erase(std::remove(m_stopping_threads.begin(),
+											 m_stopping_threads.end(),
+											 tid),
+								 m_stopping_threads.end());
+		m_pending_signals.erase(tid);
+	}
+}
+
+void
+Debugger::resume_other_threads()
+{
+	for (auto tid : m_threads) {
+		if (tid == m_tid)
+			continue;
+		int	 signal{ 0 };
+		auto pending = m_pending_signals.find(tid);
+		if (pending != m_pending_signals.end()) {
+			signal = pending->second;
+			m_pending_signals.erase(pending);
+		}
+		ptrace(PTRACE_CONT, tid, nullptr, signal);
+	}
 }
 
 void
@@ -337,14 +2815,36 @@ Debugger::initialise_load_address()
 {
 	if (m_elf.get_hdr().type != elf::et::dyn)
 		return;
-	// if this is a dynamic library
-	// the load address is found in /proc/<pid>/maps
-	std::ifstream map("/proc/" + std::to_string(m_pid) + "/maps");
+	// if this is a position independent executable, the load address is
+	// found in /proc/<pid>/maps. The first line is not necessarily the
+	// executable (a process we attach to can have other mappings below it),
+	// so look for the executable's mapping of file offset 0
+	auto		  exe = executable_of(m_pid);
+	std::ifstream maps("/proc/" + std::to_string(m_pid) + "/maps");
+
+	std::string line;
+	while (std::getline(maps, line)) {
+		std::istringstream fields{ line };
+		std::string		   range, perms, offset, device, inode, path;
+		fields >> range >> perms >> offset >> device >> inode;
+		std::getline(fields >> std::ws, path);
+		if (path != exe || std::stoull(offset, 0, WORD_SIZE) != 0)
+			continue;
 
-	// read the first address from the file
-	std::string addr{};
-	std::getline(map, addr, '-');
-	m_load_address = std::stoul(addr, 0, WORD_SIZE);
+		auto start =
+			std::stoull(range.substr(0, range.find('-')), 0, WORD_SIZE);
+		// file offset 0 is mapped at load bias + (p_vaddr - p_offset) of the
+		// first PT_LOAD segment, which is 0 for most PIEs
+		for (const auto& segment : m_elf.segments()) {
+			const auto& hdr = segment.get_hdr();
+			if (hdr.type == elf::pt::load) {
+				start -= hdr.vaddr - hdr.offset;
+				break;
+			}
+		}
+		m_load_address = start;
+		return;
+	}
 }
 
 std::intptr_t
@@ -399,8 +2899,9 @@ Debugger::print_source(const std::string_view file_name,
 siginfo_t
 Debugger::get_signal_info()
 {
-	siginfo_t info;
-	ptrace(PTRACE_GETSIGINFO, m_pid, nullptr, &info);
+	// left zeroed if the process is gone
+	siginfo_t info{};
+	ptrace(PTRACE_GETSIGINFO, m_tid, nullptr, &info);
 	return info;
 }
 
@@ -421,13 +2922,15 @@ Debugger::handle_sigtrap(const siginfo_t info)
 			// offset pc for querying DWARF
 			auto offset_pc	= offset_load_address(pc);
 			auto line_entry = get_line_entry_from_pc(offset_pc);
-			print_source(line_entry->file->path, line_entry->line);
+			print_source(line_entry.file, line_entry.line);
 			return;
 		}
 		// signal 0 checks if the process is running
 		case 0:
 		// TRAP_TRACE will be set if the signal was sent by single stepping
 		case TRAP_TRACE:
+		// TRAP_BRANCH if it was sent by branch stepping
+		case TRAP_BRANCH:
 			return;
 		default:
 			std::cout << "Unknown SIGTRAP code " << info.si_code << std::endl;
@@ -438,13 +2941,17 @@ Debugger::handle_sigtrap(const siginfo_t info)
 void
 Debugger::single_step_instruction()
 {
-	ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
+	resume(PTRACE_SINGLESTEP);
 	wait_for_signal();
 }
 
 void
 Debugger::single_step_instruction_with_breakpoint_check()
 {
+	if (m_recorder.is_recording()) {
+		record_state();
+	}
+
 	// check and see if we need to disable and enable a breakpoint
 	if (m_breakpoints.count(get_pc())) {
 		step_over_breakpoint();
@@ -457,7 +2964,7 @@ void
 Debugger::step_out()
 {
 	// set a breakpoint at the return address of the function and continue
-	auto frame_pointer = get_register_value(m_pid, Reg::rbp);
+	auto frame_pointer = get_register_value(m_tid, Reg::rbp);
 	// return address is stored 8 bytes after the start of a stack frame
 	auto return_address = read_memory(frame_pointer + 8);
 
@@ -477,8 +2984,9 @@ Debugger::step_out()
 void
 Debugger::remove_breakpoint(const std::intptr_t addr)
 {
-	if (m_breakpoints.at(addr).is_enabled()) {
-		m_breakpoints.at(addr).disable();
+	auto& bp = m_breakpoints.at(addr);
+	if (bp.is_enabled()) {
+		bp.disable();
 	}
 	m_breakpoints.erase(addr);
 }
@@ -486,14 +2994,14 @@ Debugger::remove_breakpoint(const std::intptr_t addr)
 void
 Debugger::step_in()
 {
-	auto line = get_line_entry_from_pc(get_offset_pc())->line;
+	auto line = get_line_entry_from_pc(get_offset_pc()).line;
 	// keep on stepping over instructions until we get to a new line
-	while (get_line_entry_from_pc(get_offset_pc())->line == line) {
+	while (get_line_entry_from_pc(get_offset_pc()).line == line) {
 		single_step_instruction_with_breakpoint_check();
 	}
 
 	auto line_entry = get_line_entry_from_pc(get_offset_pc());
-	print_source(line_entry->file->path, line_entry->line);
+	print_source(line_entry.file, line_entry.line);
 }
 
 std::intptr_t
@@ -513,7 +3021,7 @@ Debugger::step_over()
 	auto func_entry = dwarf::at_low_pc(func);
 	auto func_end	= dwarf::at_high_pc(func);
 
-	auto line		= get_line_entry_from_pc(func_entry);
+	auto line_table = get_line_table_from_pc(func_entry);
 	auto start_line = get_line_entry_from_pc(get_offset_pc());
 
 	// we will need to remove any breakpoints set so they don't leak out of step
@@ -521,19 +3029,22 @@ Debugger::step_over()
 	std::vector<std::intptr_t> to_delete;
 	// to set all the breakpoints, loop over the line table entries until one
 	// outside the range of function is hit
-	while (line->address < func_end) {
-		auto load_address = offset_dwarf_address(line->address);
+	auto row = line_table->find_address(func_entry);
+	for (; row < line_table->size(); ++row) {
+		auto line = line_table->entry(row);
+		if (line.address >= func_end)
+			break;
+		auto load_address = offset_dwarf_address(line.address);
 		// make sure no breakpoint is already set
-		if (line->address != start_line->address &&
+		if (line.address != start_line.address && !line.end_sequence &&
 			!m_breakpoints.count(load_address)) {
 			set_breakpoint_at_address(load_address);
 			to_delete.emplace_back(load_address);
 		}
-		++line;
 	}
 
 	// set a breakpoint at return address
-	auto frame_pointer	= get_register_value(m_pid, Reg::rbp);
+	auto frame_pointer	= get_register_value(m_tid, Reg::rbp);
 	auto return_address = read_memory(frame_pointer + 8);
 	if (!m_breakpoints.count(return_address)) {
 		set_breakpoint_at_address(return_address);
@@ -551,21 +3062,148 @@ Debugger::step_over()
 void
 Debugger::set_breakpoint_at_function(const std::string_view func_name)
 {
-	// iterate through all compilation units and search for functions with name
-	// which matches
-	for (const auto& compilation_unit : m_dwarf.compilation_units()) {
-		for (const auto& die : compilation_unit.root()) {
+	// search the units the name tables point at (all of them without
+	// tables) for functions with name which matches
+	bool found{ false };
+	for (auto compilation_unit : m_image->units_named(func_name)) {
+		for (const auto& die : compilation_unit->root()) {
 			if (die.has(dwarf::DW_AT::name) &&
 				dwarf::at_name(die) == func_name.data()) {
-				auto low_pc = dwarf::at_low_pc(die);
-				auto entry	= get_line_entry_from_pc(low_pc);
-				// increment the line entry by one to get the first line of the
-				// user code instead of the prologue
-				++entry;
-				set_breakpoint_at_address(offset_dwarf_address(entry->address));
+				auto  low_pc	 = dwarf::at_low_pc(die);
+				auto line_table = get_line_table_from_pc(low_pc);
+				auto row		= line_table->find_address(low_pc);
+				if (row == Line_Table::npos) {
+					throw std::out_of_range{ "Cannot find line entry" };
+				}
+				// the next line entry is the first line of the user code
+				// instead of the prologue, when the function has one
+				auto entry	 = line_table->entry(row);
+				auto high_pc = dwarf::at_high_pc(die);
+				if (row + 1 < line_table->size()) {
+					auto next = line_table->entry(row + 1);
+					if (!next.end_sequence && next.address < high_pc)
+						entry = next;
+				}
+				set_breakpoint_at_address(offset_dwarf_address(entry.address));
+				found = true;
+			}
+		}
+	}
+
+	// not a function of the program, try the shared libraries
+	if (!found) {
+		for (const auto& sym : lookup_library_symbol(func_name)) {
+			if (sym.type == symbol_type::func) {
+				set_breakpoint_at_address(sym.addr);
+			}
+		}
+	}
+}
+
+void
+Debugger::set_tracepoint(const std::string_view location)
+{
+	std::intptr_t address{ 0 };
+	std::intptr_t function_end{ 0 };
+	if (is_prefix("0x", location)) {
+		address = std::stoull(std::string{ location.substr(2) }, 0, WORD_SIZE);
+	} else {
+		for (auto compilation_unit : m_image->units_named(location)) {
+			for (const auto& die : compilation_unit->root()) {
+				if (die.tag == dwarf::DW_TAG::subprogram &&
+					die.has(dwarf::DW_AT::name) &&
+					die.has(dwarf::DW_AT::low_pc) &&
+					dwarf::at_name(die) == location.data()) {
+					// trace the entry, the arguments are still in registers
+					address = offset_dwarf_address(dwarf::at_low_pc(die));
+					function_end = offset_dwarf_address(dwarf::at_high_pc(die));
+				}
 			}
 		}
 	}
+	if (address == 0) {
+		std::cerr << "Cannot find function " << location << '\n';
+		return;
+	}
+
+	// the jump can overwrite up to 4 instructions, an INT3 among them would
+	// be copied into the trampoline
+	for (auto addr = address; addr < address + 20; ++addr) {
+		if (m_breakpoints.count(addr)) {
+			std::cerr << "Remove the breakpoint at 0x" << std::hex << addr
+					  << " first\n";
+			return;
+		}
+	}
+
+	if (!m_tracepoints) {
+		m_tracepoints = std::make_unique<Tracepoint_Manager>(m_pid);
+	}
+	std::vector<std::intptr_t> thread_pcs;
+	for (auto tid : m_threads) {
+		thread_pcs.emplace_back(get_register_value(tid, Reg::rip));
+	}
+	m_tracepoints->install(
+		m_tid, address, function_end, std::string{ location }, thread_pcs);
+	// the first tracepoint maps the trampoline pages
+	m_memory_map.invalidate();
+}
+
+bool
+Debugger::collect_coverage(const std::vector<std::string>& sources,
+						   const std::string&			   output)
+{
+	wait_for_launch();
+	// the breakpoints are taken out of forked children, they run on their
+	// own
+	m_follow_child = false;
+
+	// every statement of the selected units
+	std::vector<Coverage_Point> points;
+	for (const auto& compilation_unit : m_dwarf.compilation_units()) {
+		auto& root = compilation_unit.root();
+		if (!sources.empty()) {
+			auto name = root.has(dwarf::DW_AT::name) ? dwarf::at_name(root)
+													 : std::string{};
+			if (std::none_of(sources.begin(),
+							 sources.end(),
+							 [&name](auto&& source) {
+								 return is_suffix(source, name);
+							 }))
+				continue;
+		}
+		auto line_table = m_image->line_table(compilation_unit);
+		for (std::size_t row = 0; row < line_table->size(); ++row) {
+			auto entry = line_table->entry(row);
+			if (entry.is_stmt && !entry.end_sequence && entry.line != 0)
+				points.push_back(
+					Coverage_Point{ static_cast<std::uintptr_t>(
+										offset_dwarf_address(entry.address)),
+									entry.file,
+									entry.line });
+		}
+	}
+	m_coverage = std::make_unique<Coverage>(m_pid);
+	std::cout << "Planted " << std::dec << m_coverage->insert(points)
+			  << " coverage breakpoints\n";
+
+	// the hits are handled by wait_for_stop(), only signals of the program
+	// and the stops of caught system calls come back here
+	resume(PTRACE_CONT);
+	while (true) {
+		auto stopped = wait_for_stop();
+		if (WIFEXITED(m_wait_status) || WIFSIGNALED(m_wait_status))
+			break;
+		int signal{ 0 };
+		if (stopped && WIFSTOPPED(m_wait_status) &&
+			WSTOPSIG(m_wait_status) != SIGTRAP)
+			signal = WSTOPSIG(m_wait_status);
+		resume(PTRACE_CONT, signal);
+	}
+
+	std::cout << "Covered " << m_coverage->covered_line_count() << " of "
+			  << m_coverage->line_count() << " lines\n";
+	return m_coverage->write_lcov(output);
 }
 
 void
@@ -575,15 +3213,14 @@ Debugger::set_breakpoint_at_source_line(const std::string_view file,
 	for (const auto& compilation_unit : m_dwarf.compilation_units()) {
 		if (!is_suffix(file, dwarf::at_name(compilation_unit.root())))
 			continue;
-		const auto& line_entry = compilation_unit.get_line_table();
-
-		for (const auto& entry : line_entry) {
-			// check the line table entry is marked as the beginning of a
-			// statement
-			if (entry.is_stmt && entry.line == line) {
-				set_breakpoint_at_address(offset_dwarf_address(entry.address));
-				return;
-			}
+		// statements of the line through the reverse index, lowest address
+		// first
+		auto line_table = m_image->line_table(compilation_unit);
+		auto rows		= line_table->find_line(line);
+		if (!rows.empty()) {
+			auto entry = line_table->entry(rows.front());
+			set_breakpoint_at_address(offset_dwarf_address(entry.address));
+			return;
 		}
 	}
 }
@@ -607,39 +3244,185 @@ Debugger::lookup_symbol(const std::string_view symbol_name)
 				to_symbol_type(data.type()), sym.get_name(), data.value });
 		}
 	}
+
+	auto library_syms = lookup_library_symbol(symbol_name);
+	syms.insert(syms.end(), library_syms.begin(), library_syms.end());
 	return syms;
 }
 
 void
 Debugger::print_backtrace()
 {
-
-	// output format of each frame
-	auto output_frame = [frame_number = 0](auto&& func) mutable {
-		std::cout << "frame #" << frame_number++ << ": 0x"
-				  << dwarf::at_low_pc(func) << ' ' << dwarf::at_name(func)
-				  << std::endl;
+	// unwinding through code without frame pointers can loop
+	static constexpr int MAX_FRAMES{ 256 };
+
+	// output format of each frame, returns the name of the function
+	int	 frame_number{ 0 };
+	auto output_frame = [this, &frame_number](const std::intptr_t pc) {
+		std::cout << "frame #" << std::dec << frame_number++ << ": 0x";
+		try {
+			auto func = get_function_from_pc(offset_load_address(pc));
+			std::cout << std::hex << dwarf::at_low_pc(func) << ' '
+					  << dwarf::at_name(func) << std::endl;
+			return dwarf::at_name(func);
+		} catch (std::out_of_range&) {
+			// not in the program, look in the shared libraries
+		}
+		if (auto sym = lookup_library_function(pc)) {
+			std::cout << std::hex << sym->addr << ' ' << sym->name << " in "
+					  << m_modules.find(pc)->path << std::endl;
+			return sym->name;
+		}
+		std::cout << std::hex << pc << " ??";
+		if (auto region = m_memory_map.find(m_pid, pc)) {
+			std::cout << " in "
+					  << (region->path.empty() ? to_string(region->kind())
+											   : region->path);
+		}
+		std::cout << std::endl;
+		return std::string{};
 	};
 
 	// get current function
-	auto current_func = get_function_from_pc(offset_load_address(get_pc()));
-	output_frame(current_func);
+	auto current_func = output_frame(get_pc());
 
 	// frame pointer is stored in the rbp register
-	std::intptr_t frame_pointer = get_register_value(m_pid, Reg::rbp);
+	std::intptr_t frame_pointer = get_register_value(m_tid, Reg::rbp);
 	// return address is 8 bytes up the stack from the frame pointer
 	std::intptr_t return_address = read_memory(frame_pointer + 8);
 
 	// keep unwinding until debugger hits main
-	while (dwarf::at_name(current_func) != "main") {
-		current_func =
-			get_function_from_pc(offset_load_address(return_address));
-		output_frame(current_func);
+	while (current_func != "main" &&
+		   valid_frame(frame_pointer, return_address) &&
+		   frame_number < MAX_FRAMES) {
+		current_func   = output_frame(return_address);
 		frame_pointer  = read_memory(frame_pointer);
 		return_address = read_memory(frame_pointer + 8);
 	}
 }
 
+void
+Debugger::print_all_backtraces(const bool group)
+{
+	auto start	 = std::chrono::steady_clock::now();
+	auto threads = m_threads;
+
+	// every thread is stopped at the prompt. Only this thread may use
+	// ptrace, so the registers are read here, one request per thread
+	std::vector<user_regs_struct> registers(threads.size());
+	for (std::size_t i = 0; i < threads.size(); ++i) {
+		ptrace(PTRACE_GETREGS, threads[i], nullptr, &registers[i]);
+	}
+	m_memory_map.refresh(m_pid);
+	const auto& regions = m_memory_map.regions();
+
+	// the stacks are read and walked in parallel
+	std::vector<std::vector<std::uintptr_t>> stacks(threads.size());
+	std::atomic<std::size_t>				 next{ 0 };
+	auto									 unwind = [&] {
+		for (auto i = next++; i < threads.size(); i = next++) {
+			stacks[i] = unwind_stack(m_pid, registers[i], regions);
+		}
+	};
+	auto workers_count = std::min<std::size_t>(
+		std::max(1u, std::thread::hardware_concurrency()), threads.size());
+	std::vector<std::thread> workers;
+	for (std::size_t worker = 1; worker < workers_count; ++worker) {
+		workers.emplace_back(unwind);
+	}
+	unwind();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	auto unwound = std::chrono::steady_clock::now();
+
+	// threads by stack, in the order they were listed
+	std::vector<std::pair<std::vector<std::uintptr_t>, std::vector<pid_t>>>
+		groups;
+	std::map<std::vector<std::uintptr_t>, std::size_t> group_of;
+	for (std::size_t i = 0; i < threads.size(); ++i) {
+		if (group) {
+			auto [found, inserted] = group_of.emplace(stacks[i], groups.size());
+			if (!inserted) {
+				groups[found->second].second.push_back(threads[i]);
+				continue;
+			}
+		}
+		groups.emplace_back(std::move(stacks[i]),
+							std::vector<pid_t>{ threads[i] });
+	}
+	// the most common stack (where a hung service waits) first
+	std::stable_sort(groups.begin(), groups.end(), [](auto&& a, auto&& b) {
+		return a.second.size() > b.second.size();
+	});
+
+	// libelfin is not thread safe, each address is described once here.
+	// Frame #0 is a pc, the others return addresses
+	std::unordered_map<std::uintptr_t, std::string> descriptions[2];
+	for (const auto& [frames, tids] : groups) {
+		std::cout << std::dec << tids.size()
+				  << (tids.size() == 1 ? " thread:" : " threads:");
+		for (std::size_t i = 0; i < tids.size() && i < 8; ++i) {
+			std::cout << ' ' << tids[i];
+		}
+		std::cout << (tids.size() > 8 ? " ...\n" : "\n");
+		for (std::size_t frame = 0; frame < frames.size(); ++frame) {
+			auto  return_address = frame != 0;
+			auto& description	 = descriptions[return_address][frames[frame]];
+			if (description.empty())
+				description =
+					describe_code_address(frames[frame], return_address);
+			std::cout << "  frame #" << std::dec << frame << ": "
+					  << description << '\n';
+		}
+	}
+	std::cout << std::dec << threads.size() << " threads, " << groups.size()
+			  << " stacks, unwound in "
+			  << std::chrono::duration_cast<std::chrono::microseconds>(
+					 unwound - start)
+					 .count()
+			  << " us\n";
+}
+
+bool
+Debugger::valid_frame(const std::intptr_t frame_pointer,
+					  const std::intptr_t return_address)
+{
+	// code built without frame pointers ends a walk here instead of
+	// following garbage
+	auto frame = m_memory_map.find(m_pid, frame_pointer);
+	auto code  = m_memory_map.find(m_pid, return_address);
+	return frame != nullptr && frame->writable && code != nullptr &&
+		   code->executable;
+}
+
+std::string
+Debugger::describe_code_address(const std::intptr_t pc,
+								const bool			return_address)
+{
+	std::ostringstream description;
+	description << "0x" << std::hex << pc << std::dec;
+	try {
+		auto func = get_function_from_pc(offset_load_address(pc));
+		description << " in " << dwarf::at_name(func);
+		try {
+			// a return address is the instruction after the call
+			auto entry = get_line_entry_from_pc(
+				offset_load_address(return_address ? pc - 1 : pc));
+			description << " at " << entry.file << ':' << entry.line;
+		} catch (std::out_of_range&) {
+		}
+		return description.str();
+	} catch (std::out_of_range&) {
+		// not in the program, or no line for it
+	}
+	if (auto sym = lookup_library_function(pc)) {
+		description << " in " << sym->name << " from "
+					<< m_modules.find(pc)->path;
+	}
+	return description.str();
+}
+
 void
 Debugger::read_variables()
 {
@@ -653,7 +3436,7 @@ Debugger::read_variables()
 
 		auto location_val = die[dwarf::DW_AT::location];
 		if (location_val.get_type() == dwarf::value::type::exprloc) {
-			Ptrace_Expr_Context context{ m_pid, m_load_address };
+			Ptrace_Expr_Context context{ m_tid, m_load_address };
 			auto result = location_val.as_exprloc().evaluate(&context);
 
 			switch (result.location_type) {
@@ -667,7 +3450,7 @@ Debugger::read_variables()
 				}
 				case dwarf::expr_result::type::reg: {
 					auto value = get_register_value_from_dwarf_register(
-						m_pid, result.value);
+						m_tid, result.value);
 					std::cout << at_name(die) << " (reg " << result.value
 							  << ") = " << value << std::endl;
 					break;
@@ -0,0 +1,163 @@
+#include <displaced_step.hpp>
+#include <inferior_syscall.hpp>
+#include <memory_access.hpp>
+#include <registers.hpp>
+#include <x86_decoder.hpp>
+
+#include <sys/mman.h>	 // PROT_*, MAP_*
+#include <sys/syscall.h> // SYS_mmap
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace mini_debugger {
+
+// longest x86 instruction
+static constexpr std::size_t MAX_INSTRUCTION_LEN{ 15 };
+// distance a rel32 can cover, minus a margin for the size of a page
+static constexpr long long MAX_PAGE_DISTANCE{ (1ll << 31) - (1 << 13) };
+
+Displaced_Stepper::Displaced_Stepper(const pid_t pid)
+	: m_pid{ pid }
+{
+}
+
+std::optional<std::uintptr_t>
+Displaced_Stepper::prepare(const pid_t			tid,
+						   const std::uintptr_t address,
+						   const uint8_t		saved_byte)
+{
+	// the instruction may end right before an unmapped page
+	uint8_t		code[MAX_INSTRUCTION_LEN]{};
+	std::size_t size{ sizeof(code) };
+	if (!read_memory_block(m_pid, address, code, size)) {
+		size = std::min<std::size_t>(
+			size, DISPLACED_PAGE_SIZE - address % DISPLACED_PAGE_SIZE);
+		if (!read_memory_block(m_pid, address, code, size))
+			return std::nullopt;
+	}
+	code[0] = saved_byte;
+
+	// a system call from the slot could fork, clone or exec with a pc in our
+	// scratch page, those are stepped in place
+	if (code[0] == 0x0f && code[1] == 0x05)
+		return std::nullopt;
+	auto insn = decode_instruction(code, size);
+	if (!insn)
+		return std::nullopt;
+
+	auto page = scratch_page(tid, address);
+	if (page == 0)
+		return std::nullopt;
+	// a slot no other thread is stepping in, the same index in every page
+	std::vector<bool> used(DISPLACED_PAGE_SIZE / DISPLACED_SLOT_SIZE);
+	for (const auto& [other, step] : m_pending) {
+		if (other != tid)
+			used[step.slot % DISPLACED_PAGE_SIZE / DISPLACED_SLOT_SIZE] = true;
+	}
+	auto free = std::find(used.begin(), used.end(), false);
+	if (free == used.end())
+		return std::nullopt;
+	auto slot = page + (free - used.begin()) * DISPLACED_SLOT_SIZE;
+
+	std::vector<uint8_t> copy;
+	if (!relocate_instruction(*insn, code, address, slot, copy) ||
+		!write_memory_block(m_pid, slot, copy.data(), copy.size()))
+		return std::nullopt;
+
+	m_pending[tid] = Pending_Step{ address,
+								   insn->length,
+								   slot,
+								   copy.size(),
+								   get_register_value(tid, Reg::rsp) };
+	return slot;
+}
+
+void
+Displaced_Stepper::finish(const pid_t tid)
+{
+	auto pending = m_pending.find(tid);
+	if (pending == m_pending.end())
+		return;
+	auto step = pending->second;
+	m_pending.erase(pending);
+
+	// fell through the copy: continue after the original instruction. A
+	// taken branch already went to its absolute target
+	auto pc = static_cast<std::uintptr_t>(get_register_value(tid, Reg::rip));
+	auto slot_end = step.slot + step.slot_length;
+	if (pc == slot_end) {
+		set_register_value(tid, Reg::rip, step.from + step.length);
+	} else if (pc == step.slot) {
+		// a signal came before the instruction ran
+		set_register_value(tid, Reg::rip, step.from);
+	}
+
+	// a call (direct or indirect) pushed the address following the copy
+	auto rsp = get_register_value(tid, Reg::rsp);
+	if (rsp == step.rsp - 8) {
+		std::uint64_t return_address{};
+		if (read_memory_block(
+				m_pid, rsp, &return_address, sizeof(return_address)) &&
+			return_address == slot_end) {
+			return_address = step.from + step.length;
+			write_memory_block(
+				m_pid, rsp, &return_address, sizeof(return_address));
+		}
+	}
+}
+
+void
+Displaced_Stepper::set_pid(const pid_t pid)
+{
+	m_pid = pid;
+	m_pending.clear();
+}
+
+std::size_t
+Displaced_Stepper::page_count() const
+{
+	return m_pages.size();
+}
+
+std::uintptr_t
+Displaced_Stepper::scratch_page(const pid_t tid, const std::uintptr_t address)
+{
+	// every byte of the page has to be reachable with a rel32 from the code
+	// and back
+	auto in_reach = [address](std::uintptr_t page) {
+		auto distance = std::llabs(static_cast<long long>(page - address));
+		return distance < MAX_PAGE_DISTANCE;
+	};
+	auto page = std::find_if(m_pages.begin(), m_pages.end(), in_reach);
+	if (page != m_pages.end())
+		return *page;
+	if (m_out_of_reach.count(address / DISPLACED_PAGE_SIZE))
+		return 0;
+
+	// ask for a page right below the code, the kernel may place it
+	// elsewhere if that range is taken
+	auto hint = (address - DISPLACED_PAGE_SIZE - (1 << 20)) &
+				~(DISPLACED_PAGE_SIZE - 1);
+	auto mapped = inject_syscall(tid,
+								 SYS_mmap,
+								 { static_cast<long>(hint),
+								   DISPLACED_PAGE_SIZE,
+								   PROT_READ | PROT_EXEC,
+								   MAP_PRIVATE | MAP_ANONYMOUS,
+								   -1,
+								   0 });
+	// mmap returns -errno on failure
+	if (mapped < 0 && mapped > -static_cast<long>(DISPLACED_PAGE_SIZE))
+		return 0;
+	if (!in_reach(mapped)) {
+		// no room near this code, its instructions are stepped in place
+		inject_syscall(tid, SYS_munmap, { mapped, DISPLACED_PAGE_SIZE });
+		m_out_of_reach.insert(address / DISPLACED_PAGE_SIZE);
+		return 0;
+	}
+	m_pages.emplace_back(mapped);
+	return mapped;
+}
+
+};
@@ -0,0 +1,1211 @@
+#include <gdb_server.hpp>
+#include <memory_access.hpp>
+
+#include <link.h>		 // r_debug
+#include <netdb.h>		 // getaddrinfo
+#include <netinet/in.h>	 // IPPROTO_TCP
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <poll.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/stat.h> // lstat
+#include <sys/un.h>	  // sockaddr_un
+#include <sys/user.h> // user_regs_struct, user_fpregs_struct
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace mini_debugger {
+
+// a register of the `g` packet, in the order of the target description
+struct Gdb_Register
+{
+	std::string name;
+	std::size_t size;
+	std::string type;
+	std::string feature;
+};
+
+static const std::vector<Gdb_Register>&
+gdb_registers()
+{
+	static const auto registers = [] {
+		const std::string core{ "org.gnu.gdb.i386.core" };
+		const std::string sse{ "org.gnu.gdb.i386.sse" };
+		std::vector<Gdb_Register> regs;
+		for (auto name : { "rax", "rbx", "rcx", "rdx", "rsi", "rdi" })
+			regs.push_back({ name, 8, "int64", core });
+		regs.push_back({ "rbp", 8, "data_ptr", core });
+		regs.push_back({ "rsp", 8, "data_ptr", core });
+		for (int i = 8; i < 16; ++i)
+			regs.push_back({ "r" + std::to_string(i), 8, "int64", core });
+		regs.push_back({ "rip", 8, "code_ptr", core });
+		for (auto name : { "eflags", "cs", "ss", "ds", "es", "fs", "gs" })
+			regs.push_back({ name, 4, "int32", core });
+		for (int i = 0; i < 8; ++i)
+			regs.push_back({ "st" + std::to_string(i), 10, "i387_ext", core });
+		for (auto name : { "fctrl",
+						   "fstat",
+						   "ftag",
+						   "fiseg",
+						   "fioff",
+						   "foseg",
+						   "fooff",
+						   "fop" })
+			regs.push_back({ name, 4, "int", core });
+		for (int i = 0; i < 16; ++i)
+			regs.push_back({ "xmm" + std::to_string(i), 16, "vec128", sse });
+		regs.push_back({ "mxcsr", 4, "int", sse });
+		regs.push_back({ "orig_rax", 8, "int", "org.gnu.gdb.i386.linux" });
+		regs.push_back({ "fs_base", 8, "int", "org.gnu.gdb.i386.segments" });
+		regs.push_back({ "gs_base", 8, "int", "org.gnu.gdb.i386.segments" });
+		return regs;
+	}();
+	return registers;
+}
+
+// linux signal numbers to GDB's (the protocol uses GDB's own numbering)
+static const std::vector<std::pair<int, int>> g_signal_numbers{
+	{ SIGHUP, 1 },	  { SIGINT, 2 },	{ SIGQUIT, 3 },	 { SIGILL, 4 },
+	{ SIGTRAP, 5 },	  { SIGABRT, 6 },	{ SIGBUS, 10 },	 { SIGFPE, 8 },
+	{ SIGKILL, 9 },	  { SIGUSR1, 30 },	{ SIGSEGV, 11 }, { SIGUSR2, 31 },
+	{ SIGPIPE, 13 },  { SIGALRM, 14 },	{ SIGTERM, 15 }, { SIGCHLD, 20 },
+	{ SIGCONT, 19 },  { SIGSTOP, 17 },	{ SIGTSTP, 18 }, { SIGTTIN, 21 },
+	{ SIGTTOU, 22 },  { SIGURG, 16 },	{ SIGXCPU, 24 }, { SIGXFSZ, 25 },
+	{ SIGVTALRM, 26 }, { SIGPROF, 27 }, { SIGWINCH, 28 }, { SIGIO, 23 },
+	{ SIGPWR, 32 },	  { SIGSYS, 12 },
+};
+
+// GDB_SIGNAL_UNKNOWN
+static constexpr int GDB_SIGNAL_UNKNOWN{ 143 };
+
+static int
+to_gdb_signal(const int signal)
+{
+	for (auto [linux_signal, gdb_signal] : g_signal_numbers) {
+		if (linux_signal == signal)
+			return gdb_signal;
+	}
+	return GDB_SIGNAL_UNKNOWN;
+}
+
+static int
+from_gdb_signal(const int signal)
+{
+	for (auto [linux_signal, gdb_signal] : g_signal_numbers) {
+		if (gdb_signal == signal)
+			return linux_signal;
+	}
+	return 0;
+}
+
+static std::string
+to_hex(const void* data, const std::size_t size)
+{
+	static constexpr char digits[]{ "0123456789abcdef" };
+	auto				  bytes = static_cast<const uint8_t*>(data);
+	std::string			  hex(size * 2, '0');
+	for (std::size_t i = 0; i < size; ++i) {
+		hex[2 * i]	   = digits[bytes[i] >> 4];
+		hex[2 * i + 1] = digits[bytes[i] & 0xf];
+	}
+	return hex;
+}
+
+static std::string
+to_hex(const std::uint64_t value, const int width = 0)
+{
+	std::ostringstream out;
+	out << std::hex;
+	if (width > 0)
+		out << std::setfill('0') << std::setw(width);
+	out << value;
+	return out.str();
+}
+
+static std::vector<uint8_t>
+from_hex(const std::string_view hex)
+{
+	std::vector<uint8_t> bytes(hex.size() / 2);
+	for (std::size_t i = 0; i < bytes.size(); ++i)
+		bytes[i] = std::stoul(std::string{ hex.substr(2 * i, 2) }, 0, 16);
+	return bytes;
+}
+
+// thread id of a packet: -1 for all threads, 0 for any
+static long
+parse_thread_id(const std::string& id)
+{
+	return id == "-1" ? -1 : std::stol(id, 0, 16);
+}
+
+// "addr,length" of the memory packets
+static std::pair<std::uintptr_t, std::size_t>
+parse_range(const std::string& range)
+{
+	auto comma = range.find(',');
+	return { std::stoull(range.substr(0, comma), 0, 16),
+			 std::stoull(range.substr(comma + 1), 0, 16) };
+}
+
+// '#', '$', '}' and '*' (run-length encoding) are escaped with '}' and xored
+// with 0x20 in binary data
+static std::string
+escape_binary(const void* data, const std::size_t size)
+{
+	auto		bytes = static_cast<const char*>(data);
+	std::string escaped;
+	escaped.reserve(size);
+	for (std::size_t i = 0; i < size; ++i) {
+		auto byte = bytes[i];
+		if (byte == '#' || byte == '$' || byte == '}' || byte == '*') {
+			escaped += '}';
+			byte ^= 0x20;
+		}
+		escaped += byte;
+	}
+	return escaped;
+}
+
+static std::vector<uint8_t>
+unescape_binary(const std::string_view data)
+{
+	std::vector<uint8_t> bytes;
+	bytes.reserve(data.size());
+	for (std::size_t i = 0; i < data.size(); ++i) {
+		if (data[i] == '}' && i + 1 < data.size())
+			bytes.push_back(data[++i] ^ 0x20);
+		else
+			bytes.push_back(data[i]);
+	}
+	return bytes;
+}
+
+static std::string
+xml_escape(const std::string_view text)
+{
+	std::string escaped;
+	for (auto c : text) {
+		switch (c) {
+			case '&':
+				escaped += "&amp;";
+				break;
+			case '<':
+				escaped += "&lt;";
+				break;
+			case '>':
+				escaped += "&gt;";
+				break;
+			case '"':
+				escaped += "&quot;";
+				break;
+			default:
+				escaped += c;
+		}
+	}
+	return escaped;
+}
+
+// qXfer reply: `length` bytes of `document` from `offset`, 'l' for the last
+// chunk and 'm' if there is more
+static std::string
+xfer_chunk(const std::string& document, const std::string& range)
+{
+	auto [offset, length] = parse_range(range);
+	if (offset >= document.size())
+		return "l";
+	auto chunk = document.substr(offset, length);
+	auto last  = offset + chunk.size() >= document.size();
+	return (last ? "l" : "m") + escape_binary(chunk.data(), chunk.size());
+}
+
+// full x87 tag word (2 bits per physical register) from the abridged one of
+// fxsave (1 bit: not empty), as the `ftag` register holds it
+static uint32_t
+full_tag_word(const user_fpregs_struct& fpregs)
+{
+	auto	 top = (fpregs.swd >> 11) & 7;
+	uint32_t tags{ 0 };
+	for (unsigned reg = 0; reg < 8; ++reg) {
+		uint32_t tag{ 3 }; // empty
+		if (fpregs.ftw & (1 << reg)) {
+			auto value = reinterpret_cast<const uint8_t*>(
+				&fpregs.st_space[((reg - top) & 7) * 4]);
+			uint16_t exponent;
+			uint64_t mantissa;
+			std::memcpy(&mantissa, value, 8);
+			std::memcpy(&exponent, value + 8, 2);
+			exponent &= 0x7fff;
+			if (exponent == 0x7fff)
+				tag = 2; // special: infinity or NaN
+			else if (exponent == 0)
+				tag = mantissa == 0 ? 1 : 2; // zero or denormal
+			else
+				tag = mantissa >> 63 ? 0 : 2; // valid or unnormal
+		}
+		tags |= tag << (2 * reg);
+	}
+	return tags;
+}
+
+Gdb_Server::Gdb_Server(Debugger& debugger)
+	: m_debugger{ debugger }
+	, m_listen_fd{ -1 }
+	, m_fd{ -1 }
+	, m_no_ack{ false }
+	, m_swbreak{ false }
+	, m_exited{ false }
+{
+}
+
+Gdb_Server::~Gdb_Server()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	if (m_listen_fd >= 0)
+		close(m_listen_fd);
+	if (!m_socket_path.empty())
+		unlink(m_socket_path.c_str());
+}
+
+bool
+Gdb_Server::serve(const std::string& address)
+{
+	if (!listen_on(address))
+		return false;
+
+	// attach() already stopped the process
+	if (!m_debugger.m_attached) {
+		m_debugger.wait_for_launch();
+	}
+	m_stop_reply = "T05thread:" + to_hex(m_debugger.m_tid) + ';';
+
+	std::cout << "Listening on " << address << std::endl;
+	m_fd = accept(m_listen_fd, nullptr, nullptr);
+	if (m_fd < 0) {
+		std::cerr << "Error accepting a connection: " << strerror(errno)
+				  << '\n';
+		return false;
+	}
+	// replies are small and latency bound, fails harmlessly on unix sockets
+	int no_delay{ 1 };
+	setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	std::cout << "Remote debugging of process " << std::dec
+			  << m_debugger.m_pid << " started" << std::endl;
+
+	std::string packet;
+	while (read_packet(packet)) {
+		if (!handle_packet(packet))
+			break;
+	}
+
+	// the client went away without a kill or detach
+	if (!m_exited) {
+		if (m_debugger.m_attached) {
+			m_debugger.detach();
+		} else {
+			kill(m_debugger.m_pid, SIGKILL);
+			waitpid(m_debugger.m_pid, nullptr, 0);
+		}
+	}
+	std::cout << "Remote debugging finished" << std::endl;
+	return true;
+}
+
+bool
+Gdb_Server::listen_on(const std::string& address)
+{
+	// [host]:port or port for TCP, anything else is a unix socket path
+	auto colon = address.rfind(':');
+	auto port  = address.substr(colon == std::string::npos ? 0 : colon + 1);
+	bool tcp   = !port.empty() &&
+			   port.find_first_not_of("0123456789") == std::string::npos &&
+			   address.find('/') == std::string::npos;
+
+	if (tcp) {
+		// only the local machine by default, the protocol has no
+		// authentication
+		auto host = colon == std::string::npos || colon == 0
+						? std::string{ "127.0.0.1" }
+						: address.substr(0, colon);
+
+		addrinfo hints{};
+		hints.ai_family	  = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags	  = AI_PASSIVE;
+		addrinfo* result{ nullptr };
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+			std::cerr << "Unknown address " << address << '\n';
+			return false;
+		}
+		for (auto info = result; info != nullptr; info = info->ai_next) {
+			auto fd =
+				socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (fd < 0)
+				continue;
+			int reuse{ 1 };
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+			if (bind(fd, info->ai_addr, info->ai_addrlen) == 0 &&
+				listen(fd, 1) == 0) {
+				m_listen_fd = fd;
+				break;
+			}
+			close(fd);
+		}
+		freeaddrinfo(result);
+	} else {
+		sockaddr_un unix_address{};
+		unix_address.sun_family = AF_UNIX;
+		if (address.size() >= sizeof(unix_address.sun_path)) {
+			std::cerr << "Socket path too long: " << address << '\n';
+			return false;
+		}
+		std::strcpy(unix_address.sun_path, address.c_str());
+		// a socket left behind by an earlier session. Anything else is
+		// most likely a mistyped address, it is left alone
+		struct stat file_stat;
+		if (lstat(address.c_str(), &file_stat) == 0) {
+			if (!S_ISSOCK(file_stat.st_mode)) {
+				std::cerr << "Cannot listen on " << address
+						  << ": not a socket\n";
+				return false;
+			}
+			unlink(address.c_str());
+		}
+
+		auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 &&
+			bind(fd,
+				 reinterpret_cast<sockaddr*>(&unix_address),
+				 sizeof(unix_address)) == 0 &&
+			listen(fd, 1) == 0) {
+			m_listen_fd	  = fd;
+			m_socket_path = address;
+		} else if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	if (m_listen_fd < 0) {
+		std::cerr << "Cannot listen on " << address << ": " << strerror(errno)
+				  << '\n';
+		return false;
+	}
+	return true;
+}
+
+bool
+Gdb_Server::receive(const int timeout_ms)
+{
+	pollfd fd{ m_fd, POLLIN, 0 };
+	auto   ready = poll(&fd, 1, timeout_ms);
+	if (ready < 0)
+		return errno == EINTR;
+	if (ready == 0)
+		return true;
+
+	char buffer[1 << 16];
+	auto size = recv(m_fd, buffer, sizeof(buffer), 0);
+	if (size <= 0)
+		return false;
+	m_input.append(buffer, size);
+	return true;
+}
+
+bool
+Gdb_Server::read_packet(std::string& packet)
+{
+	while (true) {
+		// acks of our replies and interrupts which came too late are dropped
+		auto start = m_input.find('$');
+		if (start == std::string::npos) {
+			m_input.clear();
+			if (!receive(-1))
+				return false;
+			continue;
+		}
+		auto hash = m_input.find('#', start);
+		if (hash == std::string::npos || m_input.size() < hash + 3) {
+			m_input.erase(0, start);
+			if (!receive(-1))
+				return false;
+			continue;
+		}
+
+		packet = m_input.substr(start + 1, hash - start - 1);
+		unsigned checksum{ 0 };
+		for (unsigned char c : packet)
+			checksum += c;
+		auto expected = std::stoul(m_input.substr(hash + 1, 2), 0, 16);
+		m_input.erase(0, hash + 3);
+		if (m_no_ack)
+			return true;
+
+		auto valid = (checksum & 0xff) == expected;
+		if (send(m_fd, valid ? "+" : "-", 1, MSG_NOSIGNAL) != 1)
+			return false;
+		if (valid)
+			return true;
+	}
+}
+
+bool
+Gdb_Server::send_packet(const std::string_view data)
+{
+	unsigned checksum{ 0 };
+	for (unsigned char c : data)
+		checksum += c;
+	std::string packet;
+	packet.reserve(data.size() + 4);
+	packet += '$';
+	packet += data;
+	packet += '#';
+	packet += to_hex(checksum & 0xff, 2);
+
+	while (true) {
+		std::size_t sent{ 0 };
+		while (sent < packet.size()) {
+			auto size = ::send(m_fd,
+							   packet.data() + sent,
+							   packet.size() - sent,
+							   MSG_NOSIGNAL);
+			if (size <= 0)
+				return false;
+			sent += size;
+		}
+		if (m_no_ack)
+			return true;
+
+		// wait for the ack, sending again if the client asks for it
+		while (true) {
+			if (m_input.empty() && !receive(-1))
+				return false;
+			if (m_input.empty())
+				continue;
+			auto ack = m_input.front();
+			if (ack != '+' && ack != '-')
+				return true;
+			m_input.erase(0, 1);
+			if (ack == '+')
+				return true;
+			break;
+		}
+	}
+}
+
+std::vector<pid_t>
+Gdb_Server::threads() const
+{
+	// no thread is known before the first stop of a launched process
+	if (m_debugger.m_threads.empty())
+		return { m_debugger.m_pid };
+	return m_debugger.m_threads;
+}
+
+bool
+Gdb_Server::handle_packet(const std::string& packet)
+{
+	if (packet.empty())
+		return send_packet("");
+
+	auto&		debugger = m_debugger;
+	std::string reply;
+	try {
+		switch (packet[0]) {
+			case '?':
+				reply = m_stop_reply;
+				break;
+			case 'q':
+			case 'Q':
+				reply = handle_query(packet);
+				break;
+			case 'v':
+				if (packet.rfind("vCont?", 0) == 0) {
+					reply = "vCont;c;C;s;S";
+				} else if (packet.rfind("vCont;", 0) == 0) {
+					reply = handle_vcont(packet.substr(6));
+				} else if (packet.rfind("vKill", 0) == 0) {
+					kill(debugger.m_pid, SIGKILL);
+					waitpid(debugger.m_pid, nullptr, 0);
+					m_exited = true;
+					reply	 = "OK";
+				}
+				break;
+			case 'H':
+			case 'T': {
+				// select the thread of the next register accesses, or check
+				// that a thread is alive
+				auto id =
+					parse_thread_id(packet.substr(packet[0] == 'H' ? 2 : 1));
+				auto current = threads();
+				auto known	 = std::find(current.begin(), current.end(), id) !=
+							 current.end();
+				if (packet[0] == 'H' && known)
+					debugger.m_tid = id;
+				reply = known || id <= 0 ? "OK" : "E01";
+				break;
+			}
+			case 'g': {
+				auto registers = read_registers();
+				if (registers.empty())
+					reply = "E01";
+				else
+					reply = to_hex(registers.data(), registers.size());
+				break;
+			}
+			case 'G':
+				reply =
+					write_registers(from_hex(packet.substr(1))) ? "OK" : "E01";
+				break;
+			case 'p':
+			case 'P': {
+				// one register, from/into the snapshot of all of them
+				auto equal	   = packet.find('=');
+				auto number	   = std::stoul(packet.substr(1, equal - 1), 0, 16);
+				auto registers = read_registers();
+				auto& regs	   = gdb_registers();
+				if (registers.empty() || number >= regs.size()) {
+					reply = "E01";
+					break;
+				}
+				std::size_t offset{ 0 };
+				for (std::size_t i = 0; i < number; ++i)
+					offset += regs[i].size;
+				auto size = regs[number].size;
+				if (packet[0] == 'p') {
+					reply = to_hex(registers.data() + offset, size);
+					break;
+				}
+				auto value = from_hex(packet.substr(equal + 1));
+				if (value.size() != size) {
+					reply = "E01";
+					break;
+				}
+				std::copy(
+					value.begin(), value.end(), registers.begin() + offset);
+				reply = write_registers(registers) ? "OK" : "E01";
+				break;
+			}
+			case 'm':
+			case 'x': {
+				auto [address, length] = parse_range(packet.substr(1));
+				std::vector<uint8_t> data;
+				if (!read_memory(address, data, length)) {
+					reply = "E01";
+				} else if (packet[0] == 'm') {
+					reply = to_hex(data.data(), data.size());
+				} else {
+					reply = 'b' + escape_binary(data.data(), data.size());
+				}
+				break;
+			}
+			case 'M':
+			case 'X': {
+				auto colon			   = packet.find(':');
+				auto [address, length] = parse_range(packet.substr(1, colon));
+				auto contents = std::string_view{ packet }.substr(colon + 1);
+				auto data	  = packet[0] == 'M' ? from_hex(contents)
+												 : unescape_binary(contents);
+				// `X addr,0:` is a probe for binary support
+				if (length == 0) {
+					reply = "OK";
+				} else if (data.size() != length ||
+						   !write_memory(address, data)) {
+					reply = "E01";
+				} else {
+					reply = "OK";
+				}
+				break;
+			}
+			case 'c':
+			case 's':
+			case 'C':
+			case 'S': {
+				// [signal][;address]
+				auto args = packet.substr(1);
+				int	 signal{ 0 };
+				if (packet[0] == 'C' || packet[0] == 'S') {
+					signal =
+						from_gdb_signal(std::stoi(args.substr(0, 2), 0, 16));
+					args   = args.size() > 3 ? args.substr(3) : "";
+				}
+				if (!args.empty())
+					debugger.set_pc(std::stoull(args, 0, 16));
+				auto step = packet[0] == 's' || packet[0] == 'S';
+				reply	  = resume(
+					step ? PTRACE_SINGLESTEP : PTRACE_CONT, signal, step);
+				break;
+			}
+			case 'Z':
+			case 'z': {
+				// software breakpoints only: Z0,addr,kind
+				if (packet.size() < 2 || packet[1] != '0')
+					break;
+				auto address = static_cast<std::intptr_t>(
+					std::stoull(packet.substr(3), 0, 16));
+				auto& internal = debugger.m_internal_breakpoints;
+				if (packet[0] == 'Z') {
+					// the client's breakpoint on one of ours (the loader's
+					// r_brk) stops, we run our handler when it is reported
+					auto handler = internal.find(address);
+					if (handler != internal.end()) {
+						m_shadowed[address] = std::move(handler->second);
+						internal.erase(handler);
+					} else if (!debugger.m_breakpoints.count(address)) {
+						Breakpoint bp{ debugger.m_pid, address };
+						bp.enable();
+						debugger.m_breakpoints.insert(bp);
+					}
+				} else {
+					auto handler = m_shadowed.find(address);
+					if (handler != m_shadowed.end()) {
+						internal[address] = std::move(handler->second);
+						m_shadowed.erase(handler);
+					} else if (debugger.m_breakpoints.count(address)) {
+						debugger.remove_breakpoint(address);
+					}
+				}
+				reply = "OK";
+				break;
+			}
+			case 'k':
+				kill(debugger.m_pid, SIGKILL);
+				waitpid(debugger.m_pid, nullptr, 0);
+				m_exited = true;
+				return false;
+			case 'D':
+				debugger.detach();
+				m_exited = true;
+				send_packet("OK");
+				return false;
+			default:
+				break;
+		}
+	} catch (std::exception&) {
+		// malformed packet
+		reply = "E01";
+	}
+	auto sent = send_packet(reply);
+	// the reply to QStartNoAckMode is still acknowledged
+	if (packet == "QStartNoAckMode")
+		m_no_ack = true;
+	return sent;
+}
+
+std::string
+Gdb_Server::handle_query(const std::string& packet)
+{
+	auto& debugger = m_debugger;
+	if (packet.rfind("qSupported", 0) == 0) {
+		// stop replies only carry swbreak (pc already rewound) if the client
+		// knows about it, otherwise it rewinds the pc itself
+		m_swbreak = packet.find("swbreak+") != std::string::npos;
+		return "PacketSize=" + to_hex(GDB_PACKET_SIZE) +
+			   ";QStartNoAckMode+;swbreak+;vContSupported+;binary-upload+"
+			   ";qXfer:features:read+;qXfer:libraries-svr4:read+"
+			   ";qXfer:memory-map:read+;qXfer:auxv:read+"
+			   ";qXfer:exec-file:read+";
+	}
+	if (packet == "QStartNoAckMode")
+		return "OK";
+	if (packet.rfind("qXfer:", 0) == 0)
+		return handle_xfer(packet);
+	if (packet == "qC")
+		return "QC" + to_hex(debugger.m_tid);
+	if (packet == "qfThreadInfo") {
+		std::string reply{ "m" };
+		for (auto tid : threads())
+			reply += to_hex(tid) + ',';
+		reply.pop_back();
+		return reply;
+	}
+	if (packet == "qsThreadInfo")
+		return "l";
+	if (packet.rfind("qAttached", 0) == 0)
+		return debugger.m_attached ? "1" : "0";
+	if (packet == "qSymbol::")
+		return "OK";
+	return "";
+}
+
+std::string
+Gdb_Server::handle_xfer(const std::string& packet)
+{
+	// qXfer:object:read:annex:offset,length
+	std::istringstream fields{ packet };
+	std::string		   prefix, object, operation, annex, range;
+	std::getline(fields, prefix, ':');
+	std::getline(fields, object, ':');
+	std::getline(fields, operation, ':');
+	std::getline(fields, annex, ':');
+	std::getline(fields, range);
+	if (operation != "read")
+		return "";
+
+	if (object == "features") {
+		if (annex != "target.xml")
+			return "E00";
+		static const auto description = target_description();
+		return xfer_chunk(description, range);
+	}
+	// the documents below are read once per request and then served in
+	// chunks from the copy of the first one
+	if (range.rfind("0,", 0) == 0 || m_xfer_object != object) {
+		m_xfer_object = object;
+		if (object == "libraries-svr4") {
+			m_xfer_document = libraries_xml();
+		} else if (object == "memory-map") {
+			m_xfer_document = memory_map_xml();
+		} else if (object == "auxv") {
+			std::ifstream auxv{ "/proc/" + std::to_string(m_debugger.m_pid) +
+									"/auxv",
+								std::ios::binary };
+			m_xfer_document.assign(std::istreambuf_iterator<char>{ auxv }, {});
+		} else if (object == "exec-file") {
+			m_xfer_document = executable_of(m_debugger.m_pid);
+		} else {
+			m_xfer_object.clear();
+			return "";
+		}
+	}
+	return xfer_chunk(m_xfer_document, range);
+}
+
+std::string
+Gdb_Server::handle_vcont(const std::string& actions)
+{
+	// action[:thread-id] separated by ';'. Threads without an action stay
+	// stopped, an action without thread applies to all the others
+	pid_t			 step_tid{ 0 };
+	pid_t			 continue_tid{ 0 };
+	int				 signal{ 0 };
+	bool			 others_continue{ false };
+	std::istringstream in{ actions };
+	std::string		 action;
+	while (std::getline(in, action, ';')) {
+		if (action.empty())
+			continue;
+		auto colon = action.find(':');
+		long tid   = colon == std::string::npos
+						 ? -1
+						 : parse_thread_id(action.substr(colon + 1));
+		auto kind  = action[0];
+		auto action_signal =
+			kind == 'C' || kind == 'S'
+				? from_gdb_signal(std::stoi(action.substr(1, 2), 0, 16))
+				: 0;
+		if (tid <= 0)
+			tid = m_debugger.m_tid;
+
+		if ((kind == 's' || kind == 'S') && step_tid == 0) {
+			step_tid = tid;
+			signal	 = action_signal;
+		} else if (kind == 'c' || kind == 'C') {
+			if (colon == std::string::npos) {
+				others_continue = true;
+			} else if (continue_tid == 0) {
+				continue_tid = tid;
+				if (step_tid == 0)
+					signal = action_signal;
+			}
+		}
+	}
+
+	auto current = threads();
+	auto target	 = step_tid != 0 ? step_tid : continue_tid;
+	if (target != 0 &&
+		std::find(current.begin(), current.end(), target) != current.end())
+		m_debugger.m_tid = target;
+	if (step_tid != 0)
+		return resume(PTRACE_SINGLESTEP, signal, !others_continue);
+	return resume(PTRACE_CONT, signal, false);
+}
+
+std::string
+Gdb_Server::resume(const __ptrace_request request,
+				   const int			  signal,
+				   const bool			  step_only)
+{
+	if (m_exited)
+		return m_stop_reply;
+
+	auto& debugger = m_debugger;
+	// the client does not know about our breakpoints, step over them first
+	auto pc = debugger.get_pc();
+	if (debugger.m_internal_breakpoints.count(pc)) {
+		debugger.step_over_breakpoint();
+		if (request == PTRACE_SINGLESTEP)
+			return update_stop_reply(false);
+	}
+
+	if (!step_only)
+		debugger.resume_other_threads();
+	debugger.resume(request, signal);
+	wait_for_debugee();
+	auto reported = debugger.wait_for_stop();
+	auto status	  = debugger.m_wait_status;
+	if (WIFEXITED(status) || WIFSIGNALED(status)) {
+		m_exited	 = true;
+		m_stop_reply = WIFEXITED(status)
+						   ? 'W' + to_hex(WEXITSTATUS(status), 2)
+						   : 'X' + to_hex(to_gdb_signal(WTERMSIG(status)), 2);
+		return m_stop_reply;
+	}
+	debugger.stop_other_threads();
+
+	// the first stop after the dynamic loader ran, as continue does
+	if (debugger.m_r_debug == 0)
+		debugger.update_libraries();
+	return update_stop_reply(reported);
+}
+
+void
+Gdb_Server::wait_for_debugee()
+{
+	auto& debugger = m_debugger;
+	while (true) {
+		// look for a pending stop without reaping it, wait_for_stop() does
+		siginfo_t info{};
+		waitid(debugger.waits_for_any() ? P_ALL : P_PID,
+			   debugger.m_pid,
+			   &info,
+			   WEXITED | WSTOPPED | WNOHANG | WNOWAIT | __WALL);
+		if (info.si_pid != 0)
+			return;
+
+		// the client went away, stop the debugee to let it go
+		if (!receive(10)) {
+			kill(debugger.m_pid, SIGSTOP);
+			return;
+		}
+		// ^C of the client
+		if (m_input.find('\x03') != std::string::npos) {
+			m_input.erase(std::remove(m_input.begin(), m_input.end(), '\x03'),
+						  m_input.end());
+			kill(debugger.m_pid, SIGINT);
+			return;
+		}
+	}
+}
+
+std::string
+Gdb_Server::update_stop_reply(const bool reported)
+{
+	auto& debugger = m_debugger;
+	auto  info	   = debugger.get_signal_info();
+	auto  signal   = info.si_signo != 0 ? info.si_signo : SIGTRAP;
+
+	std::string reason;
+	if (reported && signal == SIGTRAP &&
+		(info.si_code == SI_KERNEL || info.si_code == TRAP_BRKPT)) {
+		auto address = debugger.get_pc() - 1;
+		if (debugger.m_breakpoints.count(address)) {
+			if (m_swbreak) {
+				debugger.set_pc(address);
+				reason = "swbreak:;";
+			}
+			// our handler of a breakpoint the client placed on it too
+			auto handler = m_shadowed.find(address);
+			if (handler != m_shadowed.end())
+				handler->second();
+		}
+	}
+	m_stop_reply = 'T' + to_hex(to_gdb_signal(signal), 2) + reason +
+				   "thread:" + to_hex(debugger.m_tid) + ';';
+	return m_stop_reply;
+}
+
+std::vector<uint8_t>
+Gdb_Server::read_registers()
+{
+	auto			   tid = m_debugger.m_tid;
+	user_regs_struct   regs;
+	user_fpregs_struct fpregs;
+	if (ptrace(PTRACE_GETREGS, tid, nullptr, &regs) < 0 ||
+		ptrace(PTRACE_GETFPREGS, tid, nullptr, &fpregs) < 0)
+		return {};
+
+	std::vector<uint8_t> data;
+	auto				 put = [&](const void* value, const std::size_t size) {
+		auto bytes = static_cast<const uint8_t*>(value);
+		data.insert(data.end(), bytes, bytes + size);
+	};
+	for (auto value : { regs.rax,
+						regs.rbx,
+						regs.rcx,
+						regs.rdx,
+						regs.rsi,
+						regs.rdi,
+						regs.rbp,
+						regs.rsp,
+						regs.r8,
+						regs.r9,
+						regs.r10,
+						regs.r11,
+						regs.r12,
+						regs.r13,
+						regs.r14,
+						regs.r15,
+						regs.rip })
+		put(&value, 8);
+	for (auto value : { regs.eflags,
+						regs.cs,
+						regs.ss,
+						regs.ds,
+						regs.es,
+						regs.fs,
+						regs.gs }) {
+		uint32_t value32 = value;
+		put(&value32, 4);
+	}
+	// st0-7 are 10 bytes out of 16 in the fxsave area
+	for (int i = 0; i < 8; ++i)
+		put(&fpregs.st_space[i * 4], 10);
+	for (uint32_t value : { uint32_t{ fpregs.cwd },
+							uint32_t{ fpregs.swd },
+							full_tag_word(fpregs),
+							uint32_t((fpregs.rip >> 32) & 0xffff),
+							uint32_t(fpregs.rip),
+							uint32_t((fpregs.rdp >> 32) & 0xffff),
+							uint32_t(fpregs.rdp),
+							uint32_t{ fpregs.fop } })
+		put(&value, 4);
+	put(fpregs.xmm_space, sizeof(fpregs.xmm_space));
+	put(&fpregs.mxcsr, 4);
+	for (auto value : { regs.orig_rax, regs.fs_base, regs.gs_base })
+		put(&value, 8);
+	return data;
+}
+
+bool
+Gdb_Server::write_registers(const std::vector<uint8_t>& data)
+{
+	std::size_t size{ 0 };
+	for (auto& reg : gdb_registers())
+		size += reg.size;
+	if (data.size() != size)
+		return false;
+
+	auto			   tid = m_debugger.m_tid;
+	user_regs_struct   regs;
+	user_fpregs_struct fpregs;
+	if (ptrace(PTRACE_GETREGS, tid, nullptr, &regs) < 0 ||
+		ptrace(PTRACE_GETFPREGS, tid, nullptr, &fpregs) < 0)
+		return false;
+
+	std::size_t offset{ 0 };
+	auto		get = [&](void* value, const std::size_t size) {
+		   std::memcpy(value, data.data() + offset, size);
+		   offset += size;
+	};
+	for (auto value : { &regs.rax,
+						&regs.rbx,
+						&regs.rcx,
+						&regs.rdx,
+						&regs.rsi,
+						&regs.rdi,
+						&regs.rbp,
+						&regs.rsp,
+						&regs.r8,
+						&regs.r9,
+						&regs.r10,
+						&regs.r11,
+						&regs.r12,
+						&regs.r13,
+						&regs.r14,
+						&regs.r15,
+						&regs.rip })
+		get(value, 8);
+	for (auto value : { &regs.eflags,
+						&regs.cs,
+						&regs.ss,
+						&regs.ds,
+						&regs.es,
+						&regs.fs,
+						&regs.gs }) {
+		uint32_t value32;
+		get(&value32, 4);
+		*value = value32;
+	}
+	for (int i = 0; i < 8; ++i)
+		get(&fpregs.st_space[i * 4], 10);
+	uint32_t fpu[8];
+	get(fpu, sizeof(fpu));
+	fpregs.cwd = fpu[0];
+	fpregs.swd = fpu[1];
+	fpregs.ftw = 0;
+	for (unsigned reg = 0; reg < 8; ++reg) {
+		if (((fpu[2] >> (2 * reg)) & 3) != 3)
+			fpregs.ftw |= 1 << reg;
+	}
+	fpregs.rip = (std::uint64_t{ fpu[3] } << 32) | fpu[4];
+	fpregs.rdp = (std::uint64_t{ fpu[5] } << 32) | fpu[6];
+	fpregs.fop = fpu[7];
+	get(fpregs.xmm_space, sizeof(fpregs.xmm_space));
+	get(&fpregs.mxcsr, 4);
+	for (auto value : { &regs.orig_rax, &regs.fs_base, &regs.gs_base })
+		get(value, 8);
+
+	return ptrace(PTRACE_SETREGS, tid, nullptr, &regs) == 0 &&
+		   ptrace(PTRACE_SETFPREGS, tid, nullptr, &fpregs) == 0;
+}
+
+std::string
+Gdb_Server::target_description() const
+{
+	std::ostringstream xml;
+	xml << "<?xml version=\"1.0\"?>\n"
+		<< "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+		<< "<target version=\"1.0\">\n"
+		<< "<architecture>i386:x86-64</architecture>\n"
+		<< "<osabi>GNU/Linux</osabi>\n";
+	std::string feature;
+	for (auto& reg : gdb_registers()) {
+		if (reg.feature != feature) {
+			if (!feature.empty())
+				xml << "</feature>\n";
+			feature = reg.feature;
+			xml << "<feature name=\"" << feature << "\">\n";
+			// the xmm registers' union type, as gdb defines it
+			if (feature == "org.gnu.gdb.i386.sse") {
+				xml << "<vector id=\"v4f\" type=\"ieee_single\" count=\"4\"/>\n"
+					<< "<vector id=\"v2d\" type=\"ieee_double\" count=\"2\"/>\n"
+					<< "<vector id=\"v16i8\" type=\"int8\" count=\"16\"/>\n"
+					<< "<vector id=\"v8i16\" type=\"int16\" count=\"8\"/>\n"
+					<< "<vector id=\"v4i32\" type=\"int32\" count=\"4\"/>\n"
+					<< "<vector id=\"v2i64\" type=\"int64\" count=\"2\"/>\n"
+					<< "<union id=\"vec128\">\n"
+					<< "<field name=\"v4_float\" type=\"v4f\"/>\n"
+					<< "<field name=\"v2_double\" type=\"v2d\"/>\n"
+					<< "<field name=\"v16_int8\" type=\"v16i8\"/>\n"
+					<< "<field name=\"v8_int16\" type=\"v8i16\"/>\n"
+					<< "<field name=\"v4_int32\" type=\"v4i32\"/>\n"
+					<< "<field name=\"v2_int64\" type=\"v2i64\"/>\n"
+					<< "<field name=\"uint128\" type=\"uint128\"/>\n"
+					<< "</union>\n";
+			}
+		}
+		xml << "<reg name=\"" << reg.name << "\" bitsize=\"" << reg.size * 8
+			<< "\" type=\"" << reg.type << "\"/>\n";
+	}
+	xml << "</feature>\n</target>\n";
+	return xml.str();
+}
+
+bool
+Gdb_Server::read_memory(const std::uintptr_t  address,
+						std::vector<uint8_t>& data,
+						const std::size_t	  length)
+{
+	auto pid = m_debugger.m_pid;
+	data.resize(length);
+	if (length == 0)
+		return true;
+	if (!read_memory_block(pid, address, data.data(), length)) {
+		// a partial reply up to the first unreadable page
+		std::size_t done{ 0 };
+		while (done < length) {
+			auto page_left = 4096 - (address + done) % 4096;
+			auto size	   = std::min(length - done, page_left);
+			if (!read_memory_block(
+					pid, address + done, data.data() + done, size))
+				break;
+			done += size;
+		}
+		data.resize(done);
+		if (done == 0)
+			return false;
+	}
+
+	// the client sees the original code, not our INT3s
+	for (auto& bp : m_debugger.m_breakpoints) {
+		auto bp_address = static_cast<std::uintptr_t>(bp.get_address());
+		if (bp.is_enabled() && bp_address >= address &&
+			bp_address < address + data.size())
+			data[bp_address - address] = bp.get_saved_data();
+	}
+	return true;
+}
+
+bool
+Gdb_Server::write_memory(const std::uintptr_t		 address,
+						 const std::vector<uint8_t>& data)
+{
+	auto contents = data;
+	for (auto& bp : m_debugger.m_breakpoints) {
+		auto bp_address = static_cast<std::uintptr_t>(bp.get_address());
+		if (bp.is_enabled() && bp_address >= address &&
+			bp_address < address + contents.size()) {
+			bp.set_enabled(contents[bp_address - address]);
+			contents[bp_address - address] = 0xcc;
+		}
+	}
+	return write_memory_block(
+		m_debugger.m_pid, address, contents.data(), contents.size());
+}
+
+std::string
+Gdb_Server::libraries_xml()
+{
+	auto& debugger = m_debugger;
+	if (debugger.m_r_debug == 0)
+		debugger.update_libraries();
+
+	r_debug rendezvous{};
+	if (debugger.m_r_debug == 0 ||
+		!read_memory_block(debugger.m_pid,
+						   debugger.m_r_debug,
+						   &rendezvous,
+						   sizeof(rendezvous)))
+		return "<library-list-svr4 version=\"1.0\"/>";
+
+	// the head of the list is the main program
+	std::ostringstream xml;
+	xml << std::hex << "<library-list-svr4 version=\"1.0\" main-lm=\"0x"
+		<< reinterpret_cast<std::uintptr_t>(rendezvous.r_map) << "\">\n";
+	for (auto& module : debugger.m_modules.modules()) {
+		xml << "<library name=\"" << xml_escape(module.path) << "\" lm=\"0x"
+			<< module.link_map << "\" l_addr=\"0x" << module.base
+			<< "\" l_ld=\"0x" << module.dynamic << "\"/>\n";
+	}
+	xml << "</library-list-svr4>\n";
+	return xml.str();
+}
+
+std::string
+Gdb_Server::memory_map_xml()
+{
+	auto& memory_map = m_debugger.m_memory_map;
+	memory_map.refresh(m_debugger.m_pid);
+
+	// the client caches the map and refuses accesses outside of it, so the
+	// holes between the regions are listed too: memory mapped later (heap,
+	// thread stacks) stays reachable
+	std::ostringstream xml;
+	xml << std::hex << "<?xml version=\"1.0\"?>\n"
+		<< "<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map "
+		   "V1.0//EN\" \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n"
+		<< "<memory-map>\n";
+	std::uintptr_t end{ 0 };
+	for (const auto& region : memory_map.regions()) {
+		if (end != 0 && region.start > end) {
+			xml << "<memory type=\"ram\" start=\"0x" << end
+				<< "\" length=\"0x" << region.start - end << "\"/>\n";
+		}
+		xml << "<memory type=\"ram\" start=\"0x" << region.start
+			<< "\" length=\"0x" << region.end - region.start << "\"/>\n";
+		end = region.end;
+	}
+	xml << "</memory-map>\n";
+	return xml.str();
+}
+
+};
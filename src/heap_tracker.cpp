@@ -0,0 +1,197 @@
+#include <heap_tracker.hpp>
+
+#include <algorithm>
+
+namespace mini_debugger {
+
+static constexpr std::uintptr_t EMPTY_SLOT{ 0 };
+static constexpr std::uintptr_t ERASED_SLOT{ 1 };
+static constexpr std::size_t	MIN_CAPACITY{ 1024 };
+
+// Fibonacci hashing: heap pointers are aligned and close to each other, the
+// top bits of the product mix all of their bits. `capacity` is a power of 2
+static std::size_t
+hash_address(const std::uintptr_t address, const std::size_t capacity)
+{
+	unsigned shift{ 64 };
+	for (auto n = capacity; n > 1; n >>= 1)
+		--shift;
+	return (static_cast<uint64_t>(address) * 0x9e3779b97f4a7c15ull) >> shift;
+}
+
+static uint64_t
+hash_frames(const std::vector<std::uintptr_t>& frames)
+{
+	// FNV-1a over the addresses
+	uint64_t hash{ 0xcbf29ce484222325ull };
+	for (auto frame : frames) {
+		hash = (hash ^ frame) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+Heap_Tracker::Heap_Tracker()
+	: m_stack_slots(MIN_CAPACITY, 0)
+	, m_addresses(MIN_CAPACITY, EMPTY_SLOT)
+	, m_allocations(MIN_CAPACITY)
+	, m_live_count{ 0 }
+	, m_live_bytes{ 0 }
+	, m_tombstones{ 0 }
+{
+}
+
+uint32_t
+Heap_Tracker::intern_stack(const std::vector<std::uintptr_t>& frames)
+{
+	auto hash = hash_frames(frames);
+	auto mask = m_stack_slots.size() - 1;
+	for (auto slot = hash & mask;; slot = (slot + 1) & mask) {
+		auto id = m_stack_slots[slot];
+		if (id == 0)
+			break;
+		const auto& stack = m_stacks[id - 1];
+		if (stack.hash == hash && stack.length == frames.size() &&
+			std::equal(frames.begin(),
+					   frames.end(),
+					   m_frames.begin() + stack.offset))
+			return id - 1;
+	}
+
+	uint32_t id = m_stacks.size();
+	m_stacks.push_back(Stack{ hash,
+							  static_cast<uint32_t>(m_frames.size()),
+							  static_cast<uint32_t>(frames.size()),
+							  0,
+							  0 });
+	m_frames.insert(m_frames.end(), frames.begin(), frames.end());
+	if (m_stacks.size() * 4 > m_stack_slots.size() * 3) {
+		rehash_stacks(m_stack_slots.size() * 2);
+	} else {
+		auto slot = hash & mask;
+		while (m_stack_slots[slot] != 0)
+			slot = (slot + 1) & mask;
+		m_stack_slots[slot] = id + 1;
+	}
+	return id;
+}
+
+std::vector<std::uintptr_t>
+Heap_Tracker::frames(const uint32_t id) const
+{
+	const auto& stack = m_stacks.at(id);
+	return { m_frames.begin() + stack.offset,
+			 m_frames.begin() + stack.offset + stack.length };
+}
+
+void
+Heap_Tracker::rehash_stacks(const std::size_t capacity)
+{
+	m_stack_slots.assign(capacity, 0);
+	for (uint32_t id = 0; id < m_stacks.size(); ++id) {
+		auto slot = m_stacks[id].hash & (capacity - 1);
+		while (m_stack_slots[slot] != 0)
+			slot = (slot + 1) & (capacity - 1);
+		m_stack_slots[slot] = id + 1;
+	}
+}
+
+std::size_t
+Heap_Tracker::find_slot(const std::uintptr_t address) const
+{
+	// slot of `address`, or the empty slot ending its probe sequence
+	auto mask = m_addresses.size() - 1;
+	auto slot = hash_address(address, m_addresses.size());
+	while (m_addresses[slot] != address && m_addresses[slot] != EMPTY_SLOT)
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+void
+Heap_Tracker::allocated(const std::uintptr_t address,
+						const std::size_t	 size,
+						const uint32_t		 stack)
+{
+	// an address handed out again was freed without us seeing it
+	freed(address);
+
+	if ((m_live_count + m_tombstones + 1) * 4 > m_addresses.size() * 3) {
+		// grow only if the live entries need it, else just drop tombstones
+		auto capacity = m_addresses.size();
+		if ((m_live_count + 1) * 2 > capacity)
+			capacity *= 2;
+		rehash_allocations(capacity);
+	}
+	auto slot			= find_slot(address);
+	m_addresses[slot]	= address;
+	m_allocations[slot] = Allocation{ size, stack };
+	++m_live_count;
+	m_live_bytes += size;
+	m_stacks[stack].total_bytes += size;
+	++m_stacks[stack].total_count;
+}
+
+bool
+Heap_Tracker::freed(const std::uintptr_t address)
+{
+	auto slot = find_slot(address);
+	if (m_addresses[slot] != address)
+		return false;
+	m_addresses[slot] = ERASED_SLOT;
+	--m_live_count;
+	m_live_bytes -= m_allocations[slot].size;
+	++m_tombstones;
+	return true;
+}
+
+void
+Heap_Tracker::rehash_allocations(const std::size_t capacity)
+{
+	auto addresses	 = std::move(m_addresses);
+	auto allocations = std::move(m_allocations);
+	m_addresses.assign(capacity, EMPTY_SLOT);
+	m_allocations.assign(capacity, Allocation{});
+	m_tombstones = 0;
+	for (std::size_t i = 0; i < addresses.size(); ++i) {
+		if (addresses[i] == EMPTY_SLOT || addresses[i] == ERASED_SLOT)
+			continue;
+		auto slot			= find_slot(addresses[i]);
+		m_addresses[slot]	= addresses[i];
+		m_allocations[slot] = allocations[i];
+	}
+}
+
+std::size_t
+Heap_Tracker::live_count() const
+{
+	return m_live_count;
+}
+
+std::size_t
+Heap_Tracker::live_bytes() const
+{
+	return m_live_bytes;
+}
+
+std::vector<Heap_Site>
+Heap_Tracker::sites() const
+{
+	std::vector<Heap_Site> sites;
+	sites.reserve(m_stacks.size());
+	for (uint32_t id = 0; id < m_stacks.size(); ++id) {
+		sites.push_back(Heap_Site{ id,
+								   0,
+								   0,
+								   m_stacks[id].total_bytes,
+								   m_stacks[id].total_count });
+	}
+	for (std::size_t i = 0; i < m_addresses.size(); ++i) {
+		if (m_addresses[i] == EMPTY_SLOT || m_addresses[i] == ERASED_SLOT)
+			continue;
+		auto& site = sites[m_allocations[i].stack];
+		site.live_bytes += m_allocations[i].size;
+		++site.live_count;
+	}
+	return sites;
+}
+
+};
@@ -0,0 +1,124 @@
+#include <inferior_syscall.hpp>
+
+#include <signal.h>		 // SIGCHLD
+#include <sys/ptrace.h>	 // ptrace
+#include <sys/syscall.h> // SYS_fork, SYS_tkill
+#include <sys/user.h>	 // user_regs_struct
+#include <sys/wait.h>	 // waitpid
+#include <unistd.h>		 // syscall
+
+#include <vector>
+
+namespace mini_debugger {
+
+// single step `tid` and wait for the stop which is not a signal delivery. A
+// signal arriving first would be delivered instead of running the
+// instruction: it is held back in `signals`, except SIGCHLD (the copies of
+// a checkpoint we killed) which is dropped
+static void
+single_step(const pid_t tid, int& wait_status, std::vector<int>& signals)
+{
+	while (true) {
+		ptrace(PTRACE_SINGLESTEP, tid, nullptr, nullptr);
+		if (waitpid(tid, &wait_status, __WALL) != tid ||
+			!WIFSTOPPED(wait_status) || wait_status >> 16 != 0 ||
+			WSTOPSIG(wait_status) == SIGTRAP)
+			return;
+		if (WSTOPSIG(wait_status) != SIGCHLD)
+			signals.push_back(WSTOPSIG(wait_status));
+	}
+}
+
+// send the signals held back by single_step() again, the thread gets them
+// once it runs
+static void
+requeue_signals(const pid_t tid, const std::vector<int>& signals)
+{
+	for (auto signal : signals) {
+		syscall(SYS_tkill, tid, signal);
+	}
+}
+
+long
+inject_syscall(const pid_t				   tid,
+			   const long				   number,
+			   const std::array<long, 6>& args)
+{
+	user_regs_struct saved_regs;
+	if (ptrace(PTRACE_GETREGS, tid, nullptr, &saved_regs) < 0)
+		return -1;
+
+	// temporarily replace the instruction at pc by `syscall` (0f 05)
+	auto pc			= saved_regs.rip;
+	auto saved_code = ptrace(PTRACE_PEEKTEXT, tid, pc, nullptr);
+	ptrace(PTRACE_POKETEXT, tid, pc, (saved_code & ~0xffffl) | 0x050f);
+
+	auto regs = saved_regs;
+	regs.rax  = number;
+	regs.rdi  = args[0];
+	regs.rsi  = args[1];
+	regs.rdx  = args[2];
+	regs.r10  = args[3];
+	regs.r8	  = args[4];
+	regs.r9	  = args[5];
+	// the thread may be stopped inside an interrupted system call, make sure
+	// the kernel does not try to restart it instead of running ours
+	regs.orig_rax = -1;
+	ptrace(PTRACE_SETREGS, tid, nullptr, &regs);
+
+	int				 wait_status{};
+	std::vector<int> signals;
+	single_step(tid, wait_status, signals);
+	ptrace(PTRACE_GETREGS, tid, nullptr, &regs);
+
+	ptrace(PTRACE_POKETEXT, tid, pc, saved_code);
+	ptrace(PTRACE_SETREGS, tid, nullptr, &saved_regs);
+	requeue_signals(tid, signals);
+	return static_cast<long>(regs.rax);
+}
+
+pid_t
+inject_fork(const pid_t tid)
+{
+	user_regs_struct saved_regs;
+	if (ptrace(PTRACE_GETREGS, tid, nullptr, &saved_regs) < 0)
+		return -1;
+
+	auto pc			= saved_regs.rip;
+	auto saved_code = ptrace(PTRACE_PEEKTEXT, tid, pc, nullptr);
+	ptrace(PTRACE_POKETEXT, tid, pc, (saved_code & ~0xffffl) | 0x050f);
+
+	auto regs	  = saved_regs;
+	regs.rax	  = SYS_fork;
+	regs.orig_rax = -1;
+	ptrace(PTRACE_SETREGS, tid, nullptr, &regs);
+
+	// the fork event stop comes before the end of the single step
+	pid_t			 child{ 0 };
+	int				 wait_status{};
+	std::vector<int> signals;
+	single_step(tid, wait_status, signals);
+	if (WIFSTOPPED(wait_status) && wait_status >> 16 == PTRACE_EVENT_FORK) {
+		unsigned long message{};
+		ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &message);
+		child = static_cast<pid_t>(message);
+		single_step(tid, wait_status, signals);
+	}
+	ptrace(PTRACE_GETREGS, tid, nullptr, &regs);
+
+	ptrace(PTRACE_POKETEXT, tid, pc, saved_code);
+	ptrace(PTRACE_SETREGS, tid, nullptr, &saved_regs);
+	requeue_signals(tid, signals);
+	if (child <= 0)
+		return static_cast<long>(regs.rax) < 0 ? static_cast<long>(regs.rax)
+											   : -1;
+
+	// the child starts with a SIGSTOP, right after our syscall instruction:
+	// give it the code and registers of the parent
+	waitpid(child, &wait_status, __WALL);
+	ptrace(PTRACE_POKETEXT, child, pc, saved_code);
+	ptrace(PTRACE_SETREGS, child, nullptr, &saved_regs);
+	return child;
+}
+
+};
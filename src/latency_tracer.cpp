@@ -0,0 +1,222 @@
+#include <latency_tracer.hpp>
+
+#include <signal.h>		// raise
+#include <sys/ptrace.h> // ptrace
+#include <sys/user.h>	// user_regs_struct
+#include <sys/wait.h>	// waitpid
+#include <unistd.h>		// fork, _exit
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+namespace mini_debugger {
+
+// 2^SUB_BUCKET_BITS linear buckets for each of the 64 powers of two
+static constexpr std::size_t BUCKET_COUNT{ 64 << 4 };
+// traps timed by measure_stop_cost()
+static constexpr int CALIBRATION_STOPS{ 2000 };
+
+Latency_Histogram::Latency_Histogram()
+	: m_buckets(BUCKET_COUNT, 0)
+	, m_count{ 0 }
+	, m_max{ 0 }
+{
+}
+
+std::size_t
+Latency_Histogram::bucket_of(const uint64_t nanoseconds)
+{
+	constexpr uint64_t SUB_BUCKETS{ 1 << SUB_BUCKET_BITS };
+	if (nanoseconds < SUB_BUCKETS)
+		return nanoseconds;
+	// the power of two, then the next SUB_BUCKET_BITS bits below it
+	unsigned exponent = 63 - __builtin_clzll(nanoseconds);
+	auto	 mantissa =
+		(nanoseconds >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + mantissa;
+}
+
+uint64_t
+Latency_Histogram::bucket_end(const std::size_t bucket)
+{
+	constexpr uint64_t SUB_BUCKETS{ 1 << SUB_BUCKET_BITS };
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	unsigned exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+	auto	 mantissa = bucket % SUB_BUCKETS;
+	auto	 width	  = uint64_t{ 1 } << (exponent - SUB_BUCKET_BITS);
+	return ((SUB_BUCKETS + mantissa) << (exponent - SUB_BUCKET_BITS)) +
+		   width - 1;
+}
+
+void
+Latency_Histogram::record(const uint64_t nanoseconds)
+{
+	++m_buckets[bucket_of(nanoseconds)];
+	++m_count;
+	m_max = std::max(m_max, nanoseconds);
+}
+
+uint64_t
+Latency_Histogram::percentile(const double percent) const
+{
+	auto rank = static_cast<std::size_t>(std::ceil(percent / 100 * m_count));
+	std::size_t seen{ 0 };
+	for (std::size_t bucket = 0; bucket < m_buckets.size(); ++bucket) {
+		seen += m_buckets[bucket];
+		if (seen >= std::max<std::size_t>(rank, 1))
+			return std::min(bucket_end(bucket), m_max);
+	}
+	return m_max;
+}
+
+uint64_t
+Latency_Histogram::max() const
+{
+	return m_max;
+}
+
+std::size_t
+Latency_Histogram::count() const
+{
+	return m_count;
+}
+
+Latency_Tracer::Latency_Tracer(const std::chrono::nanoseconds stop_cost)
+	: m_stop_cost{ stop_cost }
+	, m_abandoned{ 0 }
+{
+}
+
+std::chrono::nanoseconds
+Latency_Tracer::measure_stop_cost()
+{
+	auto child = fork();
+	if (child < 0)
+		return std::chrono::nanoseconds{ 0 };
+	if (child == 0) {
+		ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+		raise(SIGSTOP);
+		for (int i = 0; i < CALIBRATION_STOPS; ++i) {
+			asm volatile("int3");
+		}
+		_exit(0);
+	}
+
+	// the work of a stop at an internal breakpoint: wait, read the
+	// registers, take the time and resume
+	int wait_status{};
+	waitpid(child, &wait_status, 0);
+	ptrace(PTRACE_CONT, child, nullptr, nullptr);
+	auto start = Clock::now();
+	for (int i = 0; i < CALIBRATION_STOPS; ++i) {
+		waitpid(child, &wait_status, 0);
+		if (!WIFSTOPPED(wait_status))
+			return std::chrono::nanoseconds{ 0 };
+		user_regs_struct regs;
+		ptrace(PTRACE_GETREGS, child, nullptr, &regs);
+		Clock::now();
+		ptrace(PTRACE_CONT, child, nullptr, nullptr);
+	}
+	auto end = Clock::now();
+	waitpid(child, &wait_status, 0);
+	return (end - start) / CALIBRATION_STOPS;
+}
+
+std::size_t
+Latency_Tracer::add_function(const std::string& name)
+{
+	auto function = std::find_if(m_functions.begin(),
+								 m_functions.end(),
+								 [&name](auto&& function) {
+									 return function.name == name;
+								 });
+	if (function != m_functions.end())
+		return function - m_functions.begin();
+	m_functions.push_back(Function{ name, Latency_Histogram{} });
+	return m_functions.size() - 1;
+}
+
+std::vector<std::string>
+Latency_Tracer::functions() const
+{
+	std::vector<std::string> names;
+	for (const auto& function : m_functions) {
+		names.push_back(function.name);
+	}
+	return names;
+}
+
+void
+Latency_Tracer::count_stop(const pid_t tid)
+{
+	++m_threads[tid].stops;
+}
+
+void
+Latency_Tracer::entered(const pid_t			tid,
+						const std::size_t	function,
+						const std::intptr_t stack_pointer)
+{
+	auto& thread = m_threads[tid];
+	thread.shadow_stack.push_back(
+		Frame{ function, stack_pointer, Clock::now(), thread.stops });
+}
+
+void
+Latency_Tracer::returned(const pid_t tid, const std::intptr_t stack_pointer)
+{
+	auto now	= Clock::now();
+	auto thread = m_threads.find(tid);
+	if (thread == m_threads.end())
+		return;
+	auto& stack = thread->second.shadow_stack;
+	// the return popped the return address: calls with a lower stack
+	// pointer were left without returning
+	while (!stack.empty() && stack.back().stack_pointer + 8 < stack_pointer) {
+		stack.pop_back();
+		++m_abandoned;
+	}
+	if (stack.empty() || stack.back().stack_pointer + 8 != stack_pointer)
+		return;
+
+	auto frame = stack.back();
+	stack.pop_back();
+	// the stops of the thread during the call (the step over the entry
+	// breakpoint, this return, nested traced calls) were not its own time
+	auto overhead =
+		m_stop_cost * static_cast<long>(thread->second.stops - frame.stops);
+	auto duration	 = std::max<Clock::duration>(now - frame.start, overhead);
+	auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		duration - overhead);
+	m_functions[frame.function].histogram.record(nanoseconds.count());
+}
+
+void
+Latency_Tracer::print_report(std::ostream& out) const
+{
+	out << std::dec << "Overhead of a stop: " << m_stop_cost.count()
+		<< " ns, taken out of each call\n"
+		<< std::left << std::setw(32) << "Function" << std::right
+		<< std::setw(10) << "Calls" << std::setw(14) << "p50 (ns)"
+		<< std::setw(14) << "p99 (ns)" << std::setw(14) << "max (ns)" << '\n';
+	for (const auto& function : m_functions) {
+		const auto& histogram = function.histogram;
+		out << std::left << std::setw(32) << function.name << std::right
+			<< std::setw(10) << histogram.count() << std::setw(14)
+			<< histogram.percentile(50) << std::setw(14)
+			<< histogram.percentile(99) << std::setw(14) << histogram.max()
+			<< '\n';
+	}
+	std::size_t running{ 0 };
+	for (const auto& [tid, thread] : m_threads) {
+		running += thread.shadow_stack.size();
+	}
+	if (running != 0 || m_abandoned != 0) {
+		out << running << " calls still running, " << m_abandoned
+			<< " left without returning\n";
+	}
+}
+
+};
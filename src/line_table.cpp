@@ -0,0 +1,151 @@
+#include <line_table.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+namespace mini_debugger {
+
+Line_Table::Line_Table(const dwarf::line_table& table,
+					   std::set<std::string>&	file_names)
+	: m_base{ 0 }
+{
+	struct Row
+	{
+		std::uintptr_t address;
+		uint32_t	   line;
+		uint32_t	   file_and_flags;
+	};
+
+	// decode the whole program once. Sequences at address 0 or at the
+	// tombstone (-1) belong to functions the linker discarded
+	std::vector<Row>				rows;
+	std::vector<Row>				sequence;
+	std::map<const void*, uint32_t> file_indices;
+	for (const auto& entry : table) {
+		auto file = file_indices.find(entry.file);
+		if (file == file_indices.end()) {
+			auto& name = *file_names.insert(entry.file->path).first;
+			file	   = file_indices.emplace(entry.file, m_files.size()).first;
+			m_files.emplace_back(name);
+		}
+		uint32_t flags = (entry.is_stmt ? IS_STMT : 0) |
+						 (entry.end_sequence ? END_SEQUENCE : 0);
+		sequence.push_back(Row{ entry.address,
+								entry.line,
+								file->second << FLAG_BITS | flags });
+		if (!entry.end_sequence)
+			continue;
+
+		auto start = sequence.front().address;
+		if (start != 0 && start != std::numeric_limits<dwarf::taddr>::max())
+			rows.insert(rows.end(), sequence.begin(), sequence.end());
+		sequence.clear();
+	}
+	if (rows.empty())
+		return;
+
+	// an end of sequence sorts before a sequence starting at its address,
+	// so the last row at or below a pc is the one covering it
+	std::stable_sort(rows.begin(), rows.end(), [](auto&& a, auto&& b) {
+		if (a.address != b.address)
+			return a.address < b.address;
+		return (a.file_and_flags & END_SEQUENCE) >
+			   (b.file_and_flags & END_SEQUENCE);
+	});
+	m_base = rows.front().address;
+	if (rows.back().address - m_base > std::numeric_limits<uint32_t>::max())
+		throw std::out_of_range{ "Line table spans more than 4GB" };
+
+	m_address_deltas.reserve(rows.size());
+	m_lines.reserve(rows.size());
+	m_files_and_flags.reserve(rows.size());
+	for (const auto& row : rows) {
+		m_address_deltas.emplace_back(row.address - m_base);
+		m_lines.emplace_back(row.line);
+		m_files_and_flags.emplace_back(row.file_and_flags);
+	}
+
+	// reverse index, stable so rows of a line stay in address order
+	for (uint32_t row = 0; row < m_lines.size(); ++row) {
+		auto flags = m_files_and_flags[row];
+		if (flags & IS_STMT && !(flags & END_SEQUENCE))
+			m_line_rows.emplace_back(row);
+	}
+	std::stable_sort(m_line_rows.begin(),
+					 m_line_rows.end(),
+					 [this](uint32_t a, uint32_t b) {
+						 return m_lines[a] < m_lines[b];
+					 });
+}
+
+std::size_t
+Line_Table::find_address(const std::uintptr_t address) const
+{
+	if (m_address_deltas.empty() || address < m_base ||
+		address - m_base > std::numeric_limits<uint32_t>::max())
+		return npos;
+
+	// branchless binary search for the last row at or below `address`: the
+	// loop only depends on the size, the comparison compiles to a cmov
+	auto		key	  = static_cast<uint32_t>(address - m_base);
+	auto		first = m_address_deltas.data();
+	std::size_t count = m_address_deltas.size();
+	while (count > 1) {
+		auto half = count / 2;
+		first	  = first[half] <= key ? first + half : first;
+		count -= half;
+	}
+	std::size_t row = first - m_address_deltas.data();
+
+	// past the end of its sequence, or past the last instruction
+	if (m_files_and_flags[row] & END_SEQUENCE)
+		return npos;
+	return row;
+}
+
+std::vector<std::size_t>
+Line_Table::find_line(const unsigned line) const
+{
+	auto first = std::lower_bound(
+		m_line_rows.begin(),
+		m_line_rows.end(),
+		line,
+		[this](uint32_t row, unsigned value) { return m_lines[row] < value; });
+	auto last = std::upper_bound(
+		first,
+		m_line_rows.end(),
+		line,
+		[this](unsigned value, uint32_t row) { return value < m_lines[row]; });
+	return { first, last };
+}
+
+Line_Entry
+Line_Table::entry(const std::size_t row) const
+{
+	auto file_and_flags = m_files_and_flags.at(row);
+	return Line_Entry{ m_base + m_address_deltas[row],
+					   m_lines[row],
+					   m_files[file_and_flags >> FLAG_BITS],
+					   (file_and_flags & IS_STMT) != 0,
+					   (file_and_flags & END_SEQUENCE) != 0 };
+}
+
+std::size_t
+Line_Table::size() const
+{
+	return m_address_deltas.size();
+}
+
+std::size_t
+Line_Table::memory_size() const
+{
+	return sizeof(*this) +
+		   (m_address_deltas.capacity() + m_lines.capacity() +
+			m_files_and_flags.capacity() + m_line_rows.capacity()) *
+			   sizeof(uint32_t) +
+		   m_files.capacity() * sizeof(std::string_view);
+}
+
+};
@@ -1,48 +1,209 @@
 #include <debugger.hpp>
+#include <gdb_server.hpp>
+#include <symbolizer.hpp>
+#include <syscalls.hpp>
 
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <sys/personality.h>
-#include <sys/ptrace.h> // ptrace
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <sys/syscall.h> // SYS_execve
 #include <sys/wait.h>
-#include <unistd.h> // execl, fork
 
 using mini_debugger::Debugger;
+using mini_debugger::Gdb_Server;
 
-void
-execute_debugee(const std::string& program)
+// a number of bytes with an optional K, M or G suffix
+std::optional<std::size_t>
+parse_size(const std::string& text)
 {
-	if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0) {
-		std::cerr << "Error in ptrace\n";
-		return;
+	std::size_t end{ 0 };
+	std::size_t size{ 0 };
+	try {
+		size = std::stoull(text, &end);
+	} catch (std::exception&) {
+		return std::nullopt;
 	}
-	execl(program.c_str(), program.c_str(), nullptr);
+	auto suffix = text.substr(end);
+	if (suffix == "K" || suffix == "k")
+		return size << 10;
+	if (suffix == "M" || suffix == "m")
+		return size << 20;
+	if (suffix == "G" || suffix == "g")
+		return size << 30;
+	if (!suffix.empty())
+		return std::nullopt;
+	return size;
+}
+
+// comma separated system call names or numbers
+std::optional<std::vector<long>>
+parse_syscall_list(const std::string& list)
+{
+	std::vector<long>  numbers;
+	std::istringstream in{ list };
+	std::string		   name;
+	while (std::getline(in, name, ',')) {
+		auto number = mini_debugger::get_syscall_number(name);
+		if (!number && !name.empty() &&
+			name.find_first_not_of("0123456789") == std::string::npos)
+			number = std::stol(name);
+		if (!number) {
+			std::cerr << "Unknown syscall " << name << '\n';
+			return std::nullopt;
+		}
+		// the exec of the debugee itself runs under the filter, before the
+		// debugger could ask for seccomp stops
+		if (*number == SYS_execve || *number == SYS_execveat) {
+			std::cerr << name << " cannot be traced, ignored\n";
+			continue;
+		}
+		numbers.push_back(*number);
+	}
+	return numbers;
 }
 
 int
 main(int argc, char* argv[])
 {
-	if (argc < 2) {
+	pid_t					 attach_pid{ 0 };
+	std::vector<long>		 caught_syscalls;
+	std::vector<long>		 traced_syscalls;
+	// serve the process to a gdb client instead of the command line
+	std::string				 gdbserver_address;
+	// run the program once and write its line coverage there
+	std::string				 coverage_output;
+	std::vector<std::string> coverage_sources;
+	// resolve the addresses of a file (or stdin) in this binary and exit
+	std::string				 symbolize_program;
+
+	int arg{ 1 };
+	for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+		std::string_view option{ argv[arg] };
+		if (arg + 1 >= argc) {
+			std::cerr << "Missing value for " << option << '\n';
+			return -1;
+		}
+		if (option == "--pid") {
+			attach_pid = std::stoi(argv[++arg]);
+		} else if (option == "--gdbserver") {
+			gdbserver_address = argv[++arg];
+		} else if (option == "--symbolize") {
+			symbolize_program = argv[++arg];
+		} else if (option == "--coverage") {
+			coverage_output = argv[++arg];
+		} else if (option == "--coverage-sources") {
+			std::istringstream in{ argv[++arg] };
+			std::string		   source;
+			while (std::getline(in, source, ',')) {
+				coverage_sources.push_back(source);
+			}
+		} else if (option == "--max-debuginfo-mem") {
+			auto budget = parse_size(argv[++arg]);
+			if (!budget) {
+				std::cerr << "Invalid size " << argv[arg] << '\n';
+				return -1;
+			}
+			mini_debugger::set_debug_info_budget(*budget);
+		} else if (option == "--catch-syscall" || option == "--strace") {
+			auto numbers = parse_syscall_list(argv[++arg]);
+			if (!numbers) {
+				return -1;
+			}
+			auto& list =
+				option == "--strace" ? traced_syscalls : caught_syscalls;
+			list.insert(list.end(), numbers->begin(), numbers->end());
+		} else {
+			std::cerr << "Unknown option " << option << '\n';
+			return -1;
+		}
+	}
+
+	if (!symbolize_program.empty()) {
+		mini_debugger::Symbolizer symbolizer{ symbolize_program };
+		std::ios::sync_with_stdio(false);
+		if (arg < argc) {
+			std::ifstream addresses{ argv[arg] };
+			if (!addresses) {
+				std::cerr << "Cannot open " << argv[arg] << '\n';
+				return -1;
+			}
+			symbolizer.run(addresses, std::cout);
+		} else {
+			symbolizer.run(std::cin, std::cout);
+		}
+		return 0;
+	}
+
+	if (attach_pid != 0) {
+		if (!coverage_output.empty()) {
+			// the statements run before we attach would be missed
+			std::cerr << "Coverage needs a launched program\n";
+			return -1;
+		}
+		if (!caught_syscalls.empty() || !traced_syscalls.empty()) {
+			// a seccomp filter can only be installed by the process itself
+			std::cerr << "Syscall filters need a launched program\n";
+			return -1;
+		}
+		// attach to a running process instead of launching one
+		auto program = mini_debugger::executable_of(attach_pid);
+		if (program.empty()) {
+			std::cerr << "Cannot find the executable of process "
+					  << attach_pid << '\n';
+			return -1;
+		}
+
+		Debugger dbg{ program, attach_pid };
+		if (!dbg.attach()) {
+			return -1;
+		}
+		if (!gdbserver_address.empty()) {
+			Gdb_Server server{ dbg };
+			return server.serve(gdbserver_address) ? 0 : -1;
+		}
+		dbg.run();
+		return 0;
+	}
+
+	if (arg >= argc) {
 		std::cerr << "Program name not specified\n";
 		return -1;
 	}
 
-	auto program = argv[1];
-	auto pid	 = fork();
-	if (pid == 0) {
-		// disable address space randomization so address breakpoints can be set
-		personality(ADDR_NO_RANDOMIZE);
-		// Entered the child process, exectue debugee
-		execute_debugee(program);
-	} else if (pid >= 1) {
-		// Entered the parent process, exectue debugger
-		std::cout << "Started debugging process " << pid << '\n';
+	mini_debugger::Launch_Options launch;
+	launch.program = argv[arg];
+	// whatever follows the program is passed to it
+	launch.args.assign(argv + arg + 1, argv + argc);
+	launch.syscalls = caught_syscalls;
+	launch.syscalls.insert(
+		launch.syscalls.end(), traced_syscalls.begin(), traced_syscalls.end());
 
-		Debugger dbg{ program, pid };
-		dbg.run();
+	auto pid = mini_debugger::launch_program(launch);
+	if (pid < 0) {
+		std::cerr << "Cannot fork: " << strerror(errno) << '\n';
+		return -1;
+	}
+	std::cout << "Started debugging process " << pid << '\n';
 
-		// wait for child process to end
-		wait(NULL);
+	Debugger dbg{ launch.program, pid };
+	dbg.set_launch_options(launch);
+	dbg.trace_syscalls(traced_syscalls, false);
+	dbg.trace_syscalls(caught_syscalls, true);
+	if (!coverage_output.empty()) {
+		if (!dbg.collect_coverage(coverage_sources, coverage_output))
+			return -1;
+	} else if (!gdbserver_address.empty()) {
+		Gdb_Server server{ dbg };
+		server.serve(gdbserver_address);
+	} else {
+		dbg.run();
 	}
 
+	// wait for child process to end
+	wait(NULL);
+
 	return 0;
 }
@@ -0,0 +1,91 @@
+#include <memory_access.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>		// open
+#include <string>
+#include <sys/ptrace.h> // ptrace
+#include <sys/uio.h>	// process_vm_readv
+#include <unistd.h>		// pwrite
+
+namespace mini_debugger {
+
+bool
+read_memory_block(const pid_t		   pid,
+				  const std::uintptr_t address,
+				  void*				   buffer,
+				  const std::size_t	   size)
+{
+	iovec local{ buffer, size };
+	iovec remote{ reinterpret_cast<void*>(address), size };
+	return process_vm_readv(pid, &local, 1, &remote, 1, 0) ==
+		   static_cast<ssize_t>(size);
+}
+
+std::string
+read_memory_string(const pid_t			pid,
+				   const std::uintptr_t address,
+				   const std::size_t	max_size)
+{
+	static constexpr std::uintptr_t PAGE_SIZE_BYTES{ 4096 };
+
+	std::string result;
+	char		buffer[PAGE_SIZE_BYTES];
+	auto		current = address;
+	while (result.size() < max_size) {
+		auto size = std::min<std::size_t>(
+			PAGE_SIZE_BYTES - current % PAGE_SIZE_BYTES,
+			max_size - result.size());
+		if (!read_memory_block(pid, current, buffer, size))
+			break;
+		auto end = std::find(buffer, buffer + size, '\0');
+		result.append(buffer, end);
+		if (end != buffer + size)
+			break;
+		current += size;
+	}
+	return result;
+}
+
+bool
+write_memory_block(const pid_t			pid,
+				   const std::uintptr_t address,
+				   const void*			buffer,
+				   const std::size_t	size)
+{
+	// unlike process_vm_writev, /proc/<pid>/mem ignores page protections for
+	// a tracer, which is what we need to patch code
+	auto mem = "/proc/" + std::to_string(pid) + "/mem";
+	auto fd  = open(mem.c_str(), O_RDWR);
+	if (fd >= 0) {
+		auto written = pwrite(fd, buffer, size, address);
+		close(fd);
+		if (written == static_cast<ssize_t>(size))
+			return true;
+	}
+
+	// fall back to one PTRACE_POKEDATA per word, merging the partial words at
+	// both ends with the current memory content
+	auto		bytes = static_cast<const uint8_t*>(buffer);
+	std::size_t done{ 0 };
+	while (done < size) {
+		auto word_address = (address + done) & ~(sizeof(long) - 1);
+		auto offset		  = address + done - word_address;
+		auto count		  = std::min(sizeof(long) - offset, size - done);
+
+		errno	  = 0;
+		long word = ptrace(PTRACE_PEEKDATA, pid, word_address, nullptr);
+		if (errno != 0)
+			return false;
+		std::memcpy(reinterpret_cast<uint8_t*>(&word) + offset,
+					bytes + done,
+					count);
+		if (ptrace(PTRACE_POKEDATA, pid, word_address, word) < 0)
+			return false;
+		done += count;
+	}
+	return true;
+}
+
+};
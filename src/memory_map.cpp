@@ -0,0 +1,138 @@
+#include <memory_map.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace mini_debugger {
+
+Region_Kind
+Memory_Region::kind() const
+{
+	if (path.empty())
+		return Region_Kind::anonymous;
+	if (path.front() == '/')
+		return Region_Kind::file;
+	if (path == "[heap]")
+		return Region_Kind::heap;
+	if (path == "[stack]")
+		return Region_Kind::stack;
+	return Region_Kind::special;
+}
+
+std::string
+to_string(const Region_Kind kind)
+{
+	switch (kind) {
+		case Region_Kind::file:
+			return "file";
+		case Region_Kind::anonymous:
+			return "anonymous";
+		case Region_Kind::heap:
+			return "heap";
+		case Region_Kind::stack:
+			return "stack";
+		case Region_Kind::special:
+			return "special";
+	}
+	return "";
+}
+
+Memory_Map::Memory_Map()
+	: m_valid{ false }
+{
+}
+
+bool
+Memory_Map::refresh(const pid_t pid)
+{
+	std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+	if (!maps)
+		return false;
+
+	// the kernel lists the mappings in address order
+	std::vector<Memory_Region> regions;
+	std::string				   line;
+	while (std::getline(maps, line)) {
+		std::istringstream fields{ line };
+		std::string		   range, perms, offset, device, inode, path;
+		fields >> range >> perms >> offset >> device >> inode;
+		std::getline(fields >> std::ws, path);
+
+		auto dash = range.find('-');
+		regions.push_back(
+			Memory_Region{ std::stoull(range.substr(0, dash), 0, 16),
+						   std::stoull(range.substr(dash + 1), 0, 16),
+						   perms[0] == 'r',
+						   perms[1] == 'w',
+						   perms[2] == 'x',
+						   perms[3] == 's',
+						   std::stoull(offset, 0, 16),
+						   path });
+	}
+	m_regions = std::move(regions);
+	m_valid	  = true;
+	return true;
+}
+
+void
+Memory_Map::invalidate()
+{
+	m_valid = false;
+}
+
+const Memory_Region*
+Memory_Map::lookup(const std::uintptr_t address) const
+{
+	// last region starting at or below `address`
+	auto it = std::upper_bound(m_regions.begin(),
+							   m_regions.end(),
+							   address,
+							   [](std::uintptr_t address, auto&& region) {
+								   return address < region.start;
+							   });
+	if (it == m_regions.begin())
+		return nullptr;
+	--it;
+	return address < it->end ? &*it : nullptr;
+}
+
+bool
+Memory_Map::in_growth_gap(const std::uintptr_t address) const
+{
+	auto above = std::upper_bound(m_regions.begin(),
+								  m_regions.end(),
+								  address,
+								  [](std::uintptr_t address, auto&& region) {
+									  return address < region.start;
+								  });
+	if (above != m_regions.end() && above->kind() == Region_Kind::stack)
+		return true;
+	return above != m_regions.begin() &&
+		   std::prev(above)->kind() == Region_Kind::heap;
+}
+
+const Memory_Region*
+Memory_Map::find(const pid_t pid, const std::uintptr_t address)
+{
+	if (!m_valid && !refresh(pid))
+		return nullptr;
+	auto region = lookup(address);
+	if (region != nullptr || !in_growth_gap(address))
+		return region;
+
+	auto now = std::chrono::steady_clock::now();
+	if (now - m_miss_refresh < MISS_REFRESH_INTERVAL || !refresh(pid))
+		return nullptr;
+	m_miss_refresh = now;
+	return lookup(address);
+}
+
+const std::vector<Memory_Region>&
+Memory_Map::regions() const
+{
+	return m_regions;
+}
+
+};
@@ -0,0 +1,137 @@
+#include <memory_access.hpp>
+#include <module_index.hpp>
+
+#include <link.h>	  // link_map
+#include <sys/stat.h> // stat
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace mini_debugger {
+
+// longest link_map list walked, protects against a corrupted list
+static constexpr std::size_t MAX_MODULES{ 1 << 16 };
+
+std::vector<Module>
+Module_Index::update(const pid_t pid, const std::uintptr_t link_map_address)
+{
+	// the list, as the dynamic loader sees it
+	std::vector<Module> modules;
+	auto				address = link_map_address;
+	while (address != 0 && modules.size() < MAX_MODULES) {
+		link_map entry;
+		if (!read_memory_block(pid, address, &entry, sizeof(entry)))
+			break;
+		auto entry_address = address;
+		address			   = reinterpret_cast<std::uintptr_t>(entry.l_next);
+
+		// the main program has an empty name, the vdso has no file
+		auto path = read_memory_string(
+			pid, reinterpret_cast<std::uintptr_t>(entry.l_name));
+		if (path.empty() || path.front() != '/')
+			continue;
+		modules.push_back(Module{ path,
+								  entry.l_addr,
+								  entry_address,
+								  reinterpret_cast<std::uintptr_t>(entry.l_ld),
+								  0,
+								  0,
+								  nullptr });
+	}
+
+	// address ranges from the mappings, matched by inode since the loader's
+	// path may go through symlinks which /proc/<pid>/maps resolves
+	std::map<ino_t, Module*> by_inode;
+	for (auto& module : modules) {
+		struct stat file_stat;
+		if (stat(module.path.c_str(), &file_stat) == 0)
+			by_inode[file_stat.st_ino] = &module;
+	}
+	std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+	std::string	  line;
+	while (std::getline(maps, line)) {
+		std::istringstream fields{ line };
+		std::string		   range, perms, offset, device;
+		ino_t			   inode{ 0 };
+		fields >> range >> perms >> offset >> device >> inode;
+		auto module = by_inode.find(inode);
+		if (inode == 0 || module == by_inode.end())
+			continue;
+
+		auto dash  = range.find('-');
+		auto start = std::stoull(range.substr(0, dash), 0, 16);
+		auto end   = std::stoull(range.substr(dash + 1), 0, 16);
+		auto& m	   = *module->second;
+		m.start	   = m.start == 0 ? start : std::min<uintptr_t>(m.start, start);
+		m.end	   = std::max<uintptr_t>(m.end, end);
+	}
+	modules.erase(std::remove_if(modules.begin(),
+								 modules.end(),
+								 [](auto&& module) { return module.end == 0; }),
+				  modules.end());
+	std::sort(modules.begin(), modules.end(), [](auto&& a, auto&& b) {
+		return a.start < b.start;
+	});
+
+	// keep what was already opened, report what was unloaded
+	std::vector<Module> removed;
+	for (auto& old_module : m_modules) {
+		auto same = std::find_if(
+			modules.begin(), modules.end(), [&](auto&& module) {
+				return module.path == old_module.path &&
+					   module.base == old_module.base;
+			});
+		if (same != modules.end()) {
+			same->image = std::move(old_module.image);
+		} else {
+			removed.push_back(std::move(old_module));
+		}
+	}
+	m_modules = std::move(modules);
+	return removed;
+}
+
+void
+Module_Index::clear()
+{
+	m_modules.clear();
+}
+
+Module*
+Module_Index::find(const std::uintptr_t address)
+{
+	// last module starting at or below `address`
+	auto it = std::upper_bound(m_modules.begin(),
+							   m_modules.end(),
+							   address,
+							   [](std::uintptr_t address, auto&& module) {
+								   return address < module.start;
+							   });
+	if (it == m_modules.begin())
+		return nullptr;
+	--it;
+	return address < it->end ? &*it : nullptr;
+}
+
+std::shared_ptr<const Debug_Image>
+Module_Index::image_of(Module& module)
+{
+	if (!module.image) {
+		try {
+			module.image = load_debug_image(module.path);
+		} catch (std::exception&) {
+			return nullptr;
+		}
+	}
+	return module.image;
+}
+
+std::vector<Module>&
+Module_Index::modules()
+{
+	return m_modules;
+}
+
+};
@@ -0,0 +1,116 @@
+#include <page_tracker.hpp>
+
+#include <fcntl.h>	// open
+#include <unistd.h> // pread, write
+
+#include <cstdlib>
+#include <string>
+
+namespace mini_debugger {
+
+// bit 55 of a pagemap entry: the page was written since the last clear
+static constexpr std::uint64_t PAGEMAP_SOFT_DIRTY{ 1ULL << 55 };
+
+static bool
+write_clear_refs(const std::string& path)
+{
+	// "4" only clears the soft-dirty bits, the other values drop the
+	// accessed/referenced state too
+	auto fd = open(path.c_str(), O_WRONLY);
+	if (fd < 0)
+		return false;
+	auto written = write(fd, "4", 1);
+	close(fd);
+	return written == 1;
+}
+
+static bool
+read_pagemap(const std::string&			path,
+			 const std::uintptr_t		first_page,
+			 std::vector<std::uint64_t>& entries)
+{
+	auto fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	auto  buffer = reinterpret_cast<char*>(entries.data());
+	auto  size	 = entries.size() * sizeof(std::uint64_t);
+	off_t offset = first_page * sizeof(std::uint64_t);
+	while (size > 0) {
+		auto n = pread(fd, buffer, size, offset);
+		if (n <= 0) {
+			close(fd);
+			return false;
+		}
+		buffer += n;
+		size -= n;
+		offset += n;
+	}
+	close(fd);
+	return true;
+}
+
+// the kernel accepts clear_refs "4" and returns pagemap entries without
+// soft-dirty support, so find out by writing to a page of our own
+static bool
+soft_dirty_supported()
+{
+	static const bool supported = [] {
+		auto page = static_cast<volatile char*>(
+			std::aligned_alloc(TRACKED_PAGE_SIZE, TRACKED_PAGE_SIZE));
+		if (page == nullptr)
+			return false;
+		page[0] = 1;
+
+		std::vector<std::uint64_t> entry(1);
+		auto first = reinterpret_cast<std::uintptr_t>(page) /
+					 TRACKED_PAGE_SIZE;
+		bool result = write_clear_refs("/proc/self/clear_refs");
+		page[0]		= 2;
+		result		= result &&
+				 read_pagemap("/proc/self/pagemap", first, entry) &&
+				 (entry[0] & PAGEMAP_SOFT_DIRTY);
+		std::free(const_cast<char*>(page));
+		return result;
+	}();
+	return supported;
+}
+
+Page_Tracker::Page_Tracker(const pid_t pid)
+	: m_pid{ pid }
+	, m_supported{ soft_dirty_supported() }
+{
+}
+
+std::vector<std::uintptr_t>
+Page_Tracker::dirty_pages(const std::uintptr_t address,
+						  const std::size_t	   length)
+{
+	std::vector<std::uintptr_t> pages;
+	if (length == 0)
+		return pages;
+
+	auto first = address / TRACKED_PAGE_SIZE;
+	auto last  = (address + length - 1) / TRACKED_PAGE_SIZE;
+
+	// opened for each query: a descriptor keeps reading the address space
+	// the process had when it was opened, before an exec
+	std::vector<std::uint64_t> entries(last - first + 1);
+	auto path  = "/proc/" + std::to_string(m_pid) + "/pagemap";
+	bool known = m_supported && read_pagemap(path, first, entries);
+
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		if (!known || (entries[i] & PAGEMAP_SOFT_DIRTY))
+			pages.push_back((first + i) * TRACKED_PAGE_SIZE);
+	}
+	return pages;
+}
+
+bool
+Page_Tracker::clear()
+{
+	if (!m_supported)
+		return true;
+	return write_clear_refs("/proc/" + std::to_string(m_pid) + "/clear_refs");
+}
+
+};
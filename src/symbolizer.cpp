@@ -0,0 +1,391 @@
+#include <symbolizer.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cinttypes> // PRIxPTR
+#include <cstdio>	 // snprintf
+#include <functional>
+#include <iostream>
+#include <thread>
+
+namespace mini_debugger {
+
+// lines read before the workers are started on them
+static constexpr std::size_t BLOCK_LINES{ 1 << 16 };
+
+static std::string_view
+trim(std::string_view text)
+{
+	auto first = text.find_first_not_of(" \t\r");
+	if (first == std::string_view::npos)
+		return {};
+	auto last = text.find_last_not_of(" \t\r");
+	return text.substr(first, last + 1 - first);
+}
+
+// hexadecimal number with or without 0x
+static bool
+parse_address(std::string_view text, std::uintptr_t& address)
+{
+	if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+		text.remove_prefix(2);
+	auto end = text.data() + text.size();
+	auto [ptr, ec] = std::from_chars(text.data(), end, address, 16);
+	return ec == std::errc{} && ptr == end && !text.empty();
+}
+
+// name of a function or of an inlined call, found through the abstract
+// instance or the declaration when the DIE has none
+static std::string
+scope_name(dwarf::die die)
+{
+	for (int i = 0; i < 4; ++i) {
+		if (die.has(dwarf::DW_AT::name))
+			return dwarf::at_name(die);
+		if (die.has(dwarf::DW_AT::abstract_origin))
+			die = dwarf::at_abstract_origin(die);
+		else if (die.has(dwarf::DW_AT::specification))
+			die = dwarf::at_specification(die);
+		else
+			break;
+	}
+	return "??";
+}
+
+void
+Symbolizer::read_symbols(const elf::elf& elf, std::vector<Elf_Symbol>& out)
+{
+	for (auto& section : elf.sections()) {
+		if (section.get_hdr().type != elf::sht::symtab &&
+			section.get_hdr().type != elf::sht::dynsym)
+			continue;
+		for (auto sym : section.as_symtab()) {
+			auto& data = sym.get_data();
+			if (data.type() != elf::stt::func || data.value == 0)
+				continue;
+			out.push_back(Elf_Symbol{ data.value, data.size, sym.get_name() });
+		}
+	}
+	std::sort(out.begin(), out.end(), [](auto&& a, auto&& b) {
+		return a.address < b.address;
+	});
+	// a function is in both .symtab and .dynsym
+	out.erase(std::unique(out.begin(),
+						  out.end(),
+						  [](auto&& a, auto&& b) {
+							  return a.address == b.address;
+						  }),
+			  out.end());
+}
+
+Symbolizer::Symbolizer(const std::string& program)
+{
+	auto object	  = std::make_unique<Object>();
+	object->image = load_debug_image(program);
+	read_symbols(object->image->elf, object->symbols);
+	m_objects.emplace("", std::move(object));
+}
+
+std::size_t
+Symbolizer::run(std::istream& in, std::ostream& out, unsigned threads)
+{
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// each worker keeps its cache from block to block and resolves a
+	// contiguous slice of the block: sorted input stays sorted per worker
+	std::vector<Worker_Cache> caches(threads);
+	std::vector<std::string>  outputs(threads);
+	std::vector<std::string>  lines;
+	std::size_t				  count{ 0 };
+	while (in) {
+		lines.clear();
+		std::string line;
+		while (lines.size() < BLOCK_LINES && std::getline(in, line)) {
+			lines.push_back(std::move(line));
+		}
+		if (lines.empty())
+			break;
+		count += lines.size();
+
+		auto slice	 = (lines.size() + threads - 1) / threads;
+		auto resolve = [&](std::size_t worker) {
+			auto first = std::min(lines.size(), worker * slice);
+			auto last  = std::min(lines.size(), first + slice);
+			outputs[worker].clear();
+			for (auto i = first; i < last; ++i) {
+				symbolize(lines[i], caches[worker], outputs[worker]);
+			}
+		};
+		std::vector<std::thread> workers;
+		for (std::size_t worker = 1; worker < threads; ++worker) {
+			workers.emplace_back(resolve, worker);
+		}
+		resolve(0);
+		for (auto& worker : workers) {
+			worker.join();
+		}
+
+		for (const auto& output : outputs) {
+			out.write(output.data(), output.size());
+		}
+		out.flush();
+	}
+	return count;
+}
+
+Symbolizer::Object*
+Symbolizer::object_of(const std::string_view path)
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	auto						object = m_objects.find(path);
+	if (object != m_objects.end())
+		return object->second.get();
+
+	// a file which cannot be read is remembered as such
+	std::unique_ptr<Object> loaded;
+	try {
+		loaded		  = std::make_unique<Object>();
+		loaded->image = load_debug_image(std::string{ path });
+		read_symbols(loaded->image->elf, loaded->symbols);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << '\n';
+		loaded.reset();
+	}
+	return m_objects.emplace(std::string{ path }, std::move(loaded))
+		.first->second.get();
+}
+
+std::shared_ptr<const Symbolizer::Unit_Index>
+Symbolizer::unit_index_at(Object& object, const std::uintptr_t pc)
+{
+	auto unit_in_ranges = [&object, pc]() -> const dwarf::compilation_unit* {
+		const auto& ranges = object.unit_ranges;
+		auto		range  = std::upper_bound(
+			   ranges.begin(),
+			   ranges.end(),
+			   pc,
+			   [](std::uintptr_t pc, auto&& range) { return pc < range.low; });
+		if (range == ranges.begin() || pc >= std::prev(range)->high)
+			return nullptr;
+		return std::prev(range)->unit;
+	};
+	if (object.has_unit_ranges) {
+		auto unit = unit_in_ranges();
+		if (!unit)
+			return nullptr;
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		return unit_index(object, *unit);
+	}
+
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	const dwarf::compilation_unit* unit{ nullptr };
+	if (object.has_unit_ranges) {
+		// read by another worker while we waited
+		unit = unit_in_ranges();
+	} else if (object.image->has_dwarf()) {
+		unit = object.image->unit_at(pc);
+	}
+	if (!unit && !object.has_unit_ranges) {
+		// not in the accelerator tables: read the ranges of every unit once
+		// rather than scan them again for each such address
+		if (object.image->has_dwarf()) {
+			read_unit_ranges(*object.image, object.unit_ranges);
+		}
+		object.has_unit_ranges = true;
+	}
+	return unit ? unit_index(object, *unit) : nullptr;
+}
+
+std::shared_ptr<const Symbolizer::Unit_Index>
+Symbolizer::unit_index(Object& object, const dwarf::compilation_unit& unit)
+{
+	auto& index = object.units[unit.get_section_offset()];
+	if (!index) {
+		index = index_unit(*object.image, unit);
+	}
+	return index;
+}
+
+void
+Symbolizer::read_unit_ranges(const Debug_Image&		  image,
+							 std::vector<Unit_Range>& out)
+{
+	for (const auto& unit : image.get_dwarf().compilation_units()) {
+		try {
+			for (const auto& range : dwarf::die_pc_range(unit.root())) {
+				out.push_back(Unit_Range{ range.low, range.high, &unit });
+			}
+		} catch (std::exception&) {
+			// a unit without code
+		}
+	}
+	std::sort(out.begin(), out.end(), [](auto&& a, auto&& b) {
+		return a.low < b.low;
+	});
+}
+
+std::shared_ptr<const Symbolizer::Unit_Index>
+Symbolizer::index_unit(const Debug_Image&			   image,
+					   const dwarf::compilation_unit& unit)
+{
+	auto index		  = std::make_shared<Unit_Index>();
+	index->line_table = image.line_table(unit);
+
+	// functions and inlined calls with code, their children are the calls
+	// inlined into them
+	std::function<void(const dwarf::die&, int, int)> visit =
+		[&](const dwarf::die& parent, int scope, int depth) {
+			for (const auto& die : parent) {
+				if (die.tag != dwarf::DW_TAG::subprogram &&
+					die.tag != dwarf::DW_TAG::inlined_subroutine) {
+					// lexical blocks, namespaces and classes hold scopes
+					visit(die, scope, depth);
+					continue;
+				}
+				auto ranges = dwarf::die_pc_range(die);
+				if (!(ranges.begin() != ranges.end()))
+					continue; // declaration or abstract instance
+
+				Scope child{ scope_name(die), scope, {}, 0 };
+				if (die.tag == dwarf::DW_TAG::inlined_subroutine) {
+					try {
+						auto file = unit.get_line_table().get_file(
+							dwarf::at_call_file(die));
+						child.call_file = file->path;
+					} catch (std::exception&) {
+						child.call_file = "??";
+					}
+					child.call_line = dwarf::at_call_line(die);
+				}
+				int id = index->scopes.size();
+				index->scopes.push_back(std::move(child));
+				for (const auto& range : ranges) {
+					index->ranges.push_back(
+						Scope_Range{ range.low, range.high, id, depth });
+				}
+				visit(die, id, depth + 1);
+			}
+		};
+	visit(unit.root(), -1, 0);
+
+	std::sort(index->ranges.begin(),
+			  index->ranges.end(),
+			  [](auto&& a, auto&& b) {
+				  return a.low < b.low || (a.low == b.low && a.depth < b.depth);
+			  });
+	return index;
+}
+
+int
+Symbolizer::find_scope(const Unit_Index& unit, const std::uintptr_t pc)
+{
+	// the last range starting at or before pc is the innermost one if it
+	// covers pc, else walk back over its siblings to the enclosing scopes
+	auto range = std::upper_bound(
+		unit.ranges.begin(),
+		unit.ranges.end(),
+		pc,
+		[](std::uintptr_t pc, auto&& range) { return pc < range.low; });
+	while (range != unit.ranges.begin()) {
+		--range;
+		if (pc < range->high)
+			return range->scope;
+		// functions do not overlap, no earlier range can cover pc
+		if (range->depth == 0)
+			break;
+	}
+	return -1;
+}
+
+void
+Symbolizer::symbolize(const std::string_view line,
+					  Worker_Cache&			 cache,
+					  std::string&			 out)
+{
+	auto			 text = trim(line);
+	std::string_view module;
+	std::string_view location{ text };
+	auto			 separator = text.find_last_of("+ \t");
+	if (separator != std::string_view::npos) {
+		module	 = trim(text.substr(0, separator));
+		location = text.substr(separator + 1);
+	}
+
+	std::uintptr_t pc{ 0 };
+	if (!parse_address(location, pc)) {
+		out.append(text).append("\n??\n??:0\n");
+		return;
+	}
+	char address[32];
+	std::snprintf(address, sizeof(address), "0x%016" PRIxPTR "\n", pc);
+	out.append(address);
+
+	if (!cache.object || module != cache.module) {
+		cache.module = module;
+		cache.object = object_of(module);
+		cache.unit.reset();
+	}
+	if (!cache.object) {
+		out.append("??\n??:0\n");
+		return;
+	}
+
+	int scope{ -1 };
+	if (cache.unit) {
+		scope = find_scope(*cache.unit, pc);
+	}
+	if (scope < 0) {
+		cache.unit = unit_index_at(*cache.object, pc);
+		if (cache.unit) {
+			scope = find_scope(*cache.unit, pc);
+		}
+	}
+
+	// innermost frame: the line of pc
+	if (scope >= 0) {
+		out.append(cache.unit->scopes[scope].name);
+	} else {
+		// no debug information, the ELF symbol covering pc
+		const auto& symbols = cache.object->symbols;
+		auto		symbol =
+			std::upper_bound(symbols.begin(),
+							 symbols.end(),
+							 pc,
+							 [](std::uintptr_t pc, auto&& symbol) {
+								 return pc < symbol.address;
+							 });
+		if (symbol != symbols.begin() &&
+			pc - std::prev(symbol)->address < std::prev(symbol)->size)
+			out.append(std::prev(symbol)->name);
+		else
+			out.append("??");
+	}
+	out.push_back('\n');
+	auto row = cache.unit ? cache.unit->line_table->find_address(pc)
+						  : Line_Table::npos;
+	if (row != Line_Table::npos) {
+		auto entry = cache.unit->line_table->entry(row);
+		out.append(entry.file)
+			.append(":")
+			.append(std::to_string(entry.line))
+			.push_back('\n');
+	} else {
+		out.append("??:0\n");
+	}
+
+	// the functions the code was inlined into, at their call sites
+	for (; scope >= 0 && cache.unit->scopes[scope].parent >= 0;
+		 scope = cache.unit->scopes[scope].parent) {
+		const auto& inlined = cache.unit->scopes[scope];
+		out.append(cache.unit->scopes[inlined.parent].name)
+			.append("\n")
+			.append(inlined.call_file)
+			.append(":")
+			.append(std::to_string(inlined.call_line))
+			.push_back('\n');
+	}
+}
+
+};
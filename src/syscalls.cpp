@@ -0,0 +1,348 @@
+#include <memory_access.hpp>
+#include <syscalls.hpp>
+
+#include <fcntl.h>		   // AT_FDCWD
+#include <linux/audit.h>   // AUDIT_ARCH_X86_64
+#include <linux/filter.h>  // sock_filter, BPF_*
+#include <linux/seccomp.h> // SECCOMP_*
+#include <stddef.h>		   // offsetof
+#include <sys/prctl.h>	   // prctl
+#include <sys/syscall.h>   // SYS_*
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+namespace mini_debugger {
+
+using A = Syscall_Arg;
+
+static const std::vector<Syscall_Descriptor> g_syscall_descriptors{
+	{ SYS_read, "read", { A::integer, A::hex, A::integer } },
+	{ SYS_write, "write", { A::integer, A::buffer, A::integer } },
+	{ SYS_open, "open", { A::string, A::hex, A::hex } },
+	{ SYS_close, "close", { A::integer } },
+	{ SYS_stat, "stat", { A::string, A::hex } },
+	{ SYS_fstat, "fstat", { A::integer, A::hex } },
+	{ SYS_lstat, "lstat", { A::string, A::hex } },
+	{ SYS_poll, "poll", { A::hex, A::integer, A::integer } },
+	{ SYS_lseek, "lseek", { A::integer, A::integer, A::integer } },
+	{ SYS_mmap,
+	  "mmap",
+	  { A::hex, A::integer, A::hex, A::hex, A::integer, A::integer } },
+	{ SYS_mprotect, "mprotect", { A::hex, A::integer, A::hex } },
+	{ SYS_munmap, "munmap", { A::hex, A::integer } },
+	{ SYS_brk, "brk", { A::hex } },
+	{ SYS_rt_sigaction,
+	  "rt_sigaction",
+	  { A::integer, A::hex, A::hex, A::integer } },
+	{ SYS_rt_sigprocmask,
+	  "rt_sigprocmask",
+	  { A::integer, A::hex, A::hex, A::integer } },
+	{ SYS_ioctl, "ioctl", { A::integer, A::hex, A::hex } },
+	{ SYS_pread64,
+	  "pread64",
+	  { A::integer, A::hex, A::integer, A::integer } },
+	{ SYS_pwrite64,
+	  "pwrite64",
+	  { A::integer, A::buffer, A::integer, A::integer } },
+	{ SYS_readv, "readv", { A::integer, A::hex, A::integer } },
+	{ SYS_writev, "writev", { A::integer, A::hex, A::integer } },
+	{ SYS_access, "access", { A::string, A::hex } },
+	{ SYS_pipe, "pipe", { A::hex } },
+	{ SYS_select,
+	  "select",
+	  { A::integer, A::hex, A::hex, A::hex, A::hex } },
+	{ SYS_sched_yield, "sched_yield", {} },
+	{ SYS_mremap,
+	  "mremap",
+	  { A::hex, A::integer, A::integer, A::hex, A::hex } },
+	{ SYS_madvise, "madvise", { A::hex, A::integer, A::integer } },
+	{ SYS_dup, "dup", { A::integer } },
+	{ SYS_dup2, "dup2", { A::integer, A::integer } },
+	{ SYS_nanosleep, "nanosleep", { A::hex, A::hex } },
+	{ SYS_getpid, "getpid", {} },
+	{ SYS_sendfile,
+	  "sendfile",
+	  { A::integer, A::integer, A::hex, A::integer } },
+	{ SYS_socket, "socket", { A::integer, A::integer, A::integer } },
+	{ SYS_connect, "connect", { A::integer, A::hex, A::integer } },
+	{ SYS_accept, "accept", { A::integer, A::hex, A::hex } },
+	{ SYS_sendto,
+	  "sendto",
+	  { A::integer, A::buffer, A::integer, A::hex, A::hex, A::integer } },
+	{ SYS_recvfrom,
+	  "recvfrom",
+	  { A::integer, A::hex, A::integer, A::hex, A::hex, A::hex } },
+	{ SYS_sendmsg, "sendmsg", { A::integer, A::hex, A::hex } },
+	{ SYS_recvmsg, "recvmsg", { A::integer, A::hex, A::hex } },
+	{ SYS_shutdown, "shutdown", { A::integer, A::integer } },
+	{ SYS_bind, "bind", { A::integer, A::hex, A::integer } },
+	{ SYS_listen, "listen", { A::integer, A::integer } },
+	{ SYS_setsockopt,
+	  "setsockopt",
+	  { A::integer, A::integer, A::integer, A::hex, A::integer } },
+	{ SYS_getsockopt,
+	  "getsockopt",
+	  { A::integer, A::integer, A::integer, A::hex, A::hex } },
+	{ SYS_clone, "clone", { A::hex, A::hex, A::hex, A::hex, A::hex } },
+	{ SYS_fork, "fork", {} },
+	{ SYS_vfork, "vfork", {} },
+	{ SYS_execve, "execve", { A::string, A::hex, A::hex } },
+	{ SYS_exit, "exit", { A::integer } },
+	{ SYS_wait4, "wait4", { A::integer, A::hex, A::hex, A::hex } },
+	{ SYS_kill, "kill", { A::integer, A::integer } },
+	{ SYS_uname, "uname", { A::hex } },
+	{ SYS_fcntl, "fcntl", { A::integer, A::integer, A::hex } },
+	{ SYS_flock, "flock", { A::integer, A::integer } },
+	{ SYS_fsync, "fsync", { A::integer } },
+	{ SYS_fdatasync, "fdatasync", { A::integer } },
+	{ SYS_truncate, "truncate", { A::string, A::integer } },
+	{ SYS_ftruncate, "ftruncate", { A::integer, A::integer } },
+	{ SYS_getcwd, "getcwd", { A::hex, A::integer } },
+	{ SYS_chdir, "chdir", { A::string } },
+	{ SYS_rename, "rename", { A::string, A::string } },
+	{ SYS_mkdir, "mkdir", { A::string, A::hex } },
+	{ SYS_rmdir, "rmdir", { A::string } },
+	{ SYS_unlink, "unlink", { A::string } },
+	{ SYS_readlink, "readlink", { A::string, A::hex, A::integer } },
+	{ SYS_chmod, "chmod", { A::string, A::hex } },
+	{ SYS_gettimeofday, "gettimeofday", { A::hex, A::hex } },
+	{ SYS_getuid, "getuid", {} },
+	{ SYS_gettid, "gettid", {} },
+	{ SYS_tgkill, "tgkill", { A::integer, A::integer, A::integer } },
+	{ SYS_futex,
+	  "futex",
+	  { A::hex, A::integer, A::integer, A::hex, A::hex, A::integer } },
+	{ SYS_getdents64, "getdents64", { A::integer, A::hex, A::integer } },
+	{ SYS_clock_gettime, "clock_gettime", { A::integer, A::hex } },
+	{ SYS_clock_nanosleep,
+	  "clock_nanosleep",
+	  { A::integer, A::hex, A::hex, A::hex } },
+	{ SYS_exit_group, "exit_group", { A::integer } },
+	{ SYS_epoll_wait,
+	  "epoll_wait",
+	  { A::integer, A::hex, A::integer, A::integer } },
+	{ SYS_epoll_ctl,
+	  "epoll_ctl",
+	  { A::integer, A::integer, A::integer, A::hex } },
+	{ SYS_openat, "openat", { A::dirfd, A::string, A::hex, A::hex } },
+	{ SYS_mkdirat, "mkdirat", { A::dirfd, A::string, A::hex } },
+	{ SYS_newfstatat,
+	  "newfstatat",
+	  { A::dirfd, A::string, A::hex, A::hex } },
+	{ SYS_unlinkat, "unlinkat", { A::dirfd, A::string, A::hex } },
+	{ SYS_renameat,
+	  "renameat",
+	  { A::dirfd, A::string, A::dirfd, A::string } },
+	{ SYS_readlinkat,
+	  "readlinkat",
+	  { A::dirfd, A::string, A::hex, A::integer } },
+	{ SYS_faccessat, "faccessat", { A::dirfd, A::string, A::hex } },
+	{ SYS_pselect6,
+	  "pselect6",
+	  { A::integer, A::hex, A::hex, A::hex, A::hex, A::hex } },
+	{ SYS_ppoll, "ppoll", { A::hex, A::integer, A::hex, A::hex } },
+	{ SYS_set_robust_list, "set_robust_list", { A::hex, A::integer } },
+	{ SYS_splice,
+	  "splice",
+	  { A::integer, A::hex, A::integer, A::hex, A::integer, A::hex } },
+	{ SYS_epoll_pwait,
+	  "epoll_pwait",
+	  { A::integer, A::hex, A::integer, A::integer, A::hex } },
+	{ SYS_eventfd2, "eventfd2", { A::integer, A::hex } },
+	{ SYS_epoll_create1, "epoll_create1", { A::hex } },
+	{ SYS_dup3, "dup3", { A::integer, A::integer, A::hex } },
+	{ SYS_pipe2, "pipe2", { A::hex, A::hex } },
+	{ SYS_accept4, "accept4", { A::integer, A::hex, A::hex, A::hex } },
+	{ SYS_preadv,
+	  "preadv",
+	  { A::integer, A::hex, A::integer, A::integer } },
+	{ SYS_pwritev,
+	  "pwritev",
+	  { A::integer, A::hex, A::integer, A::integer } },
+	{ SYS_recvmmsg,
+	  "recvmmsg",
+	  { A::integer, A::hex, A::integer, A::hex, A::hex } },
+	{ SYS_prlimit64,
+	  "prlimit64",
+	  { A::integer, A::integer, A::hex, A::hex } },
+	{ SYS_sendmmsg,
+	  "sendmmsg",
+	  { A::integer, A::hex, A::integer, A::hex } },
+	{ SYS_getrandom, "getrandom", { A::hex, A::integer, A::hex } },
+	{ SYS_memfd_create, "memfd_create", { A::string, A::hex } },
+	{ SYS_execveat,
+	  "execveat",
+	  { A::dirfd, A::string, A::hex, A::hex, A::hex } },
+	{ SYS_statx,
+	  "statx",
+	  { A::dirfd, A::string, A::hex, A::hex, A::hex } },
+	{ SYS_rseq, "rseq", { A::hex, A::integer, A::hex, A::hex } },
+	{ SYS_clone3, "clone3", { A::hex, A::integer } },
+};
+
+// longest string or buffer printed for an argument
+static constexpr std::size_t MAX_ARG_LEN{ 64 };
+
+static const Syscall_Descriptor*
+find_descriptor(const long number)
+{
+	auto it = std::find_if(g_syscall_descriptors.begin(),
+						   g_syscall_descriptors.end(),
+						   [number](auto&& syscall_descriptor) {
+							   return syscall_descriptor.number == number;
+						   });
+	return it == g_syscall_descriptors.end() ? nullptr : &*it;
+}
+
+std::optional<long>
+get_syscall_number(const std::string_view name)
+{
+	auto it = std::find_if(g_syscall_descriptors.begin(),
+						   g_syscall_descriptors.end(),
+						   [name](auto&& syscall_descriptor) {
+							   return syscall_descriptor.name == name;
+						   });
+	if (it == g_syscall_descriptors.end())
+		return std::nullopt;
+	return it->number;
+}
+
+std::string
+get_syscall_name(const long number)
+{
+	auto descriptor = find_descriptor(number);
+	return descriptor ? descriptor->name
+					  : "syscall_" + std::to_string(number);
+}
+
+// quote and escape `length` bytes of `data`
+static void
+print_quoted(std::ostringstream& out, const char* data, std::size_t length)
+{
+	out << '"';
+	for (std::size_t i = 0; i < length; ++i) {
+		auto ch = static_cast<unsigned char>(data[i]);
+		switch (ch) {
+			case '\n':
+				out << "\\n";
+				break;
+			case '\t':
+				out << "\\t";
+				break;
+			case '"':
+				out << "\\\"";
+				break;
+			case '\\':
+				out << "\\\\";
+				break;
+			default:
+				if (ch >= 0x20 && ch < 0x7f) {
+					out << ch;
+				} else {
+					out << "\\x" << std::hex << static_cast<int>(ch)
+						<< std::dec;
+				}
+		}
+	}
+	out << '"';
+}
+
+std::string
+format_syscall(const pid_t pid, const user_regs_struct& regs)
+{
+	const unsigned long long args[6]{ regs.rdi, regs.rsi, regs.rdx,
+									  regs.r10, regs.r8,  regs.r9 };
+	auto descriptor = find_descriptor(regs.orig_rax);
+
+	std::ostringstream out;
+	out << get_syscall_name(regs.orig_rax) << '(';
+	for (std::size_t i = 0; i < 6; ++i) {
+		// unknown system calls: print every register as hex
+		auto kind = descriptor ? descriptor->args[i] : Syscall_Arg::hex;
+		if (kind == Syscall_Arg::none)
+			break;
+		if (i != 0)
+			out << ", ";
+
+		char buffer[MAX_ARG_LEN];
+		switch (kind) {
+			case Syscall_Arg::integer:
+				out << static_cast<long long>(args[i]);
+				break;
+			case Syscall_Arg::dirfd:
+				if (static_cast<int>(args[i]) == AT_FDCWD)
+					out << "AT_FDCWD";
+				else
+					out << static_cast<int>(args[i]);
+				break;
+			case Syscall_Arg::string: {
+				// one bulk read; a string ending right before an unmapped
+				// page is read again up to the end of its page
+				std::size_t length = MAX_ARG_LEN;
+				auto		page_left =
+					4096 - static_cast<std::size_t>(args[i] % 4096);
+				if (!read_memory_block(pid, args[i], buffer, length)) {
+					length = std::min(length, page_left);
+					if (!read_memory_block(pid, args[i], buffer, length)) {
+						out << "0x" << std::hex << args[i] << std::dec;
+						break;
+					}
+				}
+				auto end = std::find(buffer, buffer + length, '\0');
+				print_quoted(out, buffer, end - buffer);
+				if (end == buffer + length)
+					out << "...";
+				break;
+			}
+			case Syscall_Arg::buffer: {
+				auto length = std::min<std::size_t>(
+					i + 1 < 6 ? args[i + 1] : 0, MAX_ARG_LEN);
+				if (!read_memory_block(pid, args[i], buffer, length)) {
+					out << "0x" << std::hex << args[i] << std::dec;
+					break;
+				}
+				print_quoted(out, buffer, length);
+				if (i + 1 < 6 && args[i + 1] > length)
+					out << "...";
+				break;
+			}
+			default:
+				out << "0x" << std::hex << args[i] << std::dec;
+		}
+	}
+	out << ')';
+	return out.str();
+}
+
+bool
+install_syscall_filter(const std::vector<long>& numbers)
+{
+	// classic BPF run by the kernel on every system call:
+	//   if (arch != x86_64) allow
+	//   for each number: if (nr == number) return TRACE
+	//   allow
+	std::vector<sock_filter> program{
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)),
+	};
+	for (auto number : numbers) {
+		// jump offsets are 8 bits, so test each number next to its return
+		program.push_back(BPF_JUMP(
+			BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(number), 0, 1));
+		program.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+	}
+	program.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+
+	sock_fprog filter{ static_cast<unsigned short>(program.size()),
+					   program.data() };
+	// required to install a filter without CAP_SYS_ADMIN
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+		return false;
+	return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &filter) == 0;
+}
+
+};
@@ -0,0 +1,227 @@
+#include <trace_recorder.hpp>
+
+#include <algorithm>
+#include <cstddef> // offsetof
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace mini_debugger {
+
+static constexpr std::size_t CHUNK_BYTES{ 64 << 10 };
+// number of 64 bit fields of user_regs_struct, rip being one of them
+static constexpr std::size_t REG_FIELDS{ sizeof(user_regs_struct) /
+										 sizeof(std::uint64_t) };
+static constexpr std::size_t RIP_FIELD{ offsetof(user_regs_struct, rip) /
+										sizeof(std::uint64_t) };
+static constexpr char		 TRACE_FILE_MAGIC[8]{ 'M', 'D', 'B', 'G',
+												  'T', 'R', 'C', '1' };
+
+static_assert(REG_FIELDS <= 32, "the changed registers mask is 32 bits");
+
+// zigzag encoding maps small negative deltas to small unsigned values
+static std::uint64_t
+zigzag(const std::int64_t value)
+{
+	return (static_cast<std::uint64_t>(value) << 1) ^
+		   static_cast<std::uint64_t>(value >> 63);
+}
+
+static std::int64_t
+unzigzag(const std::uint64_t value)
+{
+	return static_cast<std::int64_t>(value >> 1) ^
+		   -static_cast<std::int64_t>(value & 1);
+}
+
+static std::uint64_t
+read_varint(const std::vector<uint8_t>& bytes, std::size_t& pos)
+{
+	std::uint64_t value{ 0 };
+	unsigned	  shift{ 0 };
+	while (pos < bytes.size()) {
+		auto byte = bytes[pos++];
+		value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			break;
+		shift += 7;
+	}
+	return value;
+}
+
+template<typename T>
+static void
+write_raw(std::ofstream& out, const T value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+Trace_Recorder::Trace_Recorder(const std::size_t max_bytes)
+	: m_max_chunks{ std::max<std::size_t>(max_bytes / CHUNK_BYTES, 1) }
+	, m_recording{ false }
+	, m_with_registers{ false }
+	, m_previous{}
+	, m_recorded{ 0 }
+	, m_dropped{ 0 }
+{
+}
+
+void
+Trace_Recorder::start(const bool with_registers)
+{
+	m_chunks.clear();
+	m_recording		 = true;
+	m_with_registers = with_registers;
+	m_recorded		 = 0;
+	m_dropped		 = 0;
+}
+
+void
+Trace_Recorder::stop()
+{
+	m_recording = false;
+}
+
+bool
+Trace_Recorder::is_recording() const
+{
+	return m_recording;
+}
+
+void
+Trace_Recorder::append_varint(std::uint64_t value)
+{
+	auto& bytes = m_chunks.back().bytes;
+	while (value >= 0x80) {
+		bytes.emplace_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	bytes.emplace_back(static_cast<uint8_t>(value));
+}
+
+void
+Trace_Recorder::append_signed(const std::int64_t value)
+{
+	append_varint(zigzag(value));
+}
+
+void
+Trace_Recorder::record(const user_regs_struct& regs)
+{
+	if (!m_recording)
+		return;
+
+	// an entry is at most 1 + 32 varints of 10 bytes
+	if (m_chunks.empty() ||
+		m_chunks.back().bytes.size() + 33 * 10 > CHUNK_BYTES) {
+		if (m_chunks.size() == m_max_chunks) {
+			m_dropped += m_chunks.front().entries;
+			m_chunks.pop_front();
+		}
+		m_chunks.emplace_back();
+		m_chunks.back().bytes.reserve(CHUNK_BYTES);
+		m_chunks.back().entries = 0;
+		m_previous				= user_regs_struct{};
+	}
+
+	std::uint64_t current[REG_FIELDS];
+	std::uint64_t previous[REG_FIELDS];
+	std::memcpy(current, &regs, sizeof(current));
+	std::memcpy(previous, &m_previous, sizeof(previous));
+
+	append_signed(current[RIP_FIELD] - previous[RIP_FIELD]);
+	if (m_with_registers) {
+		// bitmask of the changed registers followed by their deltas
+		std::uint32_t changed{ 0 };
+		for (std::size_t i = 0; i < REG_FIELDS; ++i) {
+			if (i != RIP_FIELD && current[i] != previous[i])
+				changed |= 1u << i;
+		}
+		append_varint(changed);
+		for (std::size_t i = 0; i < REG_FIELDS; ++i) {
+			if (changed & (1u << i))
+				append_signed(current[i] - previous[i]);
+		}
+	}
+
+	m_previous = regs;
+	++m_chunks.back().entries;
+	++m_recorded;
+}
+
+std::vector<std::uintptr_t>
+Trace_Recorder::last_pcs(const std::size_t count) const
+{
+	// only decode the chunks holding the last `count` entries
+	std::size_t first_chunk = m_chunks.size();
+	std::size_t entries{ 0 };
+	while (first_chunk > 0 && entries < count) {
+		entries += m_chunks[--first_chunk].entries;
+	}
+
+	std::vector<std::uintptr_t> pcs;
+	pcs.reserve(entries);
+	for (auto i = first_chunk; i < m_chunks.size(); ++i) {
+		const auto&	  bytes = m_chunks[i].bytes;
+		std::size_t	  pos{ 0 };
+		std::uint64_t pc{ 0 };
+		for (std::size_t entry = 0; entry < m_chunks[i].entries; ++entry) {
+			pc += unzigzag(read_varint(bytes, pos));
+			pcs.emplace_back(pc);
+			if (m_with_registers) {
+				auto changed = read_varint(bytes, pos);
+				for (std::size_t reg = 0; reg < REG_FIELDS; ++reg) {
+					if (changed & (1u << reg))
+						read_varint(bytes, pos);
+				}
+			}
+		}
+	}
+
+	if (pcs.size() > count)
+		pcs.erase(pcs.begin(), pcs.end() - count);
+	return pcs;
+}
+
+bool
+Trace_Recorder::save(const std::string&	 path,
+					 const std::intptr_t load_address) const
+{
+	// header: magic, flags (bit 0: registers), load address, number of
+	// entries and chunks. Then each chunk: entries, size, encoded bytes
+	std::ofstream out{ path, std::ios::binary };
+	if (!out)
+		return false;
+
+	out.write(TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC));
+	write_raw<std::uint64_t>(out, m_with_registers ? 1 : 0);
+	write_raw<std::uint64_t>(out, load_address);
+	write_raw<std::uint64_t>(out, m_recorded - m_dropped);
+	write_raw<std::uint64_t>(out, m_chunks.size());
+	for (const auto& chunk : m_chunks) {
+		write_raw<std::uint64_t>(out, chunk.entries);
+		write_raw<std::uint64_t>(out, chunk.bytes.size());
+		out.write(reinterpret_cast<const char*>(chunk.bytes.data()),
+				  chunk.bytes.size());
+	}
+	return static_cast<bool>(out);
+}
+
+void
+Trace_Recorder::print_info() const
+{
+	std::size_t bytes{ 0 };
+	for (const auto& chunk : m_chunks) {
+		bytes += chunk.bytes.size();
+	}
+	std::cout << std::dec << (m_recording ? "recording" : "not recording")
+			  << ", " << m_recorded - m_dropped << " entries in " << bytes
+			  << " bytes";
+	if (m_recorded > m_dropped)
+		std::cout << " (" << static_cast<double>(bytes) /
+								 static_cast<double>(m_recorded - m_dropped)
+				  << " bytes/entry)";
+	std::cout << ", " << m_dropped << " oldest entries dropped" << std::endl;
+}
+
+};
@@ -0,0 +1,395 @@
+#include <inferior_syscall.hpp>
+#include <memory_access.hpp>
+#include <tracepoint.hpp>
+#include <x86_decoder.hpp>
+
+#include <sys/mman.h>	 // PROT_*, MAP_*
+#include <sys/syscall.h> // SYS_mmap
+#include <unistd.h>		 // sysconf
+#include <x86intrin.h>	 // __rdtsc
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+namespace mini_debugger {
+
+// length of the `jmp rel32` patched over the traced instructions
+static constexpr std::size_t JMP_LEN{ 5 };
+// offset of the first record in the ring buffer, the header only holds the
+// 64 bit head counter but gets its own cache line
+static constexpr std::size_t RING_HEADER_SIZE{ 64 };
+
+static_assert(sizeof(Trace_Record) == 72, "layout used by the trampolines");
+static_assert((TRACE_RING_RECORDS & (TRACE_RING_RECORDS - 1)) == 0,
+			  "the trampolines mask the ring index");
+
+template<typename T>
+static void
+append(std::vector<uint8_t>& code, const T value)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(&value);
+	code.insert(code.end(), bytes, bytes + sizeof(T));
+}
+
+Tracepoint_Manager::Tracepoint_Manager(const pid_t pid)
+	: m_pid{ pid }
+	, m_code{ 0 }
+	, m_code_used{ 0 }
+	, m_ring{ 0 }
+	, m_draining{ false }
+	, m_tail{ 0 }
+	, m_dropped{ 0 }
+	, m_ns_per_tick{ 1.0 }
+{
+	// the trampolines timestamp with rdtsc, measure its rate once to report
+	// nanoseconds
+	auto start_time = std::chrono::steady_clock::now();
+	auto start_tsc	= __rdtsc();
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	auto elapsed = std::chrono::duration<double, std::nano>(
+					   std::chrono::steady_clock::now() - start_time)
+					   .count();
+	m_ns_per_tick = elapsed / static_cast<double>(__rdtsc() - start_tsc);
+}
+
+Tracepoint_Manager::~Tracepoint_Manager()
+{
+	m_draining = false;
+	if (m_drain_thread.joinable()) {
+		m_drain_thread.join();
+	}
+}
+
+bool
+Tracepoint_Manager::allocate_scratch(const pid_t tid, const std::intptr_t near)
+{
+	// ask for the trampolines right below the code, a jmp rel32 can only
+	// reach +-2GB
+	const long page_size = sysconf(_SC_PAGESIZE);
+	auto hint =
+		(near - static_cast<std::intptr_t>(TRACE_CODE_SIZE) - (1 << 20)) &
+		~(page_size - 1);
+	auto code = inject_syscall(tid,
+							   SYS_mmap,
+							   { hint,
+								 TRACE_CODE_SIZE,
+								 PROT_READ | PROT_WRITE | PROT_EXEC,
+								 MAP_PRIVATE | MAP_ANONYMOUS,
+								 -1,
+								 0 });
+	// mmap returns -errno on failure
+	if (code < 0 && code > -page_size) {
+		std::cerr << "Cannot map the trampoline page: " << strerror(-code)
+				  << '\n';
+		return false;
+	}
+
+	// shared, so that the records of forked children end up in it as well
+	auto ring = inject_syscall(
+		tid,
+		SYS_mmap,
+		{ 0,
+		  static_cast<long>(RING_HEADER_SIZE +
+							TRACE_RING_RECORDS * sizeof(Trace_Record)),
+		  PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS,
+		  -1,
+		  0 });
+	if (ring < 0 && ring > -page_size) {
+		std::cerr << "Cannot map the trace buffer: " << strerror(-ring)
+				  << '\n';
+		return false;
+	}
+
+	m_code = code;
+	m_ring = ring;
+	return true;
+}
+
+std::vector<uint8_t>
+Tracepoint_Manager::trampoline_prologue(const std::uint64_t id) const
+{
+	// the record written is at ring + 64 + (seq & (records - 1)) * 72:
+	//   lea    rsp, [rsp - 128]       skip the red zone of the function
+	//   pushfq
+	//   push   rax, rcx, rdx, r11
+	//   mov    r11, <ring>
+	//   mov    eax, 1
+	//   lock xadd [r11], rax          reserve a record, rax = seq
+	//   mov    rcx, rax
+	//   and    rcx, <records - 1>
+	//   imul   rcx, rcx, 72
+	//   lea    rcx, [r11 + rcx + 64]
+	//   mov    qword [rcx + 8], <id>
+	//   mov    [rcx + 24..64], rdi, rsi, rdx, (saved rcx), r8, r9
+	//   mov    r11, rax
+	//   rdtsc
+	//   shl    rdx, 32
+	//   or     rax, rdx
+	//   mov    [rcx + 16], rax
+	//   lea    rax, [r11 + 1]
+	//   mov    [rcx], rax             publish the record
+	//   pop    r11, rdx, rcx, rax
+	//   popfq
+	//   lea    rsp, [rsp + 128]
+	std::vector<uint8_t> code{ 0x48, 0x8d, 0x64, 0x24, 0x80, 0x9c, 0x50,
+							   0x51, 0x52, 0x41, 0x53, 0x49, 0xbb };
+	append<std::uint64_t>(code, m_ring);
+	code.insert(code.end(),
+				{ 0xb8, 0x01, 0x00, 0x00, 0x00, 0xf0, 0x49, 0x0f, 0xc1, 0x03,
+				  0x48, 0x89, 0xc1, 0x48, 0x81, 0xe1 });
+	append<std::uint32_t>(code, TRACE_RING_RECORDS - 1);
+	code.insert(code.end(), { 0x48, 0x69, 0xc9 });
+	append<std::uint32_t>(code, sizeof(Trace_Record));
+	code.insert(code.end(),
+				{ 0x49, 0x8d, 0x4c, 0x0b, RING_HEADER_SIZE, 0x48, 0xc7, 0x41,
+				  0x08 });
+	append<std::uint32_t>(code, id);
+	code.insert(code.end(),
+				{
+					0x48, 0x89, 0x79, 0x18,		  // mov [rcx + 24], rdi
+					0x48, 0x89, 0x71, 0x20,		  // mov [rcx + 32], rsi
+					0x48, 0x89, 0x51, 0x28,		  // mov [rcx + 40], rdx
+					0x48, 0x8b, 0x54, 0x24, 0x10, // mov rdx, [rsp + 16]
+					0x48, 0x89, 0x51, 0x30,		  // mov [rcx + 48], rdx
+					0x4c, 0x89, 0x41, 0x38,		  // mov [rcx + 56], r8
+					0x4c, 0x89, 0x49, 0x40,		  // mov [rcx + 64], r9
+					0x49, 0x89, 0xc3,			  // mov r11, rax
+					0x0f, 0x31,					  // rdtsc
+					0x48, 0xc1, 0xe2, 0x20,		  // shl rdx, 32
+					0x48, 0x09, 0xd0,			  // or rax, rdx
+					0x48, 0x89, 0x41, 0x10,		  // mov [rcx + 16], rax
+					0x49, 0x8d, 0x43, 0x01,		  // lea rax, [r11 + 1]
+					0x48, 0x89, 0x01,			  // mov [rcx], rax
+					0x41, 0x5b, 0x5a, 0x59, 0x58, // pop r11, rdx, rcx, rax
+					0x9d,						  // popfq
+					0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00,
+				});
+	return code;
+}
+
+bool
+Tracepoint_Manager::install(const pid_t						   tid,
+							const std::intptr_t				   address,
+							const std::intptr_t				   function_end,
+							std::string						   name,
+							const std::vector<std::intptr_t>& thread_pcs)
+{
+	if (m_code == 0 && !allocate_scratch(tid, address))
+		return false;
+
+	// decode whole instructions until the jmp fits
+	uint8_t code[JMP_LEN + 15];
+	if (!read_memory_block(m_pid, address, code, sizeof(code))) {
+		std::cerr << "Cannot read memory at 0x" << std::hex << address << '\n';
+		return false;
+	}
+	std::vector<Decoded_Instruction> displaced;
+	std::size_t						 displaced_len{ 0 };
+	while (displaced_len < JMP_LEN) {
+		auto insn = decode_instruction(code + displaced_len,
+									   sizeof(code) - displaced_len);
+		if (!insn) {
+			std::cerr << "Cannot decode the instruction at 0x" << std::hex
+					  << address + displaced_len << '\n';
+			return false;
+		}
+		displaced.emplace_back(*insn);
+		displaced_len += insn->length;
+	}
+
+	auto patch_end = address + static_cast<std::intptr_t>(displaced_len);
+	if (function_end != 0 && patch_end > function_end) {
+		std::cerr << "Function is too short for a tracepoint\n";
+		return false;
+	}
+	for (auto pc : thread_pcs) {
+		// a thread resuming there would land in the middle of the jmp
+		if (pc > address && pc < patch_end) {
+			std::cerr << "A thread is stopped inside the instructions to "
+						 "patch, step it out first\n";
+			return false;
+		}
+	}
+
+	// trampoline: prologue, displaced instructions, jump back
+	auto trampoline = static_cast<std::intptr_t>(m_code + m_code_used);
+	auto out		= trampoline_prologue(m_tracepoints.size());
+	std::size_t offset{ 0 };
+	for (const auto& insn : displaced) {
+		if (!relocate_instruction(insn,
+								  code + offset,
+								  address + offset,
+								  trampoline + out.size(),
+								  out)) {
+			std::cerr << "Cannot relocate the instruction at 0x" << std::hex
+					  << address + offset << '\n';
+			return false;
+		}
+		offset += insn.length;
+	}
+	auto jump_back = patch_end - (trampoline + static_cast<std::intptr_t>(
+												   out.size() + JMP_LEN));
+	auto jump_to =
+		trampoline - (address + static_cast<std::intptr_t>(JMP_LEN));
+	if (std::max(std::abs(jump_back), std::abs(jump_to)) >
+		std::numeric_limits<std::int32_t>::max()) {
+		std::cerr << "Trampoline is out of reach of the traced code\n";
+		return false;
+	}
+	out.emplace_back(0xe9);
+	append<std::int32_t>(out, jump_back);
+
+	if (m_code_used + out.size() > TRACE_CODE_SIZE) {
+		std::cerr << "Out of trampoline space\n";
+		return false;
+	}
+	if (!write_memory_block(m_pid, trampoline, out.data(), out.size()))
+		return false;
+	m_code_used += out.size();
+
+	// the jmp, the bytes left over from the displaced instructions are never
+	// executed and filled with INT3
+	std::vector<uint8_t> patch{ 0xe9 };
+	append<std::int32_t>(patch, jump_to);
+	patch.resize(displaced_len, 0xcc);
+	if (!write_memory_block(m_pid, address, patch.data(), patch.size()))
+		return false;
+
+	std::cout << "Tracepoint " << std::dec << m_tracepoints.size() << " at 0x"
+			  << std::hex << address << " (" << name << ")\n";
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		m_tracepoints.emplace_back(Tracepoint{
+			address,
+			std::move(name),
+			std::vector<uint8_t>(code, code + displaced_len),
+			0 });
+	}
+
+	if (!m_draining.exchange(true)) {
+		m_drain_thread = std::thread{ &Tracepoint_Manager::drain_loop, this };
+	}
+	return true;
+}
+
+void
+Tracepoint_Manager::remove_all()
+{
+	for (const auto& tracepoint : m_tracepoints) {
+		write_memory_block(m_pid,
+						   tracepoint.address,
+						   tracepoint.saved_code.data(),
+						   tracepoint.saved_code.size());
+	}
+
+	// collect what was recorded up to now and stop draining
+	m_draining = false;
+	if (m_drain_thread.joinable()) {
+		m_drain_thread.join();
+	}
+	drain();
+}
+
+void
+Tracepoint_Manager::drain_loop()
+{
+	while (m_draining) {
+		if (!drain())
+			return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+bool
+Tracepoint_Manager::drain()
+{
+	std::uint64_t head{ 0 };
+	if (!read_memory_block(m_pid, m_ring, &head, sizeof(head)))
+		return false;
+
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	// the trampolines never wait for us, records we were too slow to read
+	// have been overwritten
+	if (head - m_tail > TRACE_RING_RECORDS) {
+		m_dropped += head - m_tail - TRACE_RING_RECORDS;
+		m_tail = head - TRACE_RING_RECORDS;
+	}
+
+	while (m_tail < head) {
+		auto index = m_tail & (TRACE_RING_RECORDS - 1);
+		auto count = std::min(head - m_tail, TRACE_RING_RECORDS - index);
+		m_batch.resize(count);
+		if (!read_memory_block(m_pid,
+							   m_ring + RING_HEADER_SIZE +
+								   index * sizeof(Trace_Record),
+							   m_batch.data(),
+							   count * sizeof(Trace_Record)))
+			return false;
+
+		for (const auto& record : m_batch) {
+			// reserved but not written yet, pick it up on the next round
+			if (record.seq <= m_tail)
+				return true;
+			++m_tail;
+			// lapped by the writers while we were reading
+			if (record.seq != m_tail) {
+				++m_dropped;
+				continue;
+			}
+
+			if (record.id < m_tracepoints.size())
+				++m_tracepoints[record.id].hits;
+			if (m_recent.size() == TRACE_RECENT_RECORDS)
+				m_recent.erase(m_recent.begin(),
+							   m_recent.begin() + TRACE_RECENT_RECORDS / 2);
+			m_recent.emplace_back(record);
+		}
+	}
+	return true;
+}
+
+void
+Tracepoint_Manager::print_tracepoints()
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	for (std::size_t id = 0; id < m_tracepoints.size(); ++id) {
+		const auto& tracepoint = m_tracepoints[id];
+		std::cout << std::dec << id << ": 0x" << std::hex << tracepoint.address
+				  << ' ' << tracepoint.name << " hits " << std::dec
+				  << tracepoint.hits << '\n';
+	}
+	std::cout << "records drained " << m_tail - m_dropped << ", dropped "
+			  << m_dropped << std::endl;
+}
+
+void
+Tracepoint_Manager::print_events(const std::size_t count)
+{
+	std::lock_guard<std::mutex> lock{ m_mutex };
+	auto first = m_recent.size() > count ? m_recent.size() - count : 0;
+	for (auto i = first; i < m_recent.size(); ++i) {
+		const auto& record = m_recent[i];
+		// time relative to the oldest record printed
+		auto ns = static_cast<double>(record.tsc - m_recent[first].tsc) *
+				  m_ns_per_tick;
+		std::cout << std::dec << '#' << record.seq << " +" << std::fixed
+				  << std::setprecision(0) << ns << "ns "
+				  << (record.id < m_tracepoints.size()
+						  ? m_tracepoints[record.id].name
+						  : "?")
+				  << std::hex;
+		for (auto arg : record.args) {
+			std::cout << " 0x" << arg;
+		}
+		std::cout << '\n';
+	}
+	std::cout << std::flush;
+}
+
+};
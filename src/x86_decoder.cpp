@@ -0,0 +1,448 @@
+// decode just enough of an x86-64 instruction to relocate it
+#include <x86_decoder.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace mini_debugger {
+
+// the architectural limit on the length of an instruction
+static constexpr std::size_t MAX_INSTRUCTION_LEN{ 15 };
+
+static bool
+is_legacy_prefix(const uint8_t byte)
+{
+	switch (byte) {
+		case 0x66: // operand size
+		case 0x67: // address size
+		case 0xf0: // lock
+		case 0xf2: // repne
+		case 0xf3: // rep
+		case 0x26: // segment overrides
+		case 0x2e:
+		case 0x36:
+		case 0x3e:
+		case 0x64:
+		case 0x65:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// opcodes of the one byte map which do not exist in 64 bit mode
+static bool
+is_invalid_in_64bit(const uint8_t op)
+{
+	switch (op) {
+		case 0x06:
+		case 0x07:
+		case 0x0e:
+		case 0x16:
+		case 0x17:
+		case 0x1e:
+		case 0x1f:
+		case 0x27:
+		case 0x2f:
+		case 0x37:
+		case 0x3f:
+		case 0x60:
+		case 0x61:
+		case 0x82:
+		case 0x9a:
+		case 0xce:
+		case 0xd4:
+		case 0xd5:
+		case 0xd6:
+		case 0xea:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool
+one_byte_has_modrm(const uint8_t op)
+{
+	// add, or, adc, sbb, and, sub, xor, cmp in their r/m forms
+	if (op < 0x40)
+		return (op & 0x7) < 4;
+	if (op >= 0x80 && op <= 0x8f)
+		return true;
+	if (op >= 0xd0 && op <= 0xd3)
+		return true;
+	// x87
+	if (op >= 0xd8 && op <= 0xdf)
+		return true;
+
+	switch (op) {
+		case 0x63:
+		case 0x69:
+		case 0x6b:
+		case 0xc0:
+		case 0xc1:
+		case 0xc6:
+		case 0xc7:
+		case 0xf6:
+		case 0xf7:
+		case 0xfe:
+		case 0xff:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static std::size_t
+one_byte_immediate_size(const uint8_t op,
+						const uint8_t modrm_reg,
+						const bool	  operand_size_16,
+						const bool	  address_size_32,
+						const bool	  rex_w)
+{
+	// immediates sized by the operand size are 32 bits (sign extended to 64
+	// bits) unless the 0x66 prefix is used
+	const std::size_t imm_z = operand_size_16 ? 2 : 4;
+
+	if (op < 0x40 && (op & 0x7) == 4)
+		return 1;
+	if (op < 0x40 && (op & 0x7) == 5)
+		return imm_z;
+	// jcc rel8
+	if (op >= 0x70 && op <= 0x7f)
+		return 1;
+	// mov r8, imm8
+	if (op >= 0xb0 && op <= 0xb7)
+		return 1;
+	// mov r, imm is the only instruction with a 64 bit immediate
+	if (op >= 0xb8 && op <= 0xbf)
+		return rex_w ? 8 : imm_z;
+	// mov al/ax/eax/rax <-> moffs
+	if (op >= 0xa0 && op <= 0xa3)
+		return address_size_32 ? 4 : 8;
+	// loop, jrcxz, in, out
+	if (op >= 0xe0 && op <= 0xe7)
+		return 1;
+
+	switch (op) {
+		case 0x6a:
+		case 0x6b:
+		case 0x80:
+		case 0x83:
+		case 0xa8:
+		case 0xc0:
+		case 0xc1:
+		case 0xc6:
+		case 0xcd:
+		case 0xeb:
+			return 1;
+		case 0x68:
+		case 0x69:
+		case 0x81:
+		case 0xa9:
+		case 0xc7:
+			return imm_z;
+		// call/jmp rel32 ignore the operand size prefix in 64 bit mode
+		case 0xe8:
+		case 0xe9:
+			return 4;
+		case 0xc2:
+		case 0xca:
+			return 2;
+		// enter imm16, imm8
+		case 0xc8:
+			return 3;
+		// test is the only member of the F6/F7 group with an immediate
+		case 0xf6:
+			return modrm_reg < 2 ? 1 : 0;
+		case 0xf7:
+			return modrm_reg < 2 ? imm_z : 0;
+		default:
+			return 0;
+	}
+}
+
+static bool
+two_byte_has_modrm(const uint8_t op)
+{
+	// jcc rel32
+	if (op >= 0x80 && op <= 0x8f)
+		return false;
+	// bswap
+	if (op >= 0xc8 && op <= 0xcf)
+		return false;
+	// wrmsr, rdtsc, rdmsr, rdpmc, sysenter, sysexit, getsec
+	if (op >= 0x30 && op <= 0x37)
+		return false;
+
+	switch (op) {
+		case 0x05: // syscall
+		case 0x06: // clts
+		case 0x07: // sysret
+		case 0x08: // invd
+		case 0x09: // wbinvd
+		case 0x0b: // ud2
+		case 0x0e: // femms
+		case 0x77: // emms
+		case 0xa0: // push fs
+		case 0xa1: // pop fs
+		case 0xa2: // cpuid
+		case 0xa8: // push gs
+		case 0xa9: // pop gs
+		case 0xaa: // rsm
+			return false;
+		default:
+			return true;
+	}
+}
+
+static std::size_t
+two_byte_immediate_size(const uint8_t op)
+{
+	if (op >= 0x80 && op <= 0x8f)
+		return 4;
+	// pshufw/pshufd/pshuflw/pshufhw and the shift groups
+	if (op >= 0x70 && op <= 0x73)
+		return 1;
+
+	switch (op) {
+		case 0x0f: // 3DNow! uses an imm8 as its opcode
+		case 0xa4: // shld imm8
+		case 0xac: // shrd imm8
+		case 0xba: // bt group imm8
+		case 0xc2: // cmpps
+		case 0xc4: // pinsrw
+		case 0xc5: // pextrw
+		case 0xc6: // shufps
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+std::optional<Decoded_Instruction>
+decode_instruction(const uint8_t* code, const std::size_t size)
+{
+	const std::size_t limit = std::min(size, MAX_INSTRUCTION_LEN);
+
+	Decoded_Instruction insn;
+	std::size_t			pos{ 0 };
+	bool				operand_size_16{ false };
+	bool				address_size_32{ false };
+	bool				rex_w{ false };
+
+	while (pos < limit && is_legacy_prefix(code[pos])) {
+		operand_size_16 |= code[pos] == 0x66;
+		address_size_32 |= code[pos] == 0x67;
+		++pos;
+	}
+	// REX has to be the last prefix
+	if (pos < limit && (code[pos] & 0xf0) == 0x40) {
+		rex_w = code[pos] & 0x08;
+		++pos;
+	}
+	if (pos >= limit)
+		return std::nullopt;
+
+	// opcode map: 1 = one byte, 2 = 0F, 3 = 0F 38, 4 = 0F 3A
+	int			map{ 1 };
+	bool		has_modrm{ false };
+	std::size_t imm_size{ 0 };
+	uint8_t		op = code[pos];
+
+	if (op == 0xc4 || op == 0xc5 || op == 0x62) {
+		// VEX (2 or 3 bytes) and EVEX (4 bytes) prefixes, they always
+		// describe instructions of the 0F maps
+		std::size_t prefix_len = op == 0xc5 ? 2 : (op == 0xc4 ? 3 : 4);
+		if (pos + prefix_len >= limit)
+			return std::nullopt;
+		int vex_map = op == 0xc5 ? 1
+								 : code[pos + 1] & (op == 0x62 ? 0x7 : 0x1f);
+		if (vex_map < 1 || vex_map > 3)
+			return std::nullopt;
+		map = vex_map + 1;
+		pos += prefix_len;
+		op = code[pos++];
+
+		// vzeroupper/vzeroall are the only VEX instructions without a ModRM
+		has_modrm = !(map == 2 && op == 0x77);
+		imm_size  = map == 4 ? 1 : 0;
+		if (map == 2 && two_byte_immediate_size(op) == 1)
+			imm_size = 1;
+	} else if (op == 0x0f) {
+		if (++pos >= limit)
+			return std::nullopt;
+		op = code[pos++];
+		if (op == 0x38 || op == 0x3a) {
+			map = op == 0x38 ? 3 : 4;
+			if (pos >= limit)
+				return std::nullopt;
+			op		  = code[pos++];
+			has_modrm = true;
+			imm_size  = map == 4 ? 1 : 0;
+		} else {
+			map		  = 2;
+			has_modrm = two_byte_has_modrm(op);
+			imm_size  = two_byte_immediate_size(op);
+			if (op >= 0x80 && op <= 0x8f) {
+				insn.branch	   = Branch_Kind::jcc;
+				insn.condition = op & 0x0f;
+			}
+		}
+	} else {
+		if (is_invalid_in_64bit(op))
+			return std::nullopt;
+		++pos;
+		has_modrm = one_byte_has_modrm(op);
+	}
+
+	uint8_t modrm_reg{ 0 };
+	if (has_modrm) {
+		if (pos >= limit)
+			return std::nullopt;
+		auto modrm = code[pos++];
+		auto mod   = modrm >> 6;
+		auto rm	   = modrm & 0x7;
+		modrm_reg  = (modrm >> 3) & 0x7;
+
+		std::size_t disp_size{ 0 };
+		if (mod != 3) {
+			if (rm == 4) {
+				if (pos >= limit)
+					return std::nullopt;
+				// SIB without a base register takes a disp32
+				auto sib = code[pos++];
+				if ((sib & 0x7) == 5 && mod == 0)
+					disp_size = 4;
+			}
+			if (mod == 0 && rm == 5) {
+				// in 64 bit mode this encodes [rip + disp32]
+				insn.rip_relative = true;
+				insn.disp_offset  = pos;
+				disp_size		  = 4;
+			} else if (mod == 1) {
+				disp_size = 1;
+			} else if (mod == 2) {
+				disp_size = 4;
+			}
+		}
+		pos += disp_size;
+	}
+
+	if (map == 1) {
+		imm_size = one_byte_immediate_size(
+			op, modrm_reg, operand_size_16, address_size_32, rex_w);
+
+		if (op >= 0x70 && op <= 0x7f) {
+			insn.branch	   = Branch_Kind::jcc;
+			insn.condition = op & 0x0f;
+		} else if (op >= 0xe0 && op <= 0xe3) {
+			insn.branch = Branch_Kind::loop;
+		} else if (op == 0xe8) {
+			insn.branch = Branch_Kind::call;
+		} else if (op == 0xe9 || op == 0xeb) {
+			insn.branch = Branch_Kind::jmp;
+		}
+	}
+
+	if (insn.branch != Branch_Kind::none) {
+		insn.branch_offset = pos;
+		insn.branch_size   = imm_size;
+	}
+	pos += imm_size;
+
+	if (pos > limit)
+		return std::nullopt;
+	insn.length = pos;
+	return insn;
+}
+
+std::intptr_t
+branch_target(const Decoded_Instruction& insn,
+			  const uint8_t*			 code,
+			  const std::intptr_t		 address)
+{
+	std::int32_t displacement{ 0 };
+	if (insn.branch_size == 1) {
+		displacement = static_cast<int8_t>(code[insn.branch_offset]);
+	} else {
+		std::memcpy(&displacement, code + insn.branch_offset, 4);
+	}
+	// relative to the end of the instruction
+	return address + insn.length + displacement;
+}
+
+// displacement from the end of an instruction at `next` to `target`, if it
+// fits into 32 bits
+static std::optional<std::int32_t>
+rel32(const std::intptr_t target, const std::intptr_t next)
+{
+	auto displacement = target - next;
+	if (displacement < std::numeric_limits<std::int32_t>::min() ||
+		displacement > std::numeric_limits<std::int32_t>::max())
+		return std::nullopt;
+	return static_cast<std::int32_t>(displacement);
+}
+
+static void
+append_rel32(std::vector<uint8_t>& out, const std::int32_t displacement)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(&displacement);
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+bool
+relocate_instruction(const Decoded_Instruction& insn,
+					 const uint8_t*				code,
+					 const std::intptr_t		from,
+					 const std::intptr_t		to,
+					 std::vector<uint8_t>&		out)
+{
+	if (insn.branch != Branch_Kind::none) {
+		auto target = branch_target(insn, code, from);
+		// re-encode the branch in its rel32 form, any prefix is dropped
+		std::optional<std::int32_t> displacement;
+		switch (insn.branch) {
+			case Branch_Kind::jmp:
+				displacement = rel32(target, to + 5);
+				if (!displacement)
+					return false;
+				out.emplace_back(0xe9);
+				break;
+			case Branch_Kind::call:
+				displacement = rel32(target, to + 5);
+				if (!displacement)
+					return false;
+				out.emplace_back(0xe8);
+				break;
+			case Branch_Kind::jcc:
+				displacement = rel32(target, to + 6);
+				if (!displacement)
+					return false;
+				out.emplace_back(0x0f);
+				out.emplace_back(0x80 | insn.condition);
+				break;
+			default:
+				return false;
+		}
+		append_rel32(out, *displacement);
+		return true;
+	}
+
+	auto start = out.size();
+	out.insert(out.end(), code, code + insn.length);
+	if (insn.rip_relative) {
+		std::int32_t displacement{};
+		std::memcpy(&displacement, code + insn.disp_offset, 4);
+		// keep pointing at the same absolute address from the new location
+		auto fixed =
+			rel32(from + insn.length + displacement, to + insn.length);
+		if (!fixed)
+			return false;
+		std::memcpy(out.data() + start + insn.disp_offset, &*fixed, 4);
+	}
+	return true;
+}
+
+};